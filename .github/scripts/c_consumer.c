@@ -0,0 +1,53 @@
+/*
+    A C program that uses the installed libfulgor: it opens the index given as first
+    argument and checks that the sequence given as second argument, taken from the
+    indexed references, is pseudoaligned to at least one color.
+
+    Usage: c_consumer <index> <sequence>
+*/
+
+#include <fulgor.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <index> <sequence>\n", argv[0]);
+        return 1;
+    }
+    if (fulgor_abi_version() != FULGOR_ABI_VERSION) {
+        fprintf(stderr, "ABI version mismatch\n");
+        return 1;
+    }
+
+    fulgor_index* index;
+    if (fulgor_index_open(argv[1], FULGOR_OPEN_DEFAULT, &index) != FULGOR_OK) {
+        fprintf(stderr, "%s\n", fulgor_last_error());
+        return 1;
+    }
+
+    const uint64_t capacity = fulgor_index_num_colors(index);
+    uint32_t* colors = malloc(capacity * sizeof(uint32_t));
+    const char* seqs[1] = {argv[2]};
+    const uint64_t lengths[1] = {strlen(argv[2])};
+    uint64_t offsets[2];
+    uint64_t num_processed = 0;
+    int status = fulgor_pseudoalign(index, seqs, lengths, 1, colors, capacity, offsets,
+                                    &num_processed);
+    if (status != FULGOR_OK) {
+        fprintf(stderr, "%s\n", fulgor_last_error());
+    } else if (num_processed != 1 || offsets[1] == offsets[0]) {
+        fprintf(stderr, "the sequence has no colors\n");
+        status = FULGOR_ERROR_INTERNAL;
+    } else {
+        printf("k = %lu, %lu colors, the sequence has %lu of them\n",
+               (unsigned long)fulgor_index_k(index), (unsigned long)capacity,
+               (unsigned long)(offsets[1] - offsets[0]));
+    }
+
+    free(colors);
+    fulgor_index_close(index);
+    return status == FULGOR_OK ? 0 : 1;
+}
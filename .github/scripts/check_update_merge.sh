@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+#
+# Check the update and merge tools against a fresh build on test_data/salmonella_10:
+# index A is built on the first 5 references and index B on the other 5; A and B are
+# merged, and A is updated with the references of B. Both results must have the same
+# references, the same color sets and the same pseudoalignment output as the index
+# built directly on all 10 references.
+#
+# Usage: check_update_merge.sh <build-dir> (where the fulgor executable is)
+
+set -euo pipefail
+
+FULGOR="$(cd "$1" && pwd)/fulgor"
+DATA="$(cd "$(dirname "$0")/../../test_data/salmonella_10" && pwd)"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+find "$DATA" -name '*.fasta.gz' | sort > all.txt
+head -n 5 all.txt > a.txt
+tail -n +6 all.txt > b.txt
+
+build() {  # <list> <basename>
+    "$FULGOR" build -l "$1" -o "$2" -k 31 -m 19 -d tmp -g 2 -t 2 > "$2.log"
+}
+build all.txt all
+build a.txt a
+build b.txt b
+"$FULGOR" merge -i a.fur,b.fur -o merged -d tmp -g 2 -t 2 > merged.log
+"$FULGOR" update -i a.fur -l b.txt -o updated -d tmp -g 2 -t 2 > updated.log
+
+# queries: 150 bp reads and single kmers (whose colors are the color set of the kmer)
+# sampled from all references
+python3 - "$DATA" > queries.fa <<'PY'
+import gzip, os, sys
+n = 0
+for name in sorted(os.listdir(sys.argv[1])):
+    with gzip.open(os.path.join(sys.argv[1], name), "rt") as f:
+        seqs = "".join(l.strip() if not l.startswith(">") else "\n" for l in f).split("\n")
+    for seq in seqs:
+        seq = seq.upper()
+        for i in range(0, len(seq) - 150, 997):
+            for length in (150, 31):
+                s = seq[i:i + length]
+                if set(s) <= set("ACGT"):
+                    print(f">q{n}\n{s}")
+                    n += 1
+PY
+
+# canonical form of an index: references, color sets and pseudoalignment output
+summarize() {  # <basename>
+    "$FULGOR" print-filenames -i "$1.fur" > "$1.filenames.txt"
+    "$FULGOR" dump -i "$1.fur" -o "$1" > /dev/null
+    cut -d ' ' -f 2- "$1.color_sets.txt" | sort > "$1.sorted_color_sets.txt"
+    "$FULGOR" pseudoalign -i "$1.fur" -q queries.fa -o "$1.full.txt" -t 2 > /dev/null
+    "$FULGOR" pseudoalign -i "$1.fur" -q queries.fa -o "$1.union.txt" -t 2 -r 0.8 > /dev/null
+    sort "$1.full.txt" -o "$1.full.txt"
+    sort "$1.union.txt" -o "$1.union.txt"
+}
+
+status=0
+summarize all
+for index in merged updated; do
+    summarize "$index"
+    for what in filenames.txt sorted_color_sets.txt full.txt union.txt; do
+        if cmp -s "all.$what" "$index.$what"; then
+            echo "$index: $what matches the fresh build"
+        else
+            echo "$index: $what differs from the fresh build"
+            diff "all.$what" "$index.$what" | head -n 20 || true
+            status=1
+        fi
+    done
+done
+echo "$(grep -c '>' queries.fa) queries"
+exit $status
@@ -1,16 +1,24 @@
 #pragma once
 
 #include "external/sketch/include/sketch/hll.h"
-#include "external/kmeans/include/kmeans.hpp"
+#include "include/clustering.hpp"
 
 namespace fulgor {
 
+/*
+    All threads update a single array of HLL registers, one sketch of 2^p bytes per reference,
+    with an atomic max. If the sketches of all the references do not fit in ram_limit_in_bytes,
+    the references are sketched in batches: every batch scans the color sets again, skipping
+    the references outside the batch, and is written to the output before the next one.
+*/
 void build_reference_sketches(index_type const& index,
                               uint64_t p,                  // use 2^p bytes per HLL sketch
                               uint64_t num_threads,        // num. threads for construction
+                              uint64_t ram_limit_in_bytes,  // for the sketches of a batch
                               std::string output_filename  // where the sketches will be serialized
 ) {
     assert(num_threads > 0);
+    assert(p > 0 and p < 32);
 
     const uint64_t num_colors = index.num_colors();
     typename sketch::hll_t::HashType hasher;
@@ -28,8 +36,13 @@ void build_reference_sketches(index_type const& index,
                                  ": reduce the number of threads.");
     }
 
-    std::vector<std::vector<sketch::hll_t>> thread_sketches(
-        num_threads, std::vector<sketch::hll_t>(num_colors, sketch::hll_t(p)));
+    const uint64_t num_bytes = 1ULL << p;
+    const uint64_t batch_size =
+        std::min<uint64_t>(num_colors, std::max<uint64_t>(ram_limit_in_bytes / num_bytes, 1));
+    const uint64_t num_batches = (num_colors + batch_size - 1) / batch_size;
+    std::cout << "sketching " << num_colors << " references in " << num_batches
+              << " batch(es) of at most " << batch_size << " references ("
+              << (batch_size * num_bytes) / (1024.0 * 1024.0) << " [MiB])" << std::endl;
 
     struct slice {
         uint64_t begin;                         // start position in u2c
@@ -88,59 +101,84 @@ void build_reference_sketches(index_type const& index,
         num_threads = thread_slices.size();
     }
 
+    /* registers of the references in [color_begin, color_end) */
+    std::vector<std::atomic<uint8_t>> registers(batch_size * num_bytes);
+    uint64_t color_begin = 0;
+    uint64_t color_end = 0;
+
+    /*
+        The register of a hash is given by its first p bits and
+        its value is the position of the leftmost 1 in the other 64-p bits.
+    */
+    struct update {
+        uint32_t reg;
+        uint8_t val;
+    };
+    auto to_update = [p](uint64_t hash) {
+        const uint64_t w = hash << p;
+        const uint8_t val = w ? __builtin_clzll(w) + 1 : 64 - p + 1;
+        return update{static_cast<uint32_t>(hash >> (64 - p)), val};
+    };
+
     auto exe = [&](uint64_t thread_id) {
         assert(thread_id < thread_slices.size());
-        auto& sketches = thread_sketches[thread_id];
         auto s = thread_slices[thread_id];
         uint64_t prev_pos = s.begin;
-        std::vector<uint64_t> hashes;
+        std::vector<update> updates;
         auto unary_it = u2c.get_iterator_at(s.begin);
         for (uint64_t color_id = s.color_id_begin; color_id != s.color_id_end; ++color_id) {
             uint64_t curr_pos = color_id != num_color_sets - 1 ? unary_it.next() : last_pos;
             auto it = ccs.color_set(color_id);
-            const uint64_t size = it.size();
-            hashes.reserve(curr_pos - prev_pos + 1);
-            for (uint64_t unitig_id = prev_pos; unitig_id <= curr_pos; ++unitig_id) {
-                assert(unitig_id < u2c.num_bits());
-                assert(index.u2c(unitig_id) == color_id);
-                hashes.push_back(hasher.hash(unitig_id));
-            }
-            for (uint64_t i = 0; i != size; ++i, ++it) {
-                uint32_t ref_id = *it;
-                assert(ref_id < num_colors);
-                for (auto hash : hashes) sketches[ref_id].add(hash);
+            it.next_geq(color_begin);
+            if (*it < color_end) {
+                updates.reserve(curr_pos - prev_pos + 1);
+                for (uint64_t unitig_id = prev_pos; unitig_id <= curr_pos; ++unitig_id) {
+                    assert(unitig_id < u2c.num_bits());
+                    assert(index.u2c(unitig_id) == color_id);
+                    updates.push_back(to_update(hasher.hash(unitig_id)));
+                }
+                for (; *it < color_end; ++it) {
+                    uint32_t ref_id = *it;
+                    assert(ref_id < num_colors);
+                    auto* sketch = registers.data() + (ref_id - color_begin) * num_bytes;
+                    for (auto [reg, val] : updates) {
+                        auto& r = sketch[reg];
+                        uint8_t old = r.load(std::memory_order_relaxed);
+                        while (old < val and
+                               !r.compare_exchange_weak(old, val, std::memory_order_relaxed)) {}
+                    }
+                }
+                updates.clear();
             }
             prev_pos = curr_pos + 1;
-            hashes.clear();
         }
     };
 
-    std::vector<std::thread> threads(num_threads);
-    for (uint64_t thread_id = 0; thread_id != num_threads; ++thread_id) {
-        threads[thread_id] = std::thread(exe, thread_id);
-    }
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
-    }
-
-    /* merge sketches into thread_sketches[0] */
-    for (uint64_t i = 0; i != num_colors; ++i) {
-        auto& sketch = thread_sketches[0][i];
-        for (uint64_t thread_id = 1; thread_id != num_threads; ++thread_id) {
-            sketch += thread_sketches[thread_id][i];
-        }
-    }
-
     std::ofstream out(output_filename, std::ios::binary);
     if (!out.is_open()) throw std::runtime_error("cannot open file");
-    const uint64_t num_bytes = 1ULL << p;
     out.write(reinterpret_cast<char const*>(&num_bytes), 8);
     out.write(reinterpret_cast<char const*>(&num_colors), 8);
-    for (auto const& x : thread_sketches[0]) {
-        assert(x.m() == num_bytes);
-        assert(x.m() == x.core().size());
-        uint8_t const* data = x.data();
-        out.write(reinterpret_cast<char const*>(data), num_bytes);
+
+    std::vector<uint8_t> buffer(num_bytes);
+    for (; color_begin != num_colors; color_begin = color_end) {
+        color_end = std::min(color_begin + batch_size, num_colors);
+        for (auto& r : registers) r.store(0, std::memory_order_relaxed);
+
+        std::vector<std::thread> threads(num_threads);
+        for (uint64_t thread_id = 0; thread_id != num_threads; ++thread_id) {
+            threads[thread_id] = std::thread(exe, thread_id);
+        }
+        for (auto& t : threads) {
+            if (t.joinable()) t.join();
+        }
+
+        for (uint64_t i = 0; i != color_end - color_begin; ++i) {
+            auto const* sketch = registers.data() + i * num_bytes;
+            for (uint64_t j = 0; j != num_bytes; ++j) {
+                buffer[j] = sketch[j].load(std::memory_order_relaxed);
+            }
+            out.write(reinterpret_cast<char const*>(buffer.data()), num_bytes);
+        }
     }
     out.close();
 }
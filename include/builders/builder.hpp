@@ -2,6 +2,8 @@
 
 #include "include/index.hpp"
 #include "include/GGCAT.hpp"
+#include "include/concurrency.hpp"
+#include "include/packed_unitigs.hpp"
 
 namespace fulgor {
 
@@ -61,6 +63,15 @@ struct index<ColorSets>::builder {
                                                 util::filename(m_build_config.file_base_name) +
                                                 ".sshash.fa";
 
+        /*
+            Unitigs, in color-set order, are kept 2-bit packed instead of being written
+            to a FASTA file; they spill to disk past half of the RAM limit.
+        */
+        packed_unitigs unitigs(m_build_config.tmp_dirname + "/" +
+                                   util::filename(m_build_config.file_base_name) +
+                                   ".unitigs.bin",
+                               (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2);
+
         {
             essentials::logger("step 2. build m_u2c and m_color_sets");
             timer.start();
@@ -72,61 +83,99 @@ struct index<ColorSets>::builder {
             // main_builder.reserve_num_bits(16 * essentials::GB * 8);
 
             const uint64_t num_threads = m_build_config.num_threads;
-            std::vector<typename ColorSets::builder> thread_builders(num_threads,
-                                                                     m_build_config.num_colors);
 
+            /*
+                Pipeline: the ggcat callback fills buffers of color sets (slots) and hands
+                them to num_threads encoders through a bounded queue; the encoding of each
+                slot is kept, by ticket, and all of them are concatenated in parallel into
+                main_builder once the callback is done. One slot more than the encoders
+                lets the callback keep filling while all encoders are busy.
+                Unitigs are handed to a writer thread.
+            */
+            const uint64_t num_slots = num_threads + 1;
             constexpr uint64_t MAX_BUFFER_SIZE = 1 << 28;
             uint64_t buffer_size = std::min(m_build_config.num_colors * 10000, MAX_BUFFER_SIZE);
-            std::vector<std::thread> threads(num_threads);
-            std::vector<buffer> thread_buffers(num_threads, buffer_size);
-
-            /* reserve for each build as much space as for the uncompressed buffers */
-            for (auto& b : thread_builders) b.reserve_num_bits(buffer_size * 32 / 8);
-
-            assert(thread_buffers[0].capacity() > m_build_config.num_colors);
-            uint32_t curr_thread = 0;
-            std::atomic<uint32_t> appending_thread = 0;
-
-            auto encode_color_sets_and_append = [&](uint64_t thread_id) {
-                buffer const& b = thread_buffers[thread_id];
-                thread_builders[thread_id].clear();
-                for (uint32_t i = 0, pos = 0; i < b.num_sets(); i++) {
-                    uint32_t size = b[pos++];
-                    thread_builders[thread_id].encode_color_set(b.data() + pos, size);
-                    pos += size;
+            std::vector<buffer> slot_buffers(num_slots, buffer_size);
+            std::vector<uint64_t> slot_tickets(num_slots, 0);
+            std::vector<typename ColorSets::builder> encoded_slots;  // by ticket
+            std::mutex encoded_slots_mutex;
+
+            assert(slot_buffers[0].capacity() > m_build_config.num_colors);
+
+            bounded_queue<uint32_t> free_slots(num_slots);
+            bounded_queue<uint32_t> full_slots(num_slots);
+            for (uint32_t i = 0; i != num_slots; ++i) free_slots.push(i);
+
+            auto encode_color_sets = [&]() {
+                uint32_t slot_id = 0;
+                while (full_slots.pop(slot_id)) {
+                    buffer& b = slot_buffers[slot_id];
+                    typename ColorSets::builder slot_builder(m_build_config.num_colors);
+                    for (uint32_t i = 0, pos = 0; i < b.num_sets(); i++) {
+                        uint32_t size = b[pos++];
+                        slot_builder.encode_color_set(b.data() + pos, size);
+                        pos += size;
+                    }
+                    const uint64_t ticket = slot_tickets[slot_id];
+                    b.clear();
+                    free_slots.push(slot_id);
+                    std::lock_guard<std::mutex> lock(encoded_slots_mutex);
+                    if (encoded_slots.size() <= ticket) encoded_slots.resize(ticket + 1);
+                    encoded_slots[ticket] = std::move(slot_builder);
                 }
-                while (appending_thread != thread_id) {}
-                main_builder.append(thread_builders[thread_id]);
-                appending_thread = (appending_thread + 1) % num_threads;
             };
 
+            std::vector<std::thread> threads(num_threads);
+            for (auto& t : threads) t = std::thread(encode_color_sets);
+
             bits::bit_vector::builder u2c_builder;
 
-            /* write unitigs to fasta file for SSHash */
-            std::ofstream out(input_filename_for_sshash.c_str());
-            if (!out.is_open()) throw std::runtime_error("cannot open output file");
+            /* pack unitigs for SSHash */
+            struct unitig_chunk {
+                std::string bases;
+                std::vector<uint32_t> lengths;
+            };
+            constexpr uint64_t UNITIG_CHUNK_SIZE = 1 << 22;  // bases
+            bounded_queue<unitig_chunk> unitig_chunks(8);
+            std::exception_ptr unitig_error = nullptr;
+            std::thread unitig_writer([&]() {
+                unitig_chunk chunk;
+                while (unitig_chunks.pop(chunk)) {
+                    /* after an error, keep draining so that the callback never blocks */
+                    if (unitig_error) continue;
+                    try {
+                        char const* data = chunk.bases.data();
+                        for (uint32_t length : chunk.lengths) {
+                            unitigs.push_back(data, length);
+                            data += length;
+                        }
+                    } catch (...) {
+                        unitig_error = std::current_exception();
+                    }
+                }
+            });
+            unitig_chunk curr_chunk;
+            curr_chunk.bases.reserve(UNITIG_CHUNK_SIZE);
+
+            uint32_t curr_slot = 0;
+            free_slots.pop(curr_slot);
+            uint64_t next_ticket = 0;
 
             m_ccdbg.loop_through_unitigs([&](ggcat::Slice<char> const unitig,
                                              ggcat::Slice<uint32_t> const color_set,
                                              bool same_color_set) {
-                assert(curr_thread >= 0);
-                assert(curr_thread < num_threads);
                 try {
                     if (!same_color_set) {
                         num_distinct_color_sets += 1;
                         if (num_unitigs > 0) u2c_builder.set(num_unitigs - 1, 1);
 
                         /* fill buffers */
-                        if (!thread_buffers[curr_thread].insert(color_set.data, color_set.size)) {
-                            threads[curr_thread] =
-                                std::thread(encode_color_sets_and_append, curr_thread);
-                            const uint32_t next_thread = (curr_thread + 1) % num_threads;
-                            if (threads[next_thread].joinable()) threads[next_thread].join();
-
-                            curr_thread = next_thread;
-
-                            thread_buffers[curr_thread].clear();
-                            thread_buffers[curr_thread].insert(color_set.data, color_set.size);
+                        if (!slot_buffers[curr_slot].insert(color_set.data, color_set.size)) {
+                            slot_tickets[curr_slot] = next_ticket++;
+                            full_slots.push(curr_slot);
+                            free_slots.pop(curr_slot);
+                            assert(slot_buffers[curr_slot].size() == 0);
+                            slot_buffers[curr_slot].insert(color_set.data, color_set.size);
                         }
                     }
                     u2c_builder.push_back(0);
@@ -136,9 +185,13 @@ struct index<ColorSets>::builder {
                         This is *not* the same order in which
                         unitigs are written in the ggcat.fa file.
                     */
-                    out << ">\n";
-                    out.write(unitig.data, unitig.size);
-                    out << '\n';
+                    curr_chunk.bases.append(unitig.data, unitig.size);
+                    curr_chunk.lengths.push_back(unitig.size);
+                    if (curr_chunk.bases.size() >= UNITIG_CHUNK_SIZE) {
+                        unitig_chunks.push(std::move(curr_chunk));
+                        curr_chunk = unitig_chunk();
+                        curr_chunk.bases.reserve(UNITIG_CHUNK_SIZE);
+                    }
 
                     num_unitigs += 1;
 
@@ -148,12 +201,24 @@ struct index<ColorSets>::builder {
                 }
             });
 
-            threads[curr_thread] = std::thread(encode_color_sets_and_append, curr_thread);
+            if (slot_buffers[curr_slot].num_sets() > 0) {
+                slot_tickets[curr_slot] = next_ticket++;
+                full_slots.push(curr_slot);
+            }
+            full_slots.close();
             for (auto& t : threads) {
                 if (t.joinable()) t.join();
             }
+            assert(encoded_slots.size() == next_ticket);
+            main_builder.append(encoded_slots, num_threads);
 
-            out.close();
+            if (!curr_chunk.lengths.empty()) unitig_chunks.push(std::move(curr_chunk));
+            unitig_chunks.close();
+            unitig_writer.join();
+            if (unitig_error) std::rethrow_exception(unitig_error);
+            std::cout << "packed unitigs: " << unitigs.num_bytes_in_memory()
+                      << " bytes in memory, " << unitigs.num_spilled_bytes()
+                      << " bytes spilled to disk" << std::endl;
 
             assert(num_unitigs > 0);
             assert(num_unitigs < (uint64_t(1) << 32));
@@ -197,10 +262,7 @@ struct index<ColorSets>::builder {
             sshash_config.tmp_dirname = m_build_config.tmp_dirname;
             sshash_config.num_threads = util::largest_power_of_2(m_build_config.num_threads);
             sshash_config.print();
-            idx.m_k2u.build(input_filename_for_sshash, sshash_config);
-            try {  // remove unitig file
-                std::remove(input_filename_for_sshash.c_str());
-            } catch (std::exception const& e) { std::cerr << e.what() << std::endl; }
+            unitigs.build_dictionary(idx.m_k2u, input_filename_for_sshash, sshash_config);
 
             timer.stop();
             std::cout << "** building m_k2u took " << timer.elapsed() << " seconds / "
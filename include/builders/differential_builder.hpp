@@ -1,46 +1,427 @@
 #pragma once
 
 #include "include/index.hpp"
+#include "include/concurrency.hpp"
 
 namespace fulgor {
+
+/* per-thread scratch space for encode_differential_groups, reused across groups */
+struct differential_scratch {
+    differential_scratch() : num_allocations(0) {}
+
+    void init(uint64_t num_colors) { distribution.assign(num_colors, 0); }
+
+    std::vector<uint32_t> distribution;    // num. of color sets of the group with each color
+    std::vector<uint32_t> colors;          // colors with distribution > 0
+    std::vector<uint32_t> representative;  // swapped with the one of the builder
+    uint64_t num_allocations;              // num. of times a buffer had to grow
+};
+
+/*
+    Storing color c in the representative of a group of g color sets, cnt of which
+    contain c, costs one integer in the representative plus one in the differences of
+    the g - cnt sets without c; leaving c out costs cnt integers. So c is worth keeping
+    only if 2 * cnt > g + 1.
+*/
+inline bool in_representative(uint64_t cnt, uint64_t g) { return 2 * cnt > g + 1; }
+
+/*
+    Encode the groups of color sets permutation[begin..end) with builder.
+    The representative of a group is made of the colors for which in_representative holds.
+    Only the colors that occur in the group are visited and reset,
+    so a group costs time proportional to the total size of its color sets.
+*/
+template <typename ColorSets>
+void encode_differential_groups(ColorSets const& color_sets,
+                                std::vector<std::pair<uint32_t, uint32_t>> const& permutation,
+                                uint64_t begin, uint64_t end, differential::builder& builder,
+                                differential_scratch& scratch) {
+    auto& distribution = scratch.distribution;
+    auto& colors = scratch.colors;
+    auto& representative = scratch.representative;
+    for (uint64_t g_begin = begin; g_begin != end;) {
+        const uint32_t group_id = permutation[g_begin].first;
+        uint64_t g_end = g_begin;
+        const uint64_t colors_capacity = colors.capacity();
+        const uint64_t representative_capacity = representative.capacity();
+        colors.clear();
+        for (; g_end != end and permutation[g_end].first == group_id; ++g_end) {
+            auto it = color_sets.color_set(permutation[g_end].second);
+            const uint64_t size = it.size();
+            for (uint64_t pos = 0; pos != size; ++pos, ++it) {
+                if (distribution[*it]++ == 0) colors.push_back(*it);
+            }
+        }
+        std::sort(colors.begin(), colors.end());
+
+        const uint64_t g_size = g_end - g_begin;
+        representative.clear();
+        for (uint32_t color : colors) {
+            if (in_representative(distribution[color], g_size)) representative.push_back(color);
+            distribution[color] = 0;
+        }
+        scratch.num_allocations += (colors.capacity() != colors_capacity) +
+                                   (representative.capacity() != representative_capacity);
+        builder.process_partition(representative);
+
+        for (uint64_t i = g_begin; i != g_end; ++i) {
+            auto it = color_sets.color_set(permutation[i].second);
+            builder.process_color_set(it);
+        }
+        g_begin = g_end;
+    }
+}
+
+/*
+    Split the groups of a differential permutation whenever giving two representatives
+    to a group lowers the number of integers to encode (representatives plus differences).
+    A group is split with 2-medoids seeded by its representative and by the member
+    farthest from it, and the halves are split again recursively, at most max_splits
+    times per group, so that the result depends neither on the speed of the machine nor
+    on the number of threads. Groups are refined in parallel; those whose color sets
+    have more than max_decoded_integers integers in total are left as they are, since
+    a group is decoded in memory to be refined. Groups are renumbered so that each
+    (sub)group has its own id.
+*/
+struct representative_refiner {
+    typedef std::vector<std::pair<uint32_t, uint32_t>> permutation_type;
+
+    struct statistics {
+        uint64_t num_groups_before = 0, num_groups_after = 0;
+        uint64_t num_integers_majority = 0;  // with a representative of the colors in >= 1/2
+        uint64_t num_integers_weighted = 0;  // with in_representative
+        uint64_t num_integers_after = 0;     // after splitting the groups
+        uint64_t num_groups_too_large = 0;   // not refined, see max_decoded_integers
+
+        void print() const {
+            std::cout << "representatives: " << num_groups_before << " groups -> "
+                      << num_groups_after << " groups (" << num_groups_too_large
+                      << " too large to be refined)\n";
+            std::cout << "  integers to encode: " << num_integers_majority << " (majority) / "
+                      << num_integers_weighted << " (weighted) / " << num_integers_after
+                      << " (after splits)" << std::endl;
+        }
+    };
+
+    template <typename ColorSets>
+    static statistics refine(ColorSets const& color_sets, permutation_type& permutation,
+                             uint64_t num_colors, uint64_t num_threads,
+                             const uint64_t max_splits) {
+        std::vector<uint64_t> group_begin;
+        for (uint64_t i = 0; i != permutation.size(); ++i) {
+            if (i == 0 or permutation[i].first != permutation[i - 1].first) {
+                group_begin.push_back(i);
+            }
+        }
+        const uint64_t num_groups = group_begin.size();
+        group_begin.push_back(permutation.size());
+
+        std::vector<uint32_t> sub_group(permutation.size(), 0);
+        std::vector<statistics> stats(num_threads);
+        std::atomic<uint64_t> next_group{0};
+        std::vector<std::thread> threads(num_threads);
+        for (uint64_t t = 0; t != num_threads; ++t) {
+            threads[t] = std::thread([&, t]() {
+                representative_refiner r(num_colors);
+                for (uint64_t i = next_group++; i < num_groups; i = next_group++) {
+                    r.refine_group(color_sets, permutation, sub_group, group_begin[i],
+                                   group_begin[i + 1], max_splits, stats[t]);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        statistics total;
+        total.num_groups_before = num_groups;
+        for (auto const& s : stats) {
+            total.num_integers_majority += s.num_integers_majority;
+            total.num_integers_weighted += s.num_integers_weighted;
+            total.num_integers_after += s.num_integers_after;
+            total.num_groups_too_large += s.num_groups_too_large;
+        }
+
+        /* renumber the groups */
+        uint32_t group_id = 0;
+        for (uint64_t i = 0, prev_group = 0; i != permutation.size(); ++i) {
+            if (i != 0 and (permutation[i].first != prev_group or
+                            sub_group[i] != sub_group[i - 1])) {
+                group_id += 1;
+            }
+            prev_group = permutation[i].first;
+            permutation[i].first = group_id;
+        }
+        total.num_groups_after = permutation.empty() ? 0 : group_id + 1;
+        return total;
+    }
+
+private:
+    static constexpr uint64_t min_group_size = 4;   // do not split smaller groups
+    static constexpr uint64_t max_iterations = 5;   // of 2-medoids
+    static constexpr uint64_t group_overhead = 2;   // size and offset of a representative
+    static constexpr uint64_t max_decoded_integers = uint64_t(1) << 26;  // 256 MiB per thread
+
+    representative_refiner(uint64_t num_colors) : m_count(num_colors, 0) {}
+
+    std::vector<uint32_t> m_count;
+    std::vector<uint32_t> m_colors;
+    std::vector<uint32_t> m_data;     // decoded color sets of the group
+    std::vector<uint64_t> m_offsets;  // in m_data
+
+    uint32_t const* set_begin(uint32_t m) const { return m_data.data() + m_offsets[m]; }
+    uint32_t const* set_end(uint32_t m) const { return m_data.data() + m_offsets[m + 1]; }
+
+    static uint64_t symmetric_difference(uint32_t const* a, uint32_t const* a_end,
+                                         std::vector<uint32_t> const& b) {
+        uint64_t common = 0;
+        const uint64_t a_size = a_end - a;
+        uint32_t const* x = b.data();
+        uint32_t const* x_end = x + b.size();
+        while (a != a_end and x != x_end) {
+            if (*a == *x) {
+                ++common, ++a, ++x;
+            } else if (*a < *x) {
+                ++a;
+            } else {
+                ++x;
+            }
+        }
+        return a_size + b.size() - 2 * common;
+    }
+
+    /* representative of members, and the number of integers needed to encode them with it */
+    uint64_t representative(std::vector<uint32_t> const& members, std::vector<uint32_t>& rep,
+                            uint64_t* num_integers_majority = nullptr) {
+        m_colors.clear();
+        uint64_t total_size = 0;
+        for (uint32_t m : members) {
+            total_size += set_end(m) - set_begin(m);
+            for (auto p = set_begin(m); p != set_end(m); ++p) {
+                if (m_count[*p]++ == 0) m_colors.push_back(*p);
+            }
+        }
+        std::sort(m_colors.begin(), m_colors.end());
+        const uint64_t g = members.size();
+        uint64_t num_integers = total_size;  // with an empty representative
+        uint64_t majority = total_size;
+        rep.clear();
+        for (uint32_t c : m_colors) {
+            const uint64_t cnt = m_count[c];
+            if (in_representative(cnt, g)) {
+                rep.push_back(c);
+                num_integers = num_integers + 1 + (g - cnt) - cnt;
+            }
+            if (cnt >= ceil(1. * g / 2.)) majority = majority + 1 + (g - cnt) - cnt;
+            m_count[c] = 0;
+        }
+        if (num_integers_majority) *num_integers_majority = majority;
+        return num_integers + group_overhead;
+    }
+
+    /*
+        Try to split members in two; on success return true with the two halves in left
+        and right, their representatives in rep_l and rep_r, and their costs in cost_l
+        and cost_r.
+    */
+    bool split(std::vector<uint32_t> const& members, std::vector<uint32_t> const& rep,
+               uint64_t parent_cost, std::vector<uint32_t>& left, std::vector<uint32_t>& right,
+               std::vector<uint32_t>& rep_l, std::vector<uint32_t>& rep_r, uint64_t& cost_l,
+               uint64_t& cost_r) {
+        /* seeds: the representative and the member farthest from it */
+        rep_l = rep;
+        uint64_t farthest = 0, max_d = 0;
+        for (uint32_t m : members) {
+            const uint64_t d = symmetric_difference(set_begin(m), set_end(m), rep);
+            if (d > max_d) max_d = d, farthest = m;
+        }
+        if (max_d == 0) return false;
+        rep_r.assign(set_begin(farthest), set_end(farthest));
+
+        std::vector<uint8_t> label(members.size(), 2), prev_label;
+        for (uint64_t iteration = 0; iteration != max_iterations; ++iteration) {
+            prev_label = label;
+            left.clear();
+            right.clear();
+            for (uint64_t i = 0; i != members.size(); ++i) {
+                const uint32_t m = members[i];
+                const uint64_t dl = symmetric_difference(set_begin(m), set_end(m), rep_l);
+                const uint64_t dr = symmetric_difference(set_begin(m), set_end(m), rep_r);
+                label[i] = dr < dl;
+                (label[i] ? right : left).push_back(m);
+            }
+            if (left.empty() or right.empty()) return false;
+            cost_l = representative(left, rep_l);
+            cost_r = representative(right, rep_r);
+            if (label == prev_label) break;
+        }
+        return cost_l + cost_r < parent_cost;
+    }
+
+    template <typename ColorSets>
+    void refine_group(ColorSets const& color_sets, permutation_type& permutation,
+                      std::vector<uint32_t>& sub_group, uint64_t begin, uint64_t end,
+                      const uint64_t max_splits, statistics& stats) {
+        const uint64_t g = end - begin;
+        uint64_t num_integers = 0;
+        for (uint64_t i = begin; i != end; ++i) {
+            num_integers += color_sets.color_set(permutation[i].second).size();
+        }
+        if (num_integers > max_decoded_integers) {
+            const uint64_t cost = num_integers + group_overhead;  // upper bound
+            stats.num_integers_majority += cost;
+            stats.num_integers_weighted += cost;
+            stats.num_integers_after += cost;
+            stats.num_groups_too_large += 1;
+            return;
+        }
+
+        m_data.clear();
+        m_offsets.assign(1, 0);
+        for (uint64_t i = begin; i != end; ++i) {
+            auto it = color_sets.color_set(permutation[i].second);
+            const uint64_t size = it.size();
+            for (uint64_t j = 0; j != size; ++j, ++it) m_data.push_back(*it);
+            m_offsets.push_back(m_data.size());
+        }
+
+        std::vector<uint32_t> members(g), rep;
+        for (uint64_t i = 0; i != g; ++i) members[i] = i;
+        uint64_t majority = 0;
+        const uint64_t cost = representative(members, rep, &majority);
+        stats.num_integers_majority += majority + group_overhead;
+        stats.num_integers_weighted += cost;
+
+        /* (members, representative, cost) of the groups still to be split */
+        struct candidate {
+            std::vector<uint32_t> members, rep;
+            uint64_t cost;
+        };
+        std::vector<candidate> todo;
+        std::vector<std::vector<uint32_t>> done;
+        todo.push_back({std::move(members), std::move(rep), cost});
+        uint64_t num_splits = 0;
+        while (!todo.empty()) {
+            auto c = std::move(todo.back());
+            todo.pop_back();
+            std::vector<uint32_t> left, right, rep_l, rep_r;
+            uint64_t cost_l = 0, cost_r = 0;
+            if (num_splits == max_splits or c.members.size() < min_group_size or
+                !split(c.members, c.rep, c.cost, left, right, rep_l, rep_r, cost_l, cost_r)) {
+                stats.num_integers_after += c.cost;
+                done.push_back(std::move(c.members));
+                continue;
+            }
+            num_splits += 1;
+            todo.push_back({std::move(right), std::move(rep_r), cost_r});
+            todo.push_back({std::move(left), std::move(rep_l), cost_l});
+        }
+        if (done.size() == 1) return;
+
+        /* lay out the sub-groups contiguously */
+        std::vector<std::pair<uint32_t, uint32_t>> tmp(permutation.begin() + begin,
+                                                       permutation.begin() + end);
+        uint64_t pos = begin;
+        for (uint32_t s = 0; s != done.size(); ++s) {
+            std::sort(done[s].begin(), done[s].end());
+            for (uint32_t m : done[s]) {
+                permutation[pos] = tmp[m];
+                sub_group[pos] = s;
+                ++pos;
+            }
+        }
+        assert(pos == end);
+    }
+};
+
 struct differential_permuter {
-    differential_permuter(build_configuration const& build_config)
-        : m_build_config(build_config), m_num_partitions(0) {}
+    /*
+        The name tags the temporary files and the log lines, so that several
+        permuters can run at the same time in the same directory.
+    */
+    differential_permuter(build_configuration const& build_config, std::string const& name = "")
+        : m_build_config(build_config), m_name(name), m_num_partitions(0) {}
 
     template <typename Index>
     void permute(Index const& index) {
         essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
         const std::vector<float> slices = {0, 0.25, 0.5, 0.75, 1};
         const uint64_t num_slices = slices.size() - 1;
+        constexpr uint64_t p = 10;
+        const std::string tag = m_name.empty() ? "" : "." + m_name + ".";
+        auto sketches_filename = [&](uint64_t slice_id) {
+            return "/sketches" + tag + std::to_string(slice_id) + ".bin";
+        };
+
+        std::vector<std::vector<uint64_t>> slice_color_set_ids(num_slices);
+        std::vector<clustering_data> clustering_data(num_slices);
+        std::vector<uint64_t> num_points(num_slices);
 
         {
-            essentials::logger("step 2. build sketches");
-
-            constexpr uint64_t p = 10;
-            for (uint64_t slice_id = 0; slice_id != num_slices; slice_id++) {
-                timer.start();
-                build_colors_sketches_sliced(
-                    index, p, m_build_config.num_threads,
-                    m_build_config.tmp_dirname + "/sketches" + std::to_string(slice_id) + ".bin",
-                    slices[slice_id], slices[slice_id + 1]);
-                timer.stop();
-                std::cout << "** building sketches took " << timer.elapsed() << " seconds / "
-                          << timer.elapsed() / 60 << " minutes" << std::endl;
-                timer.reset();
+            essentials::logger("step 2-3. build and cluster sketches" +
+                               (m_name.empty() ? "" : " (" + m_name + ")"));
+
+            /*
+                The slices are independent: each slice is sketched and then clustered,
+                and a slice can be clustered while the others are still being sketched.
+                The threads are split among the slices; the sketches of a slice live
+                both in the sketching and in the clustering task.
+            */
+            const uint64_t num_colors = index.num_colors();
+            std::vector<uint64_t> slice_size(num_slices, 0);
+            for (uint64_t color_set_id = 0; color_set_id != index.num_color_sets();
+                 ++color_set_id) {
+                const uint64_t size = index.color_set(color_set_id).size();
+                for (uint64_t slice_id = 0; slice_id != num_slices; ++slice_id) {
+                    /* same bounds as in build_colors_sketches_sliced */
+                    const double min_size = double(slices[slice_id]) * num_colors;
+                    const double max_size = double(slices[slice_id + 1]) * num_colors;
+                    if (size > min_size and size <= max_size) {
+                        slice_size[slice_id] += 1;
+                        break;
+                    }
+                }
+            }
+
+            const uint64_t num_threads_per_slice =
+                std::max<uint64_t>(m_build_config.num_threads / num_slices, 1);
+            task_graph graph;
+            for (uint64_t slice_id = 0; slice_id != num_slices; ++slice_id) {
+                const uint64_t memory = slice_size[slice_id] * ((1ULL << p) + sizeof(uint64_t));
+                const std::string suffix =
+                    " slice " + std::to_string(slice_id) + (m_name.empty() ? "" : " " + m_name);
+                uint64_t sketch_task = graph.add(
+                    "sketch" + suffix,
+                    [&, slice_id](uint64_t) {
+                        build_colors_sketches_sliced(
+                            index, p, num_threads_per_slice,
+                            m_build_config.tmp_dirname + sketches_filename(slice_id),
+                            slices[slice_id], slices[slice_id + 1]);
+                    },
+                    {}, memory);
+                graph.add(
+                    "cluster" + suffix,
+                    [&, slice_id](uint64_t) {
+                        num_points[slice_id] =
+                            cluster(sketches_filename(slice_id), num_threads_per_slice,
+                                    clustering_data[slice_id], slice_color_set_ids[slice_id]);
+                    },
+                    {sketch_task}, memory);
             }
+            graph.run(std::min<uint64_t>(num_slices, m_build_config.num_threads),
+                      (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2);
         }
 
         {
-            essentials::logger("step 3. clustering sketches");
-
+            std::ostringstream report;
             std::vector<uint64_t> color_set_ids;
-            std::vector<kmeans::cluster_data> clustering_data(num_slices);
-            std::vector<uint64_t> num_points(num_slices);
-
             for (uint64_t slice_id = 0; slice_id < num_slices; slice_id++) {
-                num_points[slice_id] = cluster("/sketches" + std::to_string(slice_id) + ".bin",
-                                               clustering_data[slice_id], color_set_ids);
+                report << (m_name.empty() ? "" : m_name + " ") << "slice " << slice_id << ": "
+                       << num_points[slice_id] << " color sets, "
+                       << clustering_data[slice_id].num_clusters << " clusters\n";
+                if (num_points[slice_id] != 0) clustering_data[slice_id].print_report(report);
+                color_set_ids.insert(color_set_ids.end(), slice_color_set_ids[slice_id].begin(),
+                                     slice_color_set_ids[slice_id].end());
             }
+            std::cout << report.str() << std::flush;
 
             timer.start();
 
@@ -127,69 +508,44 @@ struct differential_permuter {
 
 private:
     build_configuration m_build_config;
+    std::string m_name;
     uint64_t m_num_partitions, m_num_colors;
     std::vector<std::pair<uint32_t, uint32_t>> m_permutation;
     std::vector<uint32_t> m_partition_size;
 
-    uint64_t cluster(std::string filename, kmeans::cluster_data& clustering_data,
+    uint64_t cluster(std::string filename, uint64_t num_threads, clustering_data& data,
                      std::vector<uint64_t>& color_set_ids) {
-        essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
-        timer.start();
-
         std::ifstream in(m_build_config.tmp_dirname + filename, std::ios::binary);
         if (!in.is_open()) throw std::runtime_error("error in opening file");
 
-        std::vector<kmeans::point> points;
-        std::vector<uint64_t> group_color_set_ids;
+        sketch_points points;
         uint64_t num_bytes_per_point = 0;
         uint64_t num_points = 0;
         uint64_t num_colors = 0;
         in.read(reinterpret_cast<char*>(&num_bytes_per_point), sizeof(uint64_t));
         in.read(reinterpret_cast<char*>(&num_colors), sizeof(uint64_t));
         in.read(reinterpret_cast<char*>(&num_points), sizeof(uint64_t));
-        points.resize(num_points, kmeans::point(num_bytes_per_point));
-        group_color_set_ids.resize(num_points);
-        for (uint64_t i = 0; i != num_points; ++i) {
-            in.read(reinterpret_cast<char*>(&group_color_set_ids[i]), sizeof(uint64_t));
-        }
-        for (auto& point : points) {
-            in.read(reinterpret_cast<char*>(point.data()), num_bytes_per_point);
-        }
+        points.resize(num_points, num_bytes_per_point);
+        color_set_ids.resize(num_points);
+        in.read(reinterpret_cast<char*>(color_set_ids.data()), num_points * sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(points.data(0)), num_points * num_bytes_per_point);
         in.close();
         std::remove((m_build_config.tmp_dirname + filename).c_str());
 
-        {
-            essentials::timer<std::chrono::high_resolution_clock, std::chrono::milliseconds> timer;
-            timer.start();
-            if (num_points == 0) {
-                std::cout << "Found empty partition" << endl;
-                clustering_data.num_clusters = 0;
-                clustering_data.clusters = {};
-                return 0;
-            } else {
-                kmeans::clustering_parameters params;
-                float min_delta = 0.0001;
-                float max_iteration = 10;
-                uint64_t min_cluster_size = 0;
-                uint64_t seed = 0;
-                params.set_min_delta(min_delta);
-                params.set_max_iteration(max_iteration);
-                params.set_min_cluster_size(min_cluster_size);
-                params.set_random_seed(seed);
-                params.set_num_threads(m_build_config.num_threads);
-                clustering_data = kmeans::kmeans_divisive(points.begin(), points.end(), params);
-            }
-            timer.stop();
-            std::cout << "  ** ONLY clustering sketches took " << timer.elapsed() / 1000
-                      << " seconds / " << timer.elapsed() / (60 * 1000) << " minutes" << std::endl;
+        if (num_points == 0) {
+            data.num_clusters = 0;
+            data.clusters = {};
+            return 0;
         }
 
-        color_set_ids.insert(color_set_ids.end(), group_color_set_ids.begin(),
-                             group_color_set_ids.end());
-
-        timer.stop();
-        std::cout << "** clustering sketches took " << timer.elapsed() << " seconds / "
-                  << timer.elapsed() / 60 << " minutes" << std::endl;
+        clustering_parameters params;
+        params.min_delta = 0.0001;
+        params.max_iteration = 10;
+        params.min_cluster_size = 0;
+        params.mini_batch_size = m_build_config.clustering_mini_batch_size;
+        params.seed = 0;
+        params.num_threads = num_threads;
+        data = kmeans_divisive(points, params);
 
         return num_points;
     }
@@ -215,12 +571,25 @@ struct index<ColorSets>::differential_builder {
 
         differential_permuter p(m_build_config);
         p.permute(index);
-        auto const& permutation = p.permutation();
+        auto permutation = p.permutation();
         const uint64_t num_partitions = p.num_partitions();
         const uint64_t num_color_sets = index.num_color_sets();
         const uint64_t num_colors = index.num_colors();
         std::cout << "num_partitions = " << num_partitions << std::endl;
 
+        if (m_build_config.max_representative_splits > 0) {
+            essentials::logger("step 3b. refining representatives");
+            timer.start();
+            auto stats = representative_refiner::refine(index, permutation, num_colors,
+                                                        num_threads,
+                                                        m_build_config.max_representative_splits);
+            stats.print();
+            timer.stop();
+            std::cout << "** refining representatives took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
         {
             essentials::logger("step 4. building differential color sets");
             timer.start();
@@ -256,49 +625,14 @@ struct index<ColorSets>::differential_builder {
                                                                      num_colors);
             std::vector<std::thread> threads(thread_slices.size());
 
+            std::vector<differential_scratch> scratches(thread_slices.size());
+
             auto encode_color_sets = [&](uint64_t thread_id) {
-                auto& color_sets_builder = thread_builders[thread_id];
                 auto& [begin, end] = thread_slices[thread_id];
-                color_sets_builder.reserve_num_bits(16 * essentials::GB * 8);
-
-                std::vector<uint64_t> group_endpoints;
-                uint64_t curr_group = permutation[begin].first + 1;  // different from first group
-                for (uint64_t i = begin; i < end; i++) {
-                    auto& [group_id, color_set_id] = permutation[i];
-                    if (group_id != curr_group) {
-                        group_endpoints.push_back(i);
-                        curr_group = group_id;
-                    }
-                }
-                group_endpoints.push_back(end);
-
-                std::vector<uint32_t> distribution(num_colors, 0);
-                for (uint64_t group = 0; group < group_endpoints.size() - 1; ++group) {
-                    uint64_t g_begin = group_endpoints[group];
-                    uint64_t g_end = group_endpoints[group + 1];
-                    std::vector<uint32_t> representative;
-                    representative.reserve(num_colors);
-
-                    for (uint64_t i = g_begin; i < g_end; ++i) {
-                        auto& [group_id, color_set_id] = permutation[i];
-                        auto it = index.color_set(color_set_id);
-                        uint64_t it_size = it.size();
-                        for (uint64_t pos = 0; pos < it_size; ++pos, ++it) { distribution[*it]++; }
-                    }
-                    uint64_t g_size = g_end - g_begin;
-                    for (uint64_t color = 0; color < num_colors; ++color) {
-                        if (distribution[color] >= ceil(1. * g_size / 2.))
-                            representative.push_back(color);
-                    }
-                    color_sets_builder.process_partition(representative);
-
-                    for (uint64_t i = g_begin; i < g_end; ++i) {
-                        auto& [group_id, color_set_id] = permutation[i];
-                        auto it = index.color_set(color_set_id);
-                        color_sets_builder.process_color_set(it);
-                    }
-                    std::fill(distribution.begin(), distribution.end(), 0);
-                }
+                auto& scratch = scratches[thread_id];
+                scratch.init(num_colors);
+                encode_differential_groups(index, permutation, begin, end,
+                                           thread_builders[thread_id], scratch);
             };
 
             for (uint64_t thread_id = 0; thread_id < thread_slices.size(); thread_id++) {
@@ -308,9 +642,14 @@ struct index<ColorSets>::differential_builder {
                 if (t.joinable()) t.join();
             }
 
+            uint64_t num_allocations = 0;
+            for (auto const& scratch : scratches) num_allocations += scratch.num_allocations;
             for (uint64_t thread_id = 1; thread_id < thread_builders.size(); thread_id++) {
                 thread_builders[0].append(thread_builders[thread_id]);
             }
+            num_allocations += thread_builders[0].num_scratch_allocations();
+            std::cout << "scratch buffer allocations: " << num_allocations << " for "
+                      << num_color_sets << " color sets" << std::endl;
             thread_builders[0].build(idx.m_color_sets);
 
             timer.stop();
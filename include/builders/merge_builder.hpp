@@ -0,0 +1,390 @@
+#pragma once
+
+#include "include/index.hpp"
+#include "include/concurrency.hpp"
+#include "include/packed_unitigs.hpp"
+
+namespace fulgor {
+
+/*
+    Merge indexes built on disjoint sets of references (shards) into one index.
+    The colors of shard s are shifted by the number of colors of shards 0..s-1.
+    A kmer is owned by the first shard that contains it: the unitigs of each shard
+    are split into maximal runs of owned kmers that share the same color set in
+    every later shard (or are absent from it). The runs of a shard are visited in
+    the order of its color sets, so that runs found only in that shard are streamed
+    as they are found, and only the runs shared with later shards of a single color
+    set are sorted in memory.
+
+    All the shards are loaded at once, since each kmer is looked up in every other
+    shard: the peak memory is the sum of the shard indexes plus the merged index
+    being built.
+*/
+template <typename ColorSets>
+struct index<ColorSets>::merge_builder {
+    merge_builder() {}
+
+    merge_builder(build_configuration const& build_config,
+                  std::vector<std::string> const& index_filenames)
+        : m_build_config(build_config), m_index_filenames(index_filenames) {}
+
+    void build(index& idx) {
+        if (idx.m_k2u.size() != 0) throw std::runtime_error("index already built");
+        if (m_index_filenames.size() < 2) {
+            throw std::runtime_error("at least two indexes are needed for merging");
+        }
+
+        const uint64_t num_shards = m_index_filenames.size();
+        std::vector<index_type> shards(num_shards);
+        std::vector<uint32_t> color_offsets(num_shards + 1, 0);
+        essentials::logger("step 1. loading indexes to be merged...");
+        for (uint64_t s = 0; s != num_shards; ++s) {
+            essentials::load(shards[s], m_index_filenames[s].c_str());
+            if (shards[s].k() != shards[0].k()) {
+                throw std::runtime_error("indexes must be built with the same k");
+            }
+            color_offsets[s + 1] = color_offsets[s] + shards[s].num_colors();
+        }
+        essentials::logger("DONE");
+
+        const uint64_t num_colors = color_offsets.back();
+        std::cout << "num_shards " << num_shards << std::endl;
+        std::cout << "num_colors " << num_colors << std::endl;
+
+        essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+
+        packed_unitigs unitigs(m_build_config.tmp_dirname + "/" +
+                                   util::filename(m_build_config.file_base_name) +
+                                   ".unitigs.bin",
+                               (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2);
+
+        {
+            essentials::logger("step 2. build m_u2c and m_color_sets");
+            timer.start();
+
+            typename ColorSets::builder color_sets_builder(num_colors);
+            bits::bit_vector::builder u2c_builder;
+            uint64_t num_unitigs = 0;
+            uint64_t num_shared_color_sets = 0;
+
+            /* append the color sets of a block, and their unitigs, to the merged index */
+            auto append = [&](merged_block const& block) {
+                char const* data = block.bases.data();
+                uint64_t i = 0;
+                uint64_t colors_begin = 0;
+                for (uint64_t j = 0; j != block.unitigs_end.size(); ++j) {
+                    for (; i != block.unitigs_end[j]; ++i) {
+                        unitigs.push_back(data, block.lengths[i]);
+                        data += block.lengths[i];
+                        u2c_builder.push_back(0);
+                        num_unitigs += 1;
+                    }
+                    assert(num_unitigs > 0);
+                    u2c_builder.set(num_unitigs - 1, 1);
+                    color_sets_builder.encode_color_set(block.colors.data() + colors_begin,
+                                                        block.colors_end[j] - colors_begin);
+                    colors_begin = block.colors_end[j];
+                }
+                num_shared_color_sets += block.num_shared_color_sets;
+            };
+
+            /*
+                The unitigs of each shard are split into blocks that end at the boundary of
+                a color set. The blocks are merged in parallel, since looking up their kmers
+                in the other shards is most of the work, and appended in order.
+            */
+            constexpr uint64_t min_unitigs_per_block = 1 << 12;
+            const uint64_t num_threads = std::max<uint64_t>(m_build_config.num_threads, 1);
+            for (uint64_t s = 0; s != num_shards; ++s) {
+                auto const& shard = shards[s];
+                std::vector<uint64_t> block_begins;
+                for (uint64_t u = 0; u != shard.num_unitigs();) {
+                    block_begins.push_back(u);
+                    u = std::min(u + min_unitigs_per_block, shard.num_unitigs());
+                    while (u != shard.num_unitigs() and shard.u2c(u) == shard.u2c(u - 1)) ++u;
+                }
+                block_begins.push_back(shard.num_unitigs());
+                const uint64_t num_blocks = block_begins.size() - 1;
+
+                std::atomic<uint64_t> next_block{0};
+                turnstile append_order;
+                std::vector<std::thread> threads(std::min(num_threads, num_blocks));
+                for (auto& t : threads) {
+                    t = std::thread([&]() {
+                        merged_block block(num_shards);
+                        for (uint64_t b = next_block++; b < num_blocks; b = next_block++) {
+                            merge_block(shards, color_offsets, s, block_begins[b],
+                                        block_begins[b + 1], block);
+                            append_order.run_in_order(b, [&]() { append(block); });
+                        }
+                    });
+                }
+                for (auto& t : threads) t.join();
+                std::cout << "merged shard " << s + 1 << "/" << num_shards << std::endl;
+            }
+
+            std::cout << "num_unitigs " << num_unitigs << std::endl;
+            std::cout << "num. color sets of kmers in more than one shard "
+                      << num_shared_color_sets << std::endl;
+
+            color_sets_builder.build(idx.m_color_sets);
+            u2c_builder.build(idx.m_u2c);
+            idx.m_u2c_rank1_index.build(idx.m_u2c);
+            assert(idx.m_u2c.num_bits() == num_unitigs);
+
+            timer.stop();
+            std::cout << "** building m_u2c and m_color_sets took " << timer.elapsed()
+                      << " seconds / " << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 3. build m_k2u");
+            timer.start();
+
+            auto const& dict = shards[0].get_k2u();
+            sshash::build_configuration sshash_config;
+            sshash_config.k = dict.k();
+            sshash_config.m = dict.m();
+            assert(dict.canonical() == true);
+            sshash_config.canonical = dict.canonical();
+            sshash_config.verbose = m_build_config.verbose;
+            sshash_config.tmp_dirname = m_build_config.tmp_dirname;
+            sshash_config.num_threads = util::largest_power_of_2(m_build_config.num_threads);
+            sshash_config.print();
+            unitigs.build_dictionary(idx.m_k2u,
+                                     m_build_config.tmp_dirname + "/" +
+                                         util::filename(m_build_config.file_base_name) +
+                                         ".sshash.fa",
+                                     sshash_config);
+
+            timer.stop();
+            std::cout << "** building m_k2u took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 4. write filenames");
+            timer.start();
+            std::vector<std::string> filenames;
+            filenames.reserve(num_colors);
+            for (auto const& shard : shards) {
+                for (uint64_t i = 0; i != shard.num_colors(); ++i) {
+                    filenames.emplace_back(shard.filename(i));
+                }
+            }
+            idx.m_filenames.build(filenames);
+            timer.stop();
+            std::cout << "** writing filenames took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        if (m_build_config.check) {
+            essentials::logger("step 5. check correctness...");
+            std::vector<uint32_t> expected, got;
+            for (uint64_t s = 0; s != num_shards; ++s) {
+                auto const& dict = shards[s].get_k2u();
+                for (uint64_t unitig_id = 0; unitig_id != shards[s].num_unitigs(); ++unitig_id) {
+                    auto it = dict.at_contig_id(unitig_id);
+                    while (it.has_next()) {
+                        auto [_, kmer] = it.next();
+                        expected.clear();
+                        for (uint64_t r = 0; r != num_shards; ++r) {
+                            auto answer = shards[r].get_k2u().lookup_advanced(kmer.c_str());
+                            if (answer.kmer_id == sshash::constants::invalid_uint64) continue;
+                            auto c_it = shards[r].color_set(shards[r].u2c(answer.contig_id));
+                            for (uint64_t j = 0; j != c_it.size(); ++j, ++c_it) {
+                                expected.push_back(*c_it + color_offsets[r]);
+                            }
+                        }
+                        got.clear();
+                        auto answer = idx.m_k2u.lookup_advanced(kmer.c_str());
+                        if (answer.kmer_id == sshash::constants::invalid_uint64) {
+                            std::cout << "kmer " << kmer << " not found" << std::endl;
+                            return;
+                        }
+                        auto c_it = idx.color_set(idx.u2c(answer.contig_id));
+                        for (uint64_t j = 0; j != c_it.size(); ++j, ++c_it) {
+                            got.push_back(*c_it);
+                        }
+                        if (got != expected) {
+                            std::cout << "wrong color set for kmer " << kmer << std::endl;
+                            return;
+                        }
+                    }
+                }
+            }
+            essentials::logger("DONE!");
+        }
+    }
+
+private:
+    build_configuration m_build_config;
+    std::vector<std::string> m_index_filenames;
+
+    /* runs of kmers shared with later shards, for the current color set */
+    struct run {
+        uint64_t key_begin;  // in keys
+        uint64_t begin;      // in run_bases
+        uint32_t length;
+    };
+
+    /* the merged color sets of a block of unitigs of a shard, in order */
+    struct merged_block {
+        merged_block(uint64_t num_shards) : key(num_shards), run_key(num_shards) {}
+
+        std::string bases;  // of the unitigs
+        std::vector<uint32_t> lengths;
+        std::vector<uint64_t> unitigs_end;  // in lengths, for each color set
+        std::vector<uint32_t> colors;
+        std::vector<uint64_t> colors_end;  // in colors, for each color set
+        uint64_t num_shared_color_sets;
+
+        /* scratch space */
+        std::vector<run> runs;
+        std::vector<uint32_t> keys;
+        std::string run_bases;
+        std::vector<uint32_t> key, run_key;
+        std::string seq;
+    };
+
+    /*
+        Merge the color sets of the unitigs [unitig_begin, unitig_end) of shard s, which
+        start and end at the boundaries of color sets.
+    */
+    static void merge_block(std::vector<index_type> const& shards,
+                            std::vector<uint32_t> const& color_offsets, const uint64_t s,
+                            const uint64_t unitig_begin, const uint64_t unitig_end,
+                            merged_block& block) {
+        constexpr uint32_t none = -1;  // the kmer is not in the shard
+        const uint64_t num_shards = shards.size();
+        const uint64_t k = shards[0].k();
+        auto const& shard = shards[s];
+        const uint64_t key_size = num_shards - s - 1;  // color sets in later shards
+        auto shard_key_equal = [&](uint64_t x, uint64_t y) {
+            return std::equal(block.keys.begin() + x, block.keys.begin() + x + key_size,
+                              block.keys.begin() + y);
+        };
+
+        block.bases.clear();
+        block.lengths.clear();
+        block.unitigs_end.clear();
+        block.colors.clear();
+        block.colors_end.clear();
+        block.num_shared_color_sets = 0;
+        auto add_unitig = [&](char const* data, uint64_t size) {
+            block.bases.append(data, size);
+            block.lengths.push_back(size);
+        };
+        auto add_colors = [&](uint64_t r, uint64_t color_set_id) {
+            auto it = shards[r].color_set(color_set_id);
+            const uint64_t size = it.size();
+            for (uint64_t i = 0; i != size; ++i, ++it) {
+                block.colors.push_back(*it + color_offsets[r]);
+            }
+        };
+        auto close_color_set = [&]() {
+            block.unitigs_end.push_back(block.lengths.size());
+            block.colors_end.push_back(block.colors.size());
+        };
+
+        auto& runs = block.runs;
+        auto& keys = block.keys;
+        auto& run_bases = block.run_bases;
+        auto& key = block.key;
+        auto& run_key = block.run_key;
+        auto& seq = block.seq;
+
+        for (uint64_t unitig_id = unitig_begin; unitig_id != unitig_end;) {
+            const uint64_t color_set_id = shard.u2c(unitig_id);
+            bool any = false;
+            runs.clear();
+            keys.clear();
+            run_bases.clear();
+
+            for (; unitig_id != unitig_end and shard.u2c(unitig_id) == color_set_id;
+                 ++unitig_id) {
+                auto it = shard.get_k2u().at_contig_id(unitig_id);
+                seq.clear();
+                bool has_run = false;
+                auto flush = [&]() {
+                    if (seq.empty()) return;
+                    const bool shared = std::any_of(run_key.begin() + s + 1, run_key.end(),
+                                                    [](uint32_t id) { return id != none; });
+                    if (shared) {
+                        runs.push_back({keys.size(), run_bases.size(),
+                                        static_cast<uint32_t>(seq.size())});
+                        keys.insert(keys.end(), run_key.begin() + s + 1, run_key.end());
+                        run_bases.append(seq);
+                    } else {
+                        add_unitig(seq.data(), seq.size());
+                        any = true;
+                    }
+                    seq.clear();
+                };
+
+                while (it.has_next()) {
+                    auto [_, kmer] = it.next();
+                    /* owned by an earlier shard? */
+                    bool owned = true;
+                    for (uint64_t r = 0; r != s and owned; ++r) {
+                        auto answer = shards[r].get_k2u().lookup_advanced(kmer.c_str());
+                        owned = answer.kmer_id == sshash::constants::invalid_uint64;
+                    }
+                    if (!owned) {
+                        flush();
+                        has_run = false;
+                        continue;
+                    }
+                    std::fill(key.begin(), key.end(), none);
+                    key[s] = color_set_id;
+                    for (uint64_t r = s + 1; r != num_shards; ++r) {
+                        auto answer = shards[r].get_k2u().lookup_advanced(kmer.c_str());
+                        if (answer.kmer_id != sshash::constants::invalid_uint64) {
+                            key[r] = shards[r].u2c(answer.contig_id);
+                        }
+                    }
+                    if (has_run and key != run_key) flush();
+                    if (seq.empty()) {
+                        seq = kmer;
+                    } else {
+                        seq.push_back(kmer[k - 1]);
+                    }
+                    run_key = key;
+                    has_run = true;
+                }
+                flush();
+            }
+
+            /* kmers found only in this shard */
+            if (any) {
+                add_colors(s, color_set_id);
+                close_color_set();
+            }
+
+            /* kmers shared with later shards, grouped by their color sets */
+            std::sort(runs.begin(), runs.end(), [&](run const& x, run const& y) {
+                return std::lexicographical_compare(
+                    keys.begin() + x.key_begin, keys.begin() + x.key_begin + key_size,
+                    keys.begin() + y.key_begin, keys.begin() + y.key_begin + key_size);
+            });
+            for (uint64_t i = 0; i != runs.size();) {
+                const uint64_t key_begin = runs[i].key_begin;
+                for (; i != runs.size() and shard_key_equal(runs[i].key_begin, key_begin); ++i) {
+                    add_unitig(run_bases.data() + runs[i].begin, runs[i].length);
+                }
+                add_colors(s, color_set_id);
+                for (uint64_t r = s + 1; r != num_shards; ++r) {
+                    const uint32_t id = keys[key_begin + r - s - 1];
+                    if (id != none) add_colors(r, id);
+                }
+                close_color_set();
+                block.num_shared_color_sets += 1;
+            }
+        }
+    }
+};
+
+}  // namespace fulgor
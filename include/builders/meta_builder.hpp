@@ -2,8 +2,7 @@
 
 #include "include/index.hpp"
 #include "include/build_util.hpp"
-
-#include <shared_mutex>
+#include "include/concurrency.hpp"
 
 namespace fulgor {
 
@@ -23,10 +22,12 @@ struct permuter {
             timer.start();
             constexpr uint64_t p = 10;  // use 2^p bytes per HLL sketch
             build_reference_sketches(index, p, m_build_config.num_threads,
+                                     (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2,
                                      m_build_config.tmp_dirname + "/sketches.bin");
             timer.stop();
             std::cout << "** building sketches took " << timer.elapsed() << " seconds / "
                       << timer.elapsed() / 60 << " minutes" << std::endl;
+            util::print_peak_rss();
             timer.reset();
         }
 
@@ -37,36 +38,31 @@ struct permuter {
             std::ifstream in(m_build_config.tmp_dirname + "/sketches.bin", std::ios::binary);
             if (!in.is_open()) throw std::runtime_error("error in opening file");
 
-            std::vector<kmeans::point> points;
+            sketch_points points;
             uint64_t num_bytes_per_point = 0;
             uint64_t num_points = 0;
             in.read(reinterpret_cast<char*>(&num_bytes_per_point), sizeof(uint64_t));
             in.read(reinterpret_cast<char*>(&num_points), sizeof(uint64_t));
-            points.resize(num_points, kmeans::point(num_bytes_per_point));
-            for (auto& point : points) {
-                in.read(reinterpret_cast<char*>(point.data()), num_bytes_per_point);
-            }
+            points.resize(num_points, num_bytes_per_point);
+            in.read(reinterpret_cast<char*>(points.data(0)), num_points * num_bytes_per_point);
             in.close();
 
             std::remove((m_build_config.tmp_dirname + "/sketches.bin").c_str());
 
-            kmeans::clustering_parameters params;
-
-            /* kmeans_divisive */
-            constexpr float min_delta = 0.0001;
-            constexpr float max_iteration = 10;
-            constexpr uint64_t min_cluster_size = 50;
-            constexpr uint64_t seed = 0;
-            params.set_min_delta(min_delta);
-            params.set_max_iteration(max_iteration);
-            params.set_min_cluster_size(min_cluster_size);
-            params.set_random_seed(seed);
-            params.set_num_threads(m_build_config.num_threads);
-            auto clustering_data = kmeans::kmeans_divisive(points.begin(), points.end(), params);
+            clustering_parameters params;
+            params.min_delta = 0.0001;
+            params.max_iteration = 10;
+            params.min_cluster_size = 50;
+            params.mini_batch_size = m_build_config.clustering_mini_batch_size;
+            params.seed = 0;
+            params.num_threads = m_build_config.num_threads;
+            auto clustering_data = kmeans_divisive(points, params);
+            clustering_data.print_report(std::cout);
 
             timer.stop();
             std::cout << "** clustering sketches took " << timer.elapsed() << " seconds / "
                       << timer.elapsed() / 60 << " minutes" << std::endl;
+            util::print_peak_rss();
             timer.reset();
 
             m_num_partitions = clustering_data.num_clusters;
@@ -136,6 +132,7 @@ struct index<ColorSets>::meta_builder {
         essentials::logger("step 1. loading index to be partitioned...");
         essentials::load(index, m_build_config.index_filename_to_partition.c_str());
         essentials::logger("DONE");
+        util::print_peak_rss();
 
         const uint64_t num_threads = m_build_config.num_threads;
         const uint64_t num_colors = index.num_colors();
@@ -166,19 +163,21 @@ struct index<ColorSets>::meta_builder {
                 auto endpoints = p.partition_endpoints(partition_id);
                 uint64_t num_colors_in_partition = endpoints.end - endpoints.begin;
                 color_sets_builder.init_partition(partition_id, num_colors_in_partition);
-                color_sets_builder.reserve_num_bits(partition_id, 8 * essentials::GB * 8);
             }
 
-            std::vector<std::unordered_map<__uint128_t,            // key
-                                           uint32_t,               // value
-                                           util::hasher_uint128_t  // key's hasher
-                                           >>
-                hashes;  // (hash, id)
-            hashes.resize(num_partitions);
+            /*
+                Partial color sets are deduplicated with one concurrent table per partition.
+                A new partial color set is encoded, outside of any lock, by the thread that
+                first inserted it, in its own builder for that partition; its id is
+                (thread_id, id in the thread's builder) until the builders of each partition
+                are concatenated in thread order.
+            */
+            std::vector<std::unique_ptr<striped_hash128_map>> hashes(num_partitions);
+            for (auto& h : hashes) h = std::make_unique<striped_hash128_map>(4 * num_threads);
+            std::vector<std::vector<hybrid::builder>> thread_builders(num_threads);
 
             std::vector<std::thread> threads(num_threads);
             std::vector<uint32_t> thread_slices(num_threads + 1);
-            std::vector<std::shared_mutex> partitions_mutex(num_partitions);
 
             for (uint64_t i = 0; i < num_threads; ++i) {
                 thread_slices[i] = index.num_color_sets() / num_threads * i;
@@ -199,32 +198,48 @@ struct index<ColorSets>::meta_builder {
                 partial_color_set.reserve(max_partition_size);
                 permuted_set.reserve(num_colors);
 
+                /*  Meta color sets are buffered as [size, (partition_id, thread_id,
+                    partial_color_set_id) x size] and the buffer is written once full,
+                    so that the size is filled in memory before reaching the file.
+                */
+                constexpr uint64_t buffer_size = 1 << 20;  // in uint32_t
+                std::vector<uint32_t> buffer;
+                buffer.reserve(buffer_size + 3 * num_partitions + 1);
+                auto flush = [&]() {
+                    metacolor_sets_ofstream.write(reinterpret_cast<char const*>(buffer.data()),
+                                                  buffer.size() * sizeof(uint32_t));
+                    buffer.clear();
+                };
+
+                auto& builders = thread_builders[thread_id];
+                builders.resize(num_partitions);
+                std::vector<uint32_t> num_encoded(num_partitions, 0);
+                for (uint64_t i = 0; i != num_partitions; ++i) {
+                    auto endpoints = p.partition_endpoints(i);
+                    builders[i].init(endpoints.end - endpoints.begin);
+                }
+
                 auto hash_and_compress = [&]() {
-                    std::lock_guard<std::shared_mutex> lock(partitions_mutex[partition_id]);
                     assert(!partial_color_set.empty());
-                    uint32_t partial_color_set_id = 0;
                     auto hash =
                         util::hash128(reinterpret_cast<char const*>(partial_color_set.data()),
                                       partial_color_set.size() * sizeof(uint32_t));
-                    auto it = hashes[partition_id].find(hash);
-
-                    if (it == hashes[partition_id].cend()) {  // new partial color
-                        partial_color_set_id = hashes[partition_id].size();
-                        hashes[partition_id].insert({hash, partial_color_set_id});
-                        color_sets_builder.encode_color_set(partition_id, partial_color_set.data(),
-                                                            partial_color_set.size());
-                    } else {
-                        partial_color_set_id = (*it).second;
+                    auto [id, inserted] = hashes[partition_id]->find_or_insert(hash, [&]() {
+                        return (thread_id << 32) | num_encoded[partition_id];
+                    });
+                    if (inserted) {  // new partial color
+                        builders[partition_id].encode_color_set(partial_color_set.data(),
+                                                                partial_color_set.size());
+                        num_encoded[partition_id] += 1;
                     }
 
-                    /*  write meta color: (partition_id, partial_color_set_id)
+                    /*  write meta color: (partition_id, thread_id, partial_color_set_id)
                         Note: at this stage, partial_color_set_id is relative
-                              to its partition (is not global yet).
+                              to the builder of thread_id for the partition.
                     */
-                    metacolor_sets_ofstream.write(reinterpret_cast<char const*>(&partition_id),
-                                                  sizeof(uint32_t));
-                    metacolor_sets_ofstream.write(
-                        reinterpret_cast<char const*>(&partial_color_set_id), sizeof(uint32_t));
+                    buffer.push_back(partition_id);
+                    buffer.push_back(id >> 32);      // thread_id
+                    buffer.push_back(uint32_t(id));  // partial_color_set_id
 
                     partial_color_set.clear();
                     meta_color_set_size += 1;
@@ -248,9 +263,9 @@ struct index<ColorSets>::meta_builder {
                     partition_endpoint curr_partition = p.partition_endpoints(0);
                     assert(partial_color_set.empty());
 
-                    /* reserve space to hold the size of the meta color set */
-                    metacolor_sets_ofstream.write(
-                        reinterpret_cast<char const*>(&meta_color_set_size), sizeof(uint32_t));
+                    /* placeholder for the size of the meta color set */
+                    const uint64_t size_pos = buffer.size();
+                    buffer.push_back(0);
 
                     for (uint64_t i = 0; i != set_size; ++i) {
                         uint32_t ref_id = permuted_set[i];
@@ -266,18 +281,11 @@ struct index<ColorSets>::meta_builder {
 
                     num_integers_in_metacolor_sets += meta_color_set_size;
 
-                    /* write size of meta color set */
-                    uint64_t current_pos = metacolor_sets_ofstream.tellp();
-                    uint64_t num_bytes_in_meta_color_set =
-                        2 * meta_color_set_size * sizeof(uint32_t) + sizeof(uint32_t);
-                    assert(current_pos >= num_bytes_in_meta_color_set);
-                    uint64_t pos = current_pos - num_bytes_in_meta_color_set;
-                    metacolor_sets_ofstream.seekp(pos);
-                    metacolor_sets_ofstream.write(
-                        reinterpret_cast<char const*>(&meta_color_set_size), sizeof(uint32_t));
-                    metacolor_sets_ofstream.seekp(current_pos);
+                    buffer[size_pos] = meta_color_set_size;
+                    if (buffer.size() >= buffer_size) flush();
                 }
 
+                flush();
                 metacolor_sets_ofstream.close();
             };
 
@@ -287,6 +295,37 @@ struct index<ColorSets>::meta_builder {
                 if (t.joinable()) t.join();
             }
 
+            /* the partial color sets encoded by thread t for partition i come after those
+               encoded by threads 0..t-1: thread_offsets[i][t] is their number */
+            std::vector<std::vector<uint32_t>> thread_offsets(num_partitions,
+                                                              std::vector<uint32_t>(num_threads));
+            {
+                std::atomic<uint64_t> next_partition{0};
+                for (auto& t : threads) {
+                    t = std::thread([&]() {
+                        for (uint64_t i = next_partition++; i < num_partitions;
+                             i = next_partition++) {
+                            uint64_t num_bits = 0;
+                            for (uint64_t tid = 0; tid != num_threads; ++tid) {
+                                num_bits += thread_builders[tid][i].num_bits();
+                            }
+                            color_sets_builder.reserve_num_bits(i, num_bits);
+                            uint32_t offset = 0;
+                            for (uint64_t tid = 0; tid != num_threads; ++tid) {
+                                auto& b = thread_builders[tid][i];
+                                thread_offsets[i][tid] = offset;
+                                offset += b.num_color_sets();
+                                color_sets_builder.append_color_sets(i, b);
+                                b = hybrid::builder();
+                            }
+                            assert(offset == hashes[i]->size());
+                        }
+                    });
+                }
+                for (auto& t : threads) t.join();
+                thread_builders.clear();
+            }
+
             std::vector<uint64_t> num_partial_color_sets_before;
             std::vector<uint32_t> num_sets_in_partition;
             num_partial_color_sets_before.reserve(num_partitions);
@@ -294,7 +333,7 @@ struct index<ColorSets>::meta_builder {
             num_partial_color_sets = 0;
             for (uint64_t partition_id = 0; partition_id != num_partitions; ++partition_id) {
                 num_partial_color_sets_before.push_back(num_partial_color_sets);
-                uint64_t num_partial_color_sets_in_partition = hashes[partition_id].size();
+                uint64_t num_partial_color_sets_in_partition = hashes[partition_id]->size();
                 num_partial_color_sets += num_partial_color_sets_in_partition;
                 num_sets_in_partition.push_back(num_partial_color_sets_in_partition);
                 std::cout << "num_partial_color_sets_in_partition-" << partition_id << ": "
@@ -332,12 +371,15 @@ struct index<ColorSets>::meta_builder {
                                       sizeof(uint32_t));
                 for (uint32_t i = 0; i != meta_color_set_size; ++i) {
                     uint32_t partition_id = 0;
+                    uint32_t owner = 0;
                     uint32_t partial_color_set_id = 0;
                     metacolor_set_in.read(reinterpret_cast<char*>(&partition_id), sizeof(uint32_t));
+                    metacolor_set_in.read(reinterpret_cast<char*>(&owner), sizeof(uint32_t));
                     metacolor_set_in.read(reinterpret_cast<char*>(&partial_color_set_id),
                                           sizeof(uint32_t));
                     /* transform the partial_color_set_id into a global id */
                     metacolor_set.push_back(partial_color_set_id +
+                                            thread_offsets[partition_id][owner] +
                                             num_partial_color_sets_before[partition_id]);
                 }
                 color_sets_builder.encode_metacolor_set(metacolor_set.data(), metacolor_set.size());
@@ -351,6 +393,7 @@ struct index<ColorSets>::meta_builder {
             timer.stop();
             std::cout << "** building partial/meta color sets took " << timer.elapsed()
                       << " seconds / " << timer.elapsed() / 60 << " minutes" << std::endl;
+            util::print_peak_rss();
             timer.reset();
         }
 
@@ -363,6 +406,7 @@ struct index<ColorSets>::meta_builder {
             timer.stop();
             std::cout << "** copying u2c and k2u took " << timer.elapsed() << " seconds / "
                       << timer.elapsed() / 60 << " minutes" << std::endl;
+            util::print_peak_rss();
             timer.reset();
         }
 
@@ -373,6 +417,7 @@ struct index<ColorSets>::meta_builder {
             timer.stop();
             std::cout << "** building filenames took " << timer.elapsed() << " seconds / "
                       << timer.elapsed() / 60 << " minutes" << std::endl;
+            util::print_peak_rss();
             timer.reset();
         }
 
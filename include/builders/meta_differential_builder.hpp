@@ -2,6 +2,7 @@
 
 #include "include/index.hpp"
 #include "include/build_util.hpp"
+#include "include/concurrency.hpp"
 
 namespace fulgor {
 
@@ -37,21 +38,62 @@ struct index<ColorSets>::meta_differential_builder {
             std::vector<hybrid> const& pc = meta_index.get_color_sets().partial_colors();
             assert(pc.size() == num_partitions);
 
-            for (uint64_t meta_partition_id = 0; meta_partition_id < num_partitions;
-                 meta_partition_id++) {
-                std::cout << " Partition " << meta_partition_id << " / " << num_partitions - 1
-                          << std::endl;
-                auto& meta_partition = pc[meta_partition_id];
-                const uint64_t num_partition_color_sets = meta_partition.num_color_sets();
-                const uint64_t num_partition_colors = meta_partition.num_colors();
+            /*
+                The partitions are independent: each one is permuted (sketched, clustered
+                and refined) and then encoded, with up to num_threads partitions in flight
+                and the threads split among them. Encoded partitions are committed to the
+                builder in order, each one as soon as it and the previous ones are done.
+                The memory of a partition (sketches, permutation and encoding) counts
+                against half of the RAM limit, and its encoding keeps counting until it is
+                committed. Partitions are started in order, so that when the memory is taken
+                by encoded partitions waiting for the previous ones, the one started next
+                is the one that unblocks them.
+            */
+            const uint64_t num_workers =
+                std::max<uint64_t>(std::min<uint64_t>(num_threads, num_partitions), 1);
+            const uint64_t num_threads_per_partition =
+                std::max<uint64_t>(num_threads / num_workers, 1);
+            build_configuration partition_build_config = m_build_config;
+            partition_build_config.num_threads = num_threads_per_partition;
+
+            struct partition_state {
+                std::vector<std::pair<uint32_t, uint32_t>> permutation;
+                differential d;
+                uint64_t num_allocations = 0;
+            };
+            std::vector<partition_state> states(num_partitions);
 
-                differential_permuter dp(m_build_config);
+            /* per-worker scratch space, reused across partitions */
+            std::vector<std::vector<differential_scratch>> scratches(num_workers);
+
+            auto permute = [&](uint64_t meta_partition_id) {
+                auto& meta_partition = pc[meta_partition_id];
+                auto& permutation = states[meta_partition_id].permutation;
+                differential_permuter dp(partition_build_config,
+                                         "partition" + std::to_string(meta_partition_id));
                 dp.permute(meta_partition);
-                auto const& permutation = dp.permutation();
-                partial_permutations[meta_partition_id].resize(num_partition_color_sets);
+                permutation = dp.permutation();
+
+                if (m_build_config.max_representative_splits > 0) {
+                    auto stats = representative_refiner::refine(
+                        meta_partition, permutation, meta_partition.num_colors(),
+                        num_threads_per_partition, m_build_config.max_representative_splits);
+                    stats.print();
+                }
 
-                essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
-                timer.start();
+                partial_permutations[meta_partition_id].resize(permutation.size());
+                for (uint64_t i = 0; i != permutation.size(); i++) {
+                    auto& [group_id, color_set_id] = permutation[i];
+                    partial_permutations[meta_partition_id][color_set_id] = i;
+                }
+            };
+
+            auto encode = [&](uint64_t meta_partition_id, uint64_t worker_id) {
+                auto& meta_partition = pc[meta_partition_id];
+                auto& state = states[meta_partition_id];
+                auto const& permutation = state.permutation;
+                const uint64_t num_partition_color_sets = meta_partition.num_color_sets();
+                const uint64_t num_partition_colors = meta_partition.num_colors();
 
                 struct slice {
                     uint64_t begin, end;
@@ -63,7 +105,7 @@ struct index<ColorSets>::meta_differential_builder {
                      ++color_set_id) {
                     load += meta_partition.color_set(color_set_id).size();
                 }
-                const uint64_t load_per_thread = load / num_threads;
+                const uint64_t load_per_thread = load / num_threads_per_partition;
 
                 slice s = {0, 0};
                 uint64_t curr_load = 0;
@@ -84,60 +126,21 @@ struct index<ColorSets>::meta_differential_builder {
                 std::vector<differential::builder> thread_builders(thread_slices.size(),
                                                                    num_partition_colors);
                 std::vector<std::thread> threads(thread_slices.size());
+                auto& worker_scratches = scratches[worker_id];
+                if (worker_scratches.size() < thread_slices.size()) {
+                    worker_scratches.resize(thread_slices.size());
+                }
 
                 auto encode_color_sets = [&](uint64_t thread_id) {
-                    auto& color_sets_builder = thread_builders[thread_id];
                     auto& [begin, end] = thread_slices[thread_id];
-                    color_sets_builder.reserve_num_bits(16 * essentials::GB * 8);
-
-                    std::vector<uint64_t> group_endpoints;
-                    uint64_t curr_group =
-                        permutation[begin].first + 1;  // different from first group
-                    for (uint64_t i = begin; i < end; i++) {
-                        auto& [group_id, color_set_id] = permutation[i];
-                        if (group_id != curr_group) {
-                            group_endpoints.push_back(i);
-                            curr_group = group_id;
-                        }
-                    }
-                    group_endpoints.push_back(end);
-
-                    std::vector<uint32_t> distribution(num_partition_colors, 0);
-                    for (uint64_t group = 0; group < group_endpoints.size() - 1; ++group) {
-                        uint64_t g_begin = group_endpoints[group];
-                        uint64_t g_end = group_endpoints[group + 1];
-                        std::vector<uint32_t> representative;
-                        representative.reserve(num_partition_colors);
-
-                        for (uint64_t i = g_begin; i < g_end; ++i) {
-                            auto& [group_id, color_set_id] = permutation[i];
-                            auto it = meta_partition.color_set(color_set_id);
-                            uint64_t it_size = it.size();
-                            for (uint64_t pos = 0; pos < it_size; ++pos, ++it) {
-                                distribution[*it]++;
-                            }
-                        }
-                        uint64_t g_size = g_end - g_begin;
-                        for (uint64_t color = 0; color < num_partition_colors; ++color) {
-                            if (distribution[color] >= ceil(1. * g_size / 2.))
-                                representative.push_back(color);
-                        }
-                        color_sets_builder.process_partition(representative);
-
-                        for (uint64_t i = g_begin; i < g_end; ++i) {
-                            auto& [group_id, color_set_id] = permutation[i];
-                            auto it = meta_partition.color_set(color_set_id);
-                            color_sets_builder.process_color_set(it);
-                        }
-                        std::fill(distribution.begin(), distribution.end(), 0);
+                    auto& scratch = worker_scratches[thread_id];
+                    if (scratch.distribution.size() < num_partition_colors) {
+                        scratch.init(num_partition_colors);
                     }
+                    encode_differential_groups(meta_partition, permutation, begin, end,
+                                               thread_builders[thread_id], scratch);
                 };
 
-                for (uint64_t i = 0; i < num_partition_color_sets; i++) {
-                    auto& [group_id, color_set_id] = permutation[i];
-                    partial_permutations[meta_partition_id][color_set_id] = i;
-                }
-
                 for (uint64_t thread_id = 0; thread_id < thread_slices.size(); thread_id++) {
                     threads[thread_id] = std::thread(encode_color_sets, thread_id);
                 }
@@ -148,15 +151,57 @@ struct index<ColorSets>::meta_differential_builder {
                 for (uint64_t thread_id = 1; thread_id < thread_builders.size(); thread_id++) {
                     thread_builders[0].append(thread_builders[thread_id]);
                 }
-                differential d;
-                thread_builders[0].build(d);
-                builder.process_partition(d);
+                state.num_allocations = thread_builders[0].num_scratch_allocations();
+                thread_builders[0].build(state.d);
+                std::vector<std::pair<uint32_t, uint32_t>>().swap(state.permutation);
+            };
 
-                timer.stop();
-                std::cout << "  ** building the color sets for partition " << meta_partition_id
-                          << " took " << timer.elapsed() << " seconds / " << timer.elapsed() / 60
-                          << " minutes" << std::endl;
+            task_graph graph;
+            std::vector<uint64_t> encode_tasks(num_partitions);
+            for (uint64_t meta_partition_id = 0; meta_partition_id != num_partitions;
+                 ++meta_partition_id) {
+                auto const& partition = pc[meta_partition_id];
+                const uint64_t memory = partition.num_color_sets() * ((1ULL << 10) + 16) +
+                                        partition.num_bits() / 8;
+                const std::string suffix = " partition " + std::to_string(meta_partition_id);
+                uint64_t permute_task = graph.add(
+                    "permute" + suffix,
+                    [&, meta_partition_id](uint64_t) { permute(meta_partition_id); }, {},
+                    memory);
+                encode_tasks[meta_partition_id] = graph.add(
+                    "encode" + suffix,
+                    [&, meta_partition_id](uint64_t worker_id) {
+                        encode(meta_partition_id, worker_id);
+                    },
+                    {permute_task}, memory);
+            }
+            uint64_t num_allocations = 0;
+            for (uint64_t meta_partition_id = 0; meta_partition_id != num_partitions;
+                 ++meta_partition_id) {
+                std::vector<uint64_t> dependencies = {encode_tasks[meta_partition_id]};
+                if (meta_partition_id != 0) dependencies.push_back(graph.num_tasks() - 1);
+                graph.add(
+                    "commit partition " + std::to_string(meta_partition_id),
+                    [&, meta_partition_id](uint64_t) {
+                        auto& state = states[meta_partition_id];
+                        num_allocations += state.num_allocations;
+                        builder.process_partition(state.d);
+                        state.d = differential();
+                    },
+                    dependencies);
+                /* the encoded partition stays in memory until it is committed */
+                graph.hand_over_memory(encode_tasks[meta_partition_id], graph.num_tasks() - 1,
+                                       pc[meta_partition_id].num_bits() / 8);
+            }
+            graph.run(num_workers, (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2);
+
+            for (auto const& worker_scratches : scratches) {
+                for (auto const& scratch : worker_scratches) {
+                    num_allocations += scratch.num_allocations;
+                }
             }
+            std::cout << "scratch buffer allocations: " << num_allocations << " for "
+                      << num_color_sets << " meta color sets" << std::endl;
 
             timer.stop();
             std::cout << "** building partial/meta color sets took " << timer.elapsed()
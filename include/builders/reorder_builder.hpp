@@ -0,0 +1,453 @@
+#pragma once
+
+#include "include/index.hpp"
+
+namespace fulgor {
+
+/*
+    Renumber the color sets of an index so that color sets that are likely to be
+    fetched by the same read are stored close together in memory.
+    Two color sets are likely co-accessed if they label adjacent unitigs in the dBG:
+    the color sets are visited in Cuthill-McKee order on the graph whose edges are
+    weighted by the number of unitig links between them.
+    If a color-set access profile is given (see pseudoalign --profile),
+    the traversal is seeded from the most accessed color sets, so that hot sets are
+    also packed together at the beginning of the color sets.
+*/
+template <typename ColorSets>
+struct index<ColorSets>::reorder_builder {
+    reorder_builder() {}
+
+    reorder_builder(build_configuration const& build_config) : m_build_config(build_config) {}
+
+    void build(index& idx) {
+        if (idx.m_k2u.size() != 0) throw std::runtime_error("index already built");
+
+        index_type index;
+        essentials::logger("step 1. loading index to be reordered...");
+        essentials::load(index, m_build_config.index_filename_to_partition.c_str());
+        essentials::logger("DONE");
+
+        const uint64_t num_threads = m_build_config.num_threads;
+        const uint64_t num_color_sets = index.num_color_sets();
+        const uint64_t num_colors = index.num_colors();
+
+        essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+
+        std::vector<edge> edges;
+        {
+            essentials::logger("step 2. build color-set adjacency from unitig links");
+            timer.start();
+            edges = color_set_links(index);
+            timer.stop();
+            std::cout << "num. linked pairs of color sets = " << edges.size() << std::endl;
+            std::cout << "** building color-set adjacency took " << timer.elapsed()
+                      << " seconds / " << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        std::vector<uint32_t> permutation;  // permutation[new_color_set_id] = old_color_set_id
+        {
+            essentials::logger("step 3. computing the new order of the color sets");
+            timer.start();
+            std::vector<uint32_t> counts;
+            if (!m_build_config.color_set_profile_filename.empty()) {
+                counts = color_set_profile::load(m_build_config.color_set_profile_filename);
+                if (counts.size() != num_color_sets) {
+                    throw std::runtime_error("the profile does not match the index");
+                }
+            }
+            permutation = cuthill_mckee_order(num_color_sets, edges, counts);
+            timer.stop();
+            std::cout << "** computing the new order took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 4. re-encoding color sets");
+            timer.start();
+
+            struct slice {
+                uint64_t begin, end;  // [..)
+            };
+            std::vector<slice> thread_slices;
+            uint64_t load = 0;
+            for (uint64_t color_set_id = 0; color_set_id != num_color_sets; ++color_set_id) {
+                load += index.color_set(color_set_id).size();
+            }
+            const uint64_t load_per_thread = (load + num_threads - 1) / num_threads;
+            {
+                /* at most num_threads slices: the last one takes the remainder */
+                slice s = {0, 0};
+                uint64_t curr_load = 0;
+                for (uint64_t i = 0; i != num_color_sets; ++i) {
+                    curr_load += index.color_set(permutation[i]).size();
+                    const bool last_slice = thread_slices.size() + 1 == num_threads;
+                    if ((curr_load >= load_per_thread and !last_slice) or i == num_color_sets - 1) {
+                        s.end = i + 1;
+                        thread_slices.push_back(s);
+                        s.begin = i + 1;
+                        curr_load = 0;
+                    }
+                }
+            }
+
+            std::vector<typename ColorSets::builder> thread_builders(thread_slices.size(),
+                                                                     num_colors);
+            auto exe = [&](uint64_t thread_id) {
+                auto [begin, end] = thread_slices[thread_id];
+                std::vector<uint32_t> color_set;
+                color_set.reserve(num_colors);
+                for (uint64_t i = begin; i != end; ++i) {
+                    auto it = index.color_set(permutation[i]);
+                    const uint64_t size = it.size();
+                    for (uint64_t j = 0; j != size; ++j, ++it) color_set.push_back(*it);
+                    thread_builders[thread_id].encode_color_set(color_set.data(), size);
+                    color_set.clear();
+                }
+            };
+
+            std::vector<std::thread> threads(thread_slices.size());
+            for (uint64_t thread_id = 0; thread_id != threads.size(); ++thread_id) {
+                threads[thread_id] = std::thread(exe, thread_id);
+            }
+            for (auto& t : threads) {
+                if (t.joinable()) t.join();
+            }
+            for (uint64_t thread_id = 1; thread_id < thread_builders.size(); ++thread_id) {
+                thread_builders[0].append(thread_builders[thread_id]);
+            }
+            thread_builders[0].build(idx.m_color_sets);
+
+            timer.stop();
+            std::cout << "** re-encoding color sets took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            std::vector<uint32_t> new_color_set_id(num_color_sets);
+            for (uint64_t i = 0; i != num_color_sets; ++i) new_color_set_id[permutation[i]] = i;
+            auto before = locality(index.get_color_sets(), edges, [](uint32_t x) { return x; });
+            auto after = locality(idx.m_color_sets, edges,
+                                  [&](uint32_t x) { return new_color_set_id[x]; });
+            std::cout << "co-accessed color sets (weighted by num. of unitig links):\n";
+            std::cout << "  before: ";
+            before.print();
+            std::cout << "  after:  ";
+            after.print();
+        }
+
+        {
+            essentials::logger("step 5. permute unitigs and rebuild k2u");
+            timer.start();
+
+            const std::string permuted_unitigs_filename =
+                m_build_config.tmp_dirname + "/permuted_unitigs.fa";
+            std::ofstream out(permuted_unitigs_filename.c_str());
+            if (!out.is_open()) throw std::runtime_error("cannot open output file");
+
+            auto const& u2c = index.get_u2c();
+            bits::darray1 d;  // for select_1 on u2c
+            d.build(u2c);
+
+            const uint64_t num_unitigs = u2c.num_bits();
+            bits::bit_vector::builder u2c_builder(num_unitigs + 1, 0);
+
+            auto const& dict = index.get_k2u();
+            const uint64_t k = dict.k();
+
+            uint64_t pos = 0;
+            for (uint64_t new_color_set_id = 0; new_color_set_id != num_color_sets;
+                 ++new_color_set_id) {
+                uint64_t old_color_set_id = permutation[new_color_set_id];
+                uint64_t old_unitig_id_end = num_unitigs;
+                if (old_color_set_id < num_color_sets - 1) {
+                    old_unitig_id_end = d.select(u2c, old_color_set_id) + 1;
+                }
+                uint64_t old_unitig_id_begin = 0;
+                if (old_color_set_id > 0) {
+                    old_unitig_id_begin = d.select(u2c, old_color_set_id - 1) + 1;
+                }
+
+                // num. unitigs that have the same color
+                pos += old_unitig_id_end - old_unitig_id_begin;
+                assert(pos - 1 < u2c_builder.num_bits());
+
+                u2c_builder.set(pos - 1, 1);
+
+                for (uint64_t i = old_unitig_id_begin; i != old_unitig_id_end; ++i) {
+                    auto it = dict.at_contig_id(i);
+                    out << ">\n";
+                    auto [_, kmer] = it.next();
+                    out << kmer;
+                    while (it.has_next()) {
+                        auto [_, kmer] = it.next();
+                        out << kmer[k - 1];  // overlaps!
+                    }
+                    out << '\n';
+                }
+            }
+
+            assert(pos == num_unitigs);
+            out.close();
+            u2c_builder.build(idx.m_u2c);
+            idx.m_u2c_rank1_index.build(idx.m_u2c);
+
+            /* build a new sshash::dictionary on the permuted unitigs */
+            sshash::build_configuration sshash_config;
+            sshash_config.k = dict.k();
+            sshash_config.m = dict.m();
+            assert(dict.canonical() == true);
+            sshash_config.canonical = dict.canonical();
+            sshash_config.verbose = m_build_config.verbose;
+            sshash_config.tmp_dirname = m_build_config.tmp_dirname;
+            sshash_config.num_threads = util::largest_power_of_2(m_build_config.num_threads);
+            sshash_config.print();
+            idx.m_k2u.build(permuted_unitigs_filename, sshash_config);
+            assert(idx.get_k2u().size() == dict.size());
+            try {  // remove unitig file
+                std::remove(permuted_unitigs_filename.c_str());
+            } catch (std::exception const& e) { std::cerr << e.what() << std::endl; }
+
+            timer.stop();
+            std::cout << "** permuting unitigs and rebuilding k2u took " << timer.elapsed()
+                      << " seconds / " << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 6. copying filenames");
+            timer.start();
+            idx.m_filenames = index.get_filenames();
+            timer.stop();
+            std::cout << "** copying filenames took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        if (m_build_config.check) {
+            essentials::logger("step 7. check correctness...");
+            for (uint64_t color_set_id = 0; color_set_id != num_color_sets; ++color_set_id) {
+                auto exp_it = index.color_set(permutation[color_set_id]);
+                auto res_it = idx.color_set(color_set_id);
+                if (res_it.size() != exp_it.size()) {
+                    std::cout << "Error while checking color set " << color_set_id
+                              << ", different sizes: expected " << exp_it.size() << " but got "
+                              << res_it.size() << std::endl;
+                    return;
+                }
+                for (uint64_t j = 0; j != exp_it.size(); ++j, ++exp_it, ++res_it) {
+                    if (*exp_it != *res_it) {
+                        std::cout << "Error while checking color set " << color_set_id
+                                  << ", mismatch at position " << j << ": expected " << *exp_it
+                                  << " but got " << *res_it << std::endl;
+                        return;
+                    }
+                }
+            }
+            for (uint64_t unitig_id = 0; unitig_id != idx.num_unitigs(); ++unitig_id) {
+                auto it = idx.get_k2u().at_contig_id(unitig_id);
+                auto [_, kmer] = it.next();
+                uint64_t old_unitig_id = index.get_k2u().lookup_advanced(kmer.c_str()).contig_id;
+                if (permutation[idx.u2c(unitig_id)] != index.u2c(old_unitig_id)) {
+                    std::cout << "Error while checking unitig " << unitig_id
+                              << ": wrong color set id" << std::endl;
+                    return;
+                }
+            }
+            essentials::logger("DONE!");
+        }
+    }
+
+private:
+    build_configuration m_build_config;
+
+    struct edge {
+        uint32_t from, to;  // from < to
+        uint32_t weight;
+    };
+
+    static void compact(std::vector<edge>& edges) {
+        std::sort(edges.begin(), edges.end(), [](edge const& x, edge const& y) {
+            return x.from < y.from or (x.from == y.from and x.to < y.to);
+        });
+        uint64_t size = 0;
+        for (uint64_t i = 0; i != edges.size(); ++i) {
+            if (size > 0 and edges[size - 1].from == edges[i].from and
+                edges[size - 1].to == edges[i].to) {
+                edges[size - 1].weight += edges[i].weight;
+            } else {
+                edges[size++] = edges[i];
+            }
+        }
+        edges.resize(size);
+    }
+
+    /* Weighted pairs of distinct color sets that label adjacent unitigs. */
+    std::vector<edge> color_set_links(index_type const& index) const {
+        auto const& dict = index.get_k2u();
+        const uint64_t k = dict.k();
+        const uint64_t num_unitigs = index.num_unitigs();
+        const uint64_t num_threads = std::min<uint64_t>(m_build_config.num_threads, num_unitigs);
+        constexpr uint64_t max_buffered_edges = uint64_t(1) << 24;
+        constexpr char bases[] = {'A', 'C', 'G', 'T'};
+
+        std::vector<std::vector<edge>> thread_edges(num_threads);
+        auto exe = [&](uint64_t thread_id) {
+            auto& edges = thread_edges[thread_id];
+            uint64_t num_compacted_edges = 0;
+            const uint64_t begin = (num_unitigs * thread_id) / num_threads;
+            const uint64_t end = (num_unitigs * (thread_id + 1)) / num_threads;
+            std::string neighbor(k, 'A');
+            for (uint64_t unitig_id = begin; unitig_id != end; ++unitig_id) {
+                const uint32_t color_set_id = index.u2c(unitig_id);
+                auto it = dict.at_contig_id(unitig_id);
+                auto [_, first_kmer] = it.next();
+                std::string last_kmer = first_kmer;
+                while (it.has_next()) {
+                    auto [_, kmer] = it.next();
+                    last_kmer = kmer;
+                }
+                auto add = [&](std::string const& kmer) {
+                    auto answer = dict.lookup_advanced(kmer.c_str());
+                    if (answer.kmer_id == sshash::constants::invalid_uint64) return;
+                    const uint32_t other = index.u2c(answer.contig_id);
+                    if (other == color_set_id) return;
+                    edges.push_back({std::min(color_set_id, other),
+                                     std::max(color_set_id, other), 1});
+                };
+                for (char b : bases) {
+                    /* successors of the last kmer */
+                    std::copy(last_kmer.begin() + 1, last_kmer.end(), neighbor.begin());
+                    neighbor[k - 1] = b;
+                    add(neighbor);
+                    /* predecessors of the first kmer */
+                    neighbor[0] = b;
+                    std::copy(first_kmer.begin(), first_kmer.end() - 1, neighbor.begin() + 1);
+                    add(neighbor);
+                }
+                if (edges.size() - num_compacted_edges > max_buffered_edges) {
+                    compact(edges);
+                    num_compacted_edges = edges.size();
+                }
+            }
+            compact(edges);
+        };
+
+        std::vector<std::thread> threads(num_threads);
+        for (uint64_t thread_id = 0; thread_id != num_threads; ++thread_id) {
+            threads[thread_id] = std::thread(exe, thread_id);
+        }
+        for (auto& t : threads) {
+            if (t.joinable()) t.join();
+        }
+
+        std::vector<edge> edges;
+        for (auto& e : thread_edges) {
+            edges.insert(edges.end(), e.begin(), e.end());
+            std::vector<edge>().swap(e);
+        }
+        compact(edges);
+        return edges;
+    }
+
+    /*
+        Visit the color sets in breadth-first order, visiting the neighbors of a
+        color set by decreasing link weight. A new traversal is started from the
+        most accessed (if counts are given) or from the least linked unvisited color set.
+    */
+    static std::vector<uint32_t> cuthill_mckee_order(const uint64_t num_color_sets,
+                                                     std::vector<edge> const& edges,
+                                                     std::vector<uint32_t> const& counts)  //
+    {
+        std::vector<uint64_t> offsets(num_color_sets + 1, 0);
+        for (auto const& e : edges) {
+            offsets[e.from + 1] += 1;
+            offsets[e.to + 1] += 1;
+        }
+        for (uint64_t i = 0; i != num_color_sets; ++i) offsets[i + 1] += offsets[i];
+        std::vector<std::pair<uint32_t, uint32_t>> neighbors(offsets.back());  // (id, weight)
+        {
+            auto pos = offsets;
+            for (auto const& e : edges) {
+                neighbors[pos[e.from]++] = {e.to, e.weight};
+                neighbors[pos[e.to]++] = {e.from, e.weight};
+            }
+        }
+        auto degree = [&](uint32_t x) { return offsets[x + 1] - offsets[x]; };
+
+        std::vector<uint32_t> seeds(num_color_sets);
+        std::iota(seeds.begin(), seeds.end(), 0);
+        if (!counts.empty()) {
+            std::stable_sort(seeds.begin(), seeds.end(),
+                             [&](uint32_t x, uint32_t y) { return counts[x] > counts[y]; });
+        } else {
+            std::stable_sort(seeds.begin(), seeds.end(),
+                             [&](uint32_t x, uint32_t y) { return degree(x) < degree(y); });
+        }
+
+        std::vector<uint32_t> order;  // also used as BFS queue
+        order.reserve(num_color_sets);
+        std::vector<bool> visited(num_color_sets, false);
+        std::vector<std::pair<uint32_t, uint32_t>> frontier;
+        for (uint32_t seed : seeds) {
+            if (visited[seed]) continue;
+            visited[seed] = true;
+            order.push_back(seed);
+            for (uint64_t head = order.size() - 1; head != order.size(); ++head) {
+                const uint32_t x = order[head];
+                frontier.clear();
+                for (uint64_t i = offsets[x]; i != offsets[x + 1]; ++i) {
+                    if (!visited[neighbors[i].first]) frontier.push_back(neighbors[i]);
+                }
+                std::sort(frontier.begin(), frontier.end(), [&](auto const& a, auto const& b) {
+                    return a.second > b.second or
+                           (a.second == b.second and degree(a.first) < degree(b.first));
+                });
+                for (auto [y, _] : frontier) {
+                    visited[y] = true;
+                    order.push_back(y);
+                }
+            }
+        }
+        assert(order.size() == num_color_sets);
+        return order;
+    }
+
+    struct locality_stats {
+        void print() const {
+            std::cout << (same_line * 100.0) / total << "% on the same 64-byte line, "
+                      << (same_page * 100.0) / total << "% on the same 4-KiB page, "
+                      << "avg. distance " << static_cast<double>(distance) / total << " bytes"
+                      << std::endl;
+        }
+        uint64_t same_line = 0, same_page = 0, total = 0;
+        uint64_t distance = 0;  // in bytes, weighted
+    };
+
+    /*
+        A proxy for the cache and TLB misses incurred by a read:
+        how often the headers of two co-accessed color sets fall in the same
+        cache line or memory page.
+    */
+    template <typename Map>
+    static locality_stats locality(ColorSets const& color_sets, std::vector<edge> const& edges,
+                                   Map id) {
+        locality_stats stats;
+        for (auto const& e : edges) {
+            uint64_t x = color_sets.offset(id(e.from)) / 8;
+            uint64_t y = color_sets.offset(id(e.to)) / 8;
+            if (x > y) std::swap(x, y);
+            stats.same_line += (x / 64 == y / 64) * e.weight;
+            stats.same_page += (x / 4096 == y / 4096) * e.weight;
+            stats.distance += (y - x) * e.weight;
+            stats.total += e.weight;
+        }
+        stats.total = std::max<uint64_t>(stats.total, 1);
+        return stats;
+    }
+};
+
+}  // namespace fulgor
@@ -0,0 +1,346 @@
+#pragma once
+
+#include "include/index.hpp"
+#include "include/GGCAT.hpp"
+#include "include/packed_unitigs.hpp"
+
+namespace fulgor {
+
+/*
+    Add new references to an existing index.
+    The ccdBG is built on the new references only; each of its unitigs is split into
+    maximal runs of kmers that are either absent from the old index or labeled by the
+    same old color set. The kmers of the old index that are hit by a run are removed from
+    the old unitigs, whose remaining runs keep their old color set, while every run of
+    the new graph gets the color set old_color_set U (new_color_set + num_old_colors).
+    Old color sets that are not affected are copied without being re-encoded, when their
+    encoding does not depend on the number of colors.
+*/
+template <typename ColorSets>
+struct index<ColorSets>::update_builder {
+    update_builder() {}
+
+    update_builder(build_configuration const& build_config) : m_build_config(build_config) {}
+
+    void build(index& idx) {
+        if (idx.m_k2u.size() != 0) throw std::runtime_error("index already built");
+
+        index_type old_index;
+        essentials::logger("step 1. loading index to be updated...");
+        essentials::load(old_index, m_build_config.index_filename_to_partition.c_str());
+        essentials::logger("DONE");
+
+        auto const& dict = old_index.get_k2u();
+        const uint64_t k = dict.k();
+        const uint64_t num_old_colors = old_index.num_colors();
+        const uint64_t num_old_color_sets = old_index.num_color_sets();
+        const uint64_t num_old_unitigs = old_index.num_unitigs();
+        m_build_config.k = k;
+        m_build_config.m = dict.m();
+
+        essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+
+        {
+            essentials::logger("step 2. build colored compacted dBG of the new references");
+            timer.start();
+            m_ccdbg.build(m_build_config);
+            timer.stop();
+            std::cout << "** building the ccdBG took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        const uint64_t num_new_colors = m_ccdbg.num_colors();
+        const uint64_t num_colors = num_old_colors + num_new_colors;
+        std::cout << "num_old_colors " << num_old_colors << std::endl;
+        std::cout << "num_new_colors " << num_new_colors << std::endl;
+
+        constexpr uint32_t none = -1;  // the kmers of a run are not in the old index
+        struct run {
+            uint32_t old_color_set_id, new_color_set_id;
+            uint64_t begin;  // in run_bases
+            uint32_t length;
+        };
+        std::vector<run> runs;
+        std::string run_bases;
+        std::vector<uint32_t> new_colors;
+        std::vector<uint64_t> new_color_set_offsets;
+        std::vector<bool> hit(dict.size(), false);  // old kmers that are also in the new graph
+
+        {
+            essentials::logger("step 3. looking up the new kmers in the old index");
+            timer.start();
+
+            new_color_set_offsets.push_back(0);
+            uint64_t num_hits = 0;
+            uint64_t num_new_kmers = 0;
+
+            m_ccdbg.loop_through_unitigs([&](ggcat::Slice<char> const unitig,
+                                             ggcat::Slice<uint32_t> const color_set,
+                                             bool same_color_set) {
+                try {
+                    if (!same_color_set) {
+                        new_colors.insert(new_colors.end(), color_set.data,
+                                          color_set.data + color_set.size);
+                        new_color_set_offsets.push_back(new_colors.size());
+                    }
+                    const uint32_t new_color_set_id = new_color_set_offsets.size() - 2;
+                    auto add_run = [&](uint64_t begin, uint64_t end, uint32_t old_color_set_id) {
+                        const uint32_t length = end - begin + k - 1;
+                        runs.push_back(
+                            {old_color_set_id, new_color_set_id, run_bases.size(), length});
+                        run_bases.append(unitig.data + begin, length);
+                    };
+
+                    const uint64_t num_kmers = unitig.size - k + 1;
+                    uint64_t run_begin = 0;
+                    uint32_t run_key = none;
+                    for (uint64_t i = 0; i != num_kmers; ++i) {
+                        auto answer = dict.lookup_advanced(unitig.data + i);
+                        uint32_t key = none;
+                        if (answer.kmer_id != sshash::constants::invalid_uint64) {
+                            key = old_index.u2c(answer.contig_id);
+                            hit[answer.kmer_id] = true;
+                            num_hits += 1;
+                        }
+                        if (i > 0 and key != run_key) {
+                            add_run(run_begin, i, run_key);
+                            run_begin = i;
+                        }
+                        run_key = key;
+                    }
+                    add_run(run_begin, num_kmers, run_key);
+                    num_new_kmers += num_kmers;
+                } catch (std::exception const& e) {
+                    std::cerr << e.what() << std::endl;
+                    exit(1);
+                }
+            });
+
+            std::sort(runs.begin(), runs.end(), [](run const& x, run const& y) {
+                return x.old_color_set_id < y.old_color_set_id or
+                       (x.old_color_set_id == y.old_color_set_id and
+                        x.new_color_set_id < y.new_color_set_id);
+            });
+
+            timer.stop();
+            std::cout << "num. kmers in the new references " << num_new_kmers << " ("
+                      << num_hits << " already in the index)" << std::endl;
+            std::cout << "num. runs " << runs.size() << std::endl;
+            std::cout << "** looking up the new kmers took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        packed_unitigs unitigs(m_build_config.tmp_dirname + "/" +
+                                   util::filename(m_build_config.file_base_name) +
+                                   ".unitigs.bin",
+                               (uint64_t(m_build_config.ram_limit_in_GiB) << 30) / 2);
+
+        {
+            essentials::logger("step 4. build m_u2c and m_color_sets");
+            timer.start();
+
+            typename ColorSets::builder color_sets_builder(num_colors);
+            bits::bit_vector::builder u2c_builder;
+            uint64_t num_unitigs = 0;
+            uint64_t num_copied_color_sets = 0;
+            uint64_t num_encoded_color_sets = 0;
+
+            auto add_unitig = [&](char const* data, uint64_t size) {
+                unitigs.push_back(data, size);
+                u2c_builder.push_back(0);
+                num_unitigs += 1;
+            };
+            auto close_color_set = [&]() {
+                assert(num_unitigs > 0);
+                u2c_builder.set(num_unitigs - 1, 1);
+            };
+
+            /* add all runs of the new graph with the given old color set */
+            std::vector<uint32_t> colors;
+            colors.reserve(num_colors);
+            uint64_t i = 0;
+            auto add_runs = [&](const uint32_t old_color_set_id) {
+                while (i != runs.size() and runs[i].old_color_set_id == old_color_set_id) {
+                    const uint32_t new_color_set_id = runs[i].new_color_set_id;
+                    for (; i != runs.size() and runs[i].old_color_set_id == old_color_set_id and
+                           runs[i].new_color_set_id == new_color_set_id;
+                         ++i) {
+                        add_unitig(run_bases.data() + runs[i].begin, runs[i].length);
+                    }
+                    close_color_set();
+
+                    colors.clear();
+                    if (old_color_set_id != none) {
+                        auto it = old_index.color_set(old_color_set_id);
+                        const uint64_t size = it.size();
+                        for (uint64_t j = 0; j != size; ++j, ++it) colors.push_back(*it);
+                    }
+                    for (uint64_t j = new_color_set_offsets[new_color_set_id];
+                         j != new_color_set_offsets[new_color_set_id + 1]; ++j) {
+                        colors.push_back(new_colors[j] + num_old_colors);
+                    }
+                    color_sets_builder.encode_color_set(colors.data(), colors.size());
+                    num_encoded_color_sets += 1;
+                }
+            };
+
+            uint64_t unitig_id = 0;
+            std::string seq;
+            for (uint64_t old_color_set_id = 0; old_color_set_id != num_old_color_sets;
+                 ++old_color_set_id) {
+                /* the kmers of the old unitigs that are not hit keep their color set */
+                bool any = false;
+                for (; unitig_id != num_old_unitigs and
+                       old_index.u2c(unitig_id) == old_color_set_id;
+                     ++unitig_id) {
+                    auto it = dict.at_contig_id(unitig_id);
+                    seq.clear();
+                    while (it.has_next()) {
+                        auto [kmer_id, kmer] = it.next();
+                        if (hit[kmer_id]) {
+                            if (!seq.empty()) add_unitig(seq.data(), seq.size());
+                            any = any or !seq.empty();
+                            seq.clear();
+                            continue;
+                        }
+                        if (seq.empty()) {
+                            seq = kmer;
+                        } else {
+                            seq.push_back(kmer[k - 1]);
+                        }
+                    }
+                    if (!seq.empty()) add_unitig(seq.data(), seq.size());
+                    any = any or !seq.empty();
+                }
+                if (any) {
+                    close_color_set();
+                    color_sets_builder.append_color_set(old_index.get_color_sets(),
+                                                        old_color_set_id);
+                    num_copied_color_sets += 1;
+                }
+                add_runs(old_color_set_id);
+            }
+            assert(unitig_id == num_old_unitigs);
+            add_runs(none);
+            assert(i == runs.size());
+
+            std::vector<run>().swap(runs);
+            std::string().swap(run_bases);
+
+            std::cout << "num_unitigs " << num_unitigs << std::endl;
+            std::cout << "num. old color sets kept " << num_copied_color_sets << std::endl;
+            std::cout << "num. color sets encoded " << num_encoded_color_sets << std::endl;
+
+            color_sets_builder.build(idx.m_color_sets);
+            u2c_builder.build(idx.m_u2c);
+            idx.m_u2c_rank1_index.build(idx.m_u2c);
+            assert(idx.m_u2c.num_bits() == num_unitigs);
+
+            timer.stop();
+            std::cout << "** building m_u2c and m_color_sets took " << timer.elapsed()
+                      << " seconds / " << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 5. build m_k2u");
+            timer.start();
+
+            sshash::build_configuration sshash_config;
+            sshash_config.k = dict.k();
+            sshash_config.m = dict.m();
+            assert(dict.canonical() == true);
+            sshash_config.canonical = dict.canonical();
+            sshash_config.verbose = m_build_config.verbose;
+            sshash_config.tmp_dirname = m_build_config.tmp_dirname;
+            sshash_config.num_threads = util::largest_power_of_2(m_build_config.num_threads);
+            sshash_config.print();
+            unitigs.build_dictionary(idx.m_k2u,
+                                     m_build_config.tmp_dirname + "/" +
+                                         util::filename(m_build_config.file_base_name) +
+                                         ".sshash.fa",
+                                     sshash_config);
+
+            timer.stop();
+            std::cout << "** building m_k2u took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        {
+            essentials::logger("step 6. write filenames");
+            timer.start();
+            std::vector<std::string> filenames;
+            filenames.reserve(num_colors);
+            for (uint64_t i = 0; i != num_old_colors; ++i) {
+                filenames.emplace_back(old_index.filename(i));
+            }
+            for (auto const& fn : m_ccdbg.filenames()) filenames.push_back(fn);
+            idx.m_filenames.build(filenames);
+            timer.stop();
+            std::cout << "** writing filenames took " << timer.elapsed() << " seconds / "
+                      << timer.elapsed() / 60 << " minutes" << std::endl;
+            timer.reset();
+        }
+
+        if (m_build_config.check) {
+            essentials::logger("step 7. check correctness...");
+            std::vector<uint32_t> expected, got;
+            auto check_kmer = [&](char const* kmer, std::vector<uint32_t> const& new_set) {
+                expected.clear();
+                got.clear();
+                auto old_answer = dict.lookup_advanced(kmer);
+                if (old_answer.kmer_id != sshash::constants::invalid_uint64) {
+                    auto it = old_index.color_set(old_index.u2c(old_answer.contig_id));
+                    for (uint64_t j = 0; j != it.size(); ++j, ++it) expected.push_back(*it);
+                }
+                for (uint32_t c : new_set) expected.push_back(c + num_old_colors);
+                auto answer = idx.m_k2u.lookup_advanced(kmer);
+                if (answer.kmer_id == sshash::constants::invalid_uint64) {
+                    std::cout << "kmer " << std::string(kmer, k) << " not found" << std::endl;
+                    return false;
+                }
+                auto it = idx.color_set(idx.u2c(answer.contig_id));
+                for (uint64_t j = 0; j != it.size(); ++j, ++it) got.push_back(*it);
+                if (got != expected) {
+                    std::cout << "wrong color set for kmer " << std::string(kmer, k)
+                              << std::endl;
+                    return false;
+                }
+                return true;
+            };
+
+            /* every kmer of the new references */
+            bool ok = true;
+            std::vector<uint32_t> new_set;
+            m_ccdbg.loop_through_unitigs([&](ggcat::Slice<char> const unitig,
+                                             ggcat::Slice<uint32_t> const color_set,
+                                             bool /* same_color_set */) {
+                if (!ok) return;
+                new_set.assign(color_set.data, color_set.data + color_set.size);
+                for (uint64_t i = 0; i != unitig.size - k + 1 and ok; ++i) {
+                    ok = check_kmer(unitig.data + i, new_set);
+                }
+            });
+
+            /* the old kmers that are not in the new references */
+            new_set.clear();
+            for (uint64_t unitig_id = 0; unitig_id != num_old_unitigs and ok; ++unitig_id) {
+                auto it = dict.at_contig_id(unitig_id);
+                while (it.has_next() and ok) {
+                    auto [kmer_id, kmer] = it.next();
+                    if (!hit[kmer_id]) ok = check_kmer(kmer.c_str(), new_set);
+                }
+            }
+            if (ok) essentials::logger("DONE!");
+        }
+    }
+
+private:
+    build_configuration m_build_config;
+    GGCAT m_ccdbg;
+};
+
+}  // namespace fulgor
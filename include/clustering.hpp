@@ -0,0 +1,491 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
+
+namespace fulgor {
+
+/* HLL sketches, stored contiguously: num_points x num_bytes_per_point byte registers */
+struct sketch_points {
+    sketch_points() : m_num_points(0), m_num_bytes_per_point(0) {}
+
+    void resize(uint64_t num_points, uint64_t num_bytes_per_point) {
+        m_num_points = num_points;
+        m_num_bytes_per_point = num_bytes_per_point;
+        m_data.resize(num_points * num_bytes_per_point);
+    }
+
+    uint8_t* data(uint64_t i) { return m_data.data() + i * m_num_bytes_per_point; }
+    uint8_t const* data(uint64_t i) const { return m_data.data() + i * m_num_bytes_per_point; }
+
+    uint64_t num_points() const { return m_num_points; }
+    uint64_t num_bytes_per_point() const { return m_num_bytes_per_point; }
+
+private:
+    uint64_t m_num_points;
+    uint64_t m_num_bytes_per_point;
+    std::vector<uint8_t> m_data;
+};
+
+struct clustering_parameters {
+    clustering_parameters()
+        : min_delta(0.0001)
+        , max_iteration(10)
+        , min_cluster_size(0)
+        , mini_batch_size(0)
+        , seed(0)
+        , num_threads(1) {}
+
+    float min_delta;           // stop 2-means when the relative decrease of the SSE is smaller
+    uint64_t max_iteration;    // max. num. of iterations of 2-means
+    uint64_t min_cluster_size; // never split a cluster into clusters smaller than this
+    uint64_t mini_batch_size;  // if > 0, clusters larger than this are split with mini-batches
+    uint64_t seed;
+    uint64_t num_threads;
+};
+
+struct clustering_data {
+    /* state of the clustering after each round of splits */
+    struct round {
+        uint64_t num_clusters;
+        double sse;  // sum of squared distances from the centroids
+    };
+
+    uint64_t num_clusters;
+    std::vector<uint32_t> clusters;  // cluster id of each point
+    std::vector<round> rounds;
+
+    void print_report(std::ostream& os) const {
+        os << "  round  num_clusters  SSE  SSE/point\n";
+        for (uint64_t r = 0; r != rounds.size(); ++r) {
+            os << "  " << r << "  " << rounds[r].num_clusters << "  " << rounds[r].sse << "  "
+               << rounds[r].sse / clusters.size() << "\n";
+        }
+        std::vector<uint64_t> sizes(num_clusters, 0);
+        for (auto c : clusters) sizes[c] += 1;
+        if (!sizes.empty()) {
+            os << "  cluster size: min " << *std::min_element(sizes.begin(), sizes.end())
+               << " / avg " << static_cast<double>(clusters.size()) / num_clusters << " / max "
+               << *std::max_element(sizes.begin(), sizes.end()) << "\n";
+        }
+        os << std::flush;
+    }
+};
+
+namespace detail {
+
+/* squared euclidean distance; the independent accumulators let the compiler vectorize */
+inline float distance(uint8_t const* x, float const* c, uint64_t n) {
+    constexpr uint64_t lanes = 16;
+    float acc[lanes] = {0};
+    uint64_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        for (uint64_t j = 0; j != lanes; ++j) {
+            const float d = static_cast<float>(x[i + j]) - c[i + j];
+            acc[j] += d * d;
+        }
+    }
+    float sum = 0;
+    for (; i != n; ++i) {
+        const float d = static_cast<float>(x[i]) - c[i];
+        sum += d * d;
+    }
+    for (uint64_t j = 0; j != lanes; ++j) sum += acc[j];
+    return sum;
+}
+
+/* split [0,n) into num_threads contiguous ranges and run f(thread_id, begin, end) on each */
+template <typename Func>
+void parallel_for(uint64_t num_threads, uint64_t n, Func f) {
+    num_threads = std::max<uint64_t>(std::min(num_threads, n), 1);
+    if (num_threads == 1) {
+        f(0, 0, n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    const uint64_t chunk = (n + num_threads - 1) / num_threads;
+    for (uint64_t t = 0; t != num_threads; ++t) {
+        const uint64_t begin = std::min(t * chunk, n);
+        const uint64_t end = std::min(begin + chunk, n);
+        threads.emplace_back(f, t, begin, end);
+    }
+    for (auto& t : threads) t.join();
+}
+
+/*
+    Bayesian information criterion of a spherical gaussian model with K clusters
+    for R points in M dimensions (Pelleg and Moore, X-means).
+*/
+inline double bic(uint64_t const* sizes, uint64_t K, double sse, uint64_t M) {
+    uint64_t R = 0;
+    for (uint64_t k = 0; k != K; ++k) R += sizes[k];
+    if (R <= K) return -std::numeric_limits<double>::infinity();
+    const double variance = sse / (static_cast<double>(R - K) * M);
+    if (variance <= 0) return std::numeric_limits<double>::infinity();
+    double l = 0;
+    for (uint64_t k = 0; k != K; ++k) {
+        if (sizes[k] != 0) l += sizes[k] * std::log(static_cast<double>(sizes[k]) / R);
+    }
+    l -= 0.5 * R * M * std::log(2 * M_PI * variance);
+    l -= 0.5 * static_cast<double>(R - K) * M;
+    const double num_params = K * (M + 1);
+    return l - 0.5 * num_params * std::log(static_cast<double>(R));
+}
+
+struct bisection {
+    bisection(sketch_points const& points, clustering_parameters const& params)
+        : m_points(points), m_params(params), m_dim(points.num_bytes_per_point()) {}
+
+    /* SSE of ids[0..n) from their centroid */
+    double sse(uint32_t const* ids, uint64_t n, uint64_t num_threads) {
+        std::vector<float> centroid(m_dim, 0);
+        std::vector<std::vector<uint64_t>> sums(num_threads, std::vector<uint64_t>(m_dim, 0));
+        parallel_for(num_threads, n, [&](uint64_t t, uint64_t begin, uint64_t end) {
+            auto& sum = sums[t];
+            for (uint64_t i = begin; i != end; ++i) {
+                uint8_t const* x = m_points.data(ids[i]);
+                for (uint64_t j = 0; j != m_dim; ++j) sum[j] += x[j];
+            }
+        });
+        for (auto const& sum : sums) {
+            for (uint64_t j = 0; j != m_dim; ++j) centroid[j] += sum[j];
+        }
+        for (auto& c : centroid) c /= n;
+        std::vector<double> partial(num_threads, 0);
+        parallel_for(num_threads, n, [&](uint64_t t, uint64_t begin, uint64_t end) {
+            double s = 0;
+            for (uint64_t i = begin; i != end; ++i) {
+                s += distance(m_points.data(ids[i]), centroid.data(), m_dim);
+            }
+            partial[t] = s;
+        });
+        double s = 0;
+        for (auto x : partial) s += x;
+        return s;
+    }
+
+    /*
+        Try to split ids[0..n) into two clusters with 2-means. On success, ids is
+        reordered so that the first left_size ids form the first cluster.
+    */
+    bool split(uint32_t* ids, uint64_t n, double parent_sse, uint64_t num_threads,
+               uint64_t& left_size, double& left_sse, double& right_sse) {
+        const uint64_t min_size = std::max<uint64_t>(m_params.min_cluster_size, 1);
+        if (n < 2 * min_size or parent_sse <= 0) return false;
+
+        m_centroids[0].assign(m_dim, 0);
+        m_centroids[1].assign(m_dim, 0);
+        m_labels.resize(n);
+
+        /* seeds: a random point and the point farthest from it */
+        std::mt19937_64 rng(m_params.seed ^ (uint64_t(ids[0]) << 32) ^ n);
+        const uint64_t first = rng() % n;
+        uint8_t const* x0 = m_points.data(ids[first]);
+        for (uint64_t j = 0; j != m_dim; ++j) m_centroids[0][j] = x0[j];
+        {
+            std::vector<std::pair<float, uint64_t>> farthest(num_threads, {-1, 0});
+            parallel_for(num_threads, n, [&](uint64_t t, uint64_t begin, uint64_t end) {
+                for (uint64_t i = begin; i != end; ++i) {
+                    float d = distance(m_points.data(ids[i]), m_centroids[0].data(), m_dim);
+                    if (d > farthest[t].first) farthest[t] = {d, i};
+                }
+            });
+            auto second = farthest.front();
+            for (auto const& f : farthest) {
+                if (f.first > second.first) second = f;
+            }
+            if (second.first <= 0) return false;  // all points are identical
+            uint8_t const* x1 = m_points.data(ids[second.second]);
+            for (uint64_t j = 0; j != m_dim; ++j) m_centroids[1][j] = x1[j];
+        }
+
+        if (m_params.mini_batch_size > 0 and n > m_params.mini_batch_size) {
+            mini_batch(ids, n, rng);
+        }
+
+        /* Lloyd's iterations; with mini-batches, a single assignment pass */
+        const uint64_t max_iteration =
+            (m_params.mini_batch_size > 0 and n > m_params.mini_batch_size)
+                ? 1
+                : std::max<uint64_t>(m_params.max_iteration, 1);
+        double sse[2] = {0, 0};
+        uint64_t sizes[2] = {0, 0};
+        double prev_sse = std::numeric_limits<double>::max();
+        for (uint64_t iteration = 0; iteration != max_iteration; ++iteration) {
+            assign(ids, n, num_threads, sse, sizes, iteration + 1 != max_iteration);
+            const double curr_sse = sse[0] + sse[1];
+            if (sizes[0] == 0 or sizes[1] == 0) return false;
+            if (prev_sse - curr_sse <= m_params.min_delta * prev_sse) break;
+            prev_sse = curr_sse;
+        }
+
+        if (sizes[0] < min_size or sizes[1] < min_size) return false;
+        const uint64_t parent_size[1] = {n};
+        if (bic(sizes, 2, sse[0] + sse[1], m_dim) <= bic(parent_size, 1, parent_sse, m_dim)) {
+            return false;
+        }
+
+        /* stable partition of the ids by label */
+        m_tmp.resize(n);
+        uint64_t l = 0, r = sizes[0];
+        for (uint64_t i = 0; i != n; ++i) {
+            if (m_labels[i] == 0) {
+                m_tmp[l++] = ids[i];
+            } else {
+                m_tmp[r++] = ids[i];
+            }
+        }
+        std::copy(m_tmp.begin(), m_tmp.end(), ids);
+        left_size = sizes[0];
+        left_sse = sse[0];
+        right_sse = sse[1];
+        return true;
+    }
+
+private:
+    sketch_points const& m_points;
+    clustering_parameters const& m_params;
+    const uint64_t m_dim;
+    std::vector<float> m_centroids[2];
+    std::vector<uint8_t> m_labels;
+    std::vector<uint32_t> m_tmp;
+
+    /*
+        Label every point with its closest centroid, computing the SSE and the size
+        of each cluster. If update is true, move the centroids to the means.
+    */
+    void assign(uint32_t const* ids, uint64_t n, uint64_t num_threads, double* sse,
+                uint64_t* sizes, bool update) {
+        struct partial {
+            double sse[2] = {0, 0};
+            uint64_t sizes[2] = {0, 0};
+            std::vector<uint64_t> sums[2];
+        };
+        std::vector<partial> partials(num_threads);
+        parallel_for(num_threads, n, [&](uint64_t t, uint64_t begin, uint64_t end) {
+            auto& p = partials[t];
+            if (update) {
+                p.sums[0].assign(m_dim, 0);
+                p.sums[1].assign(m_dim, 0);
+            }
+            for (uint64_t i = begin; i != end; ++i) {
+                uint8_t const* x = m_points.data(ids[i]);
+                const float d0 = distance(x, m_centroids[0].data(), m_dim);
+                const float d1 = distance(x, m_centroids[1].data(), m_dim);
+                const uint8_t label = d1 < d0;
+                m_labels[i] = label;
+                p.sse[label] += label ? d1 : d0;
+                p.sizes[label] += 1;
+                if (update) {
+                    auto& sum = p.sums[label];
+                    for (uint64_t j = 0; j != m_dim; ++j) sum[j] += x[j];
+                }
+            }
+        });
+
+        sse[0] = sse[1] = 0;
+        sizes[0] = sizes[1] = 0;
+        for (auto const& p : partials) {
+            for (int c = 0; c != 2; ++c) {
+                sse[c] += p.sse[c];
+                sizes[c] += p.sizes[c];
+            }
+        }
+        if (!update) return;
+        for (int c = 0; c != 2; ++c) {
+            if (sizes[c] == 0) continue;
+            auto& centroid = m_centroids[c];
+            std::fill(centroid.begin(), centroid.end(), 0);
+            for (auto const& p : partials) {
+                if (p.sums[c].empty()) continue;
+                for (uint64_t j = 0; j != m_dim; ++j) centroid[j] += p.sums[c][j];
+            }
+            for (auto& x : centroid) x /= sizes[c];
+        }
+    }
+
+    /* mini-batch 2-means (Sculley, 2010): per-centroid learning rate 1/count */
+    template <typename RNG>
+    void mini_batch(uint32_t const* ids, uint64_t n, RNG& rng) {
+        const uint64_t batch_size = m_params.mini_batch_size;
+        uint64_t counts[2] = {0, 0};
+        std::vector<uint32_t> batch(batch_size);
+        std::vector<uint8_t> labels(batch_size);
+        const uint64_t max_iteration = std::max<uint64_t>(m_params.max_iteration, 1);
+        for (uint64_t iteration = 0; iteration != max_iteration; ++iteration) {
+            for (auto& b : batch) b = ids[rng() % n];
+            for (uint64_t i = 0; i != batch_size; ++i) {
+                uint8_t const* x = m_points.data(batch[i]);
+                labels[i] = distance(x, m_centroids[1].data(), m_dim) <
+                            distance(x, m_centroids[0].data(), m_dim);
+            }
+            for (uint64_t i = 0; i != batch_size; ++i) {
+                auto& centroid = m_centroids[labels[i]];
+                const float eta = 1.0f / ++counts[labels[i]];
+                uint8_t const* x = m_points.data(batch[i]);
+                for (uint64_t j = 0; j != m_dim; ++j) {
+                    centroid[j] += eta * (static_cast<float>(x[j]) - centroid[j]);
+                }
+            }
+        }
+    }
+};
+
+}  // namespace detail
+
+/*
+    Divisive (bisecting) k-means: clusters are split in two with 2-means as long as
+    the split improves the Bayesian information criterion. The splits of a round are
+    independent. While there are fewer clusters than threads, they are split
+    concurrently and the threads are divided among them in proportion to their sizes
+    (with at least min_points_per_thread points per thread). Otherwise, clusters with
+    more than their share of the points are split one at a time with all threads
+    working on the assignment and centroid updates, the others one per thread.
+*/
+inline clustering_data kmeans_divisive(sketch_points const& points,
+                                       clustering_parameters const& params) {
+    struct cluster {
+        uint64_t begin, end;  // in ids
+        double sse;
+    };
+
+    const uint64_t num_points = points.num_points();
+    const uint64_t num_threads = std::max<uint64_t>(params.num_threads, 1);
+    constexpr uint64_t min_points_per_thread = 4096;
+
+    clustering_data data;
+    data.num_clusters = 0;
+    if (num_points == 0) return data;
+
+    std::vector<uint32_t> ids(num_points);
+    for (uint64_t i = 0; i != num_points; ++i) ids[i] = i;
+
+    std::vector<cluster> done;
+    std::vector<cluster> todo;
+    {
+        detail::bisection b(points, params);
+        todo.push_back({0, num_points, b.sse(ids.data(), num_points, num_threads)});
+        data.rounds.push_back({1, todo.front().sse});
+    }
+
+    while (!todo.empty()) {
+        std::vector<cluster> next;
+        std::vector<std::pair<cluster, cluster>> children(todo.size());
+        std::vector<uint8_t> split(todo.size(), false);
+
+        auto try_split = [&](uint64_t i, detail::bisection& b, uint64_t threads) {
+            auto const& c = todo[i];
+            uint64_t left_size = 0;
+            double left_sse = 0, right_sse = 0;
+            if (b.split(ids.data() + c.begin, c.end - c.begin, c.sse, threads, left_size,
+                        left_sse, right_sse)) {
+                split[i] = true;
+                children[i] = {{c.begin, c.begin + left_size, left_sse},
+                               {c.begin + left_size, c.end, right_sse}};
+            }
+        };
+
+        uint64_t round_points = 0;
+        for (auto const& c : todo) round_points += c.end - c.begin;
+        auto max_threads = [&](uint64_t i) {
+            const uint64_t n = todo[i].end - todo[i].begin;
+            return std::clamp<uint64_t>(n / min_points_per_thread, 1, num_threads);
+        };
+
+        if (todo.size() < num_threads) {
+            /* one thread each, and the others in proportion to the sizes */
+            const uint64_t num_spare_threads = num_threads - todo.size();
+            std::vector<uint64_t> shares(todo.size());
+            std::vector<std::pair<uint64_t, uint64_t>> remainders(todo.size());
+            uint64_t num_assigned = 0;
+            for (uint64_t i = 0; i != todo.size(); ++i) {
+                const uint64_t x = num_spare_threads * (todo[i].end - todo[i].begin);
+                shares[i] = x / round_points;
+                remainders[i] = {x % round_points, i};
+                num_assigned += shares[i];
+            }
+            std::sort(remainders.begin(), remainders.end(), std::greater<>());
+            for (uint64_t j = 0; num_assigned != num_spare_threads; ++j, ++num_assigned) {
+                shares[remainders[j].second] += 1;
+            }
+
+            std::vector<std::thread> threads(todo.size());
+            for (uint64_t i = 0; i != todo.size(); ++i) {
+                const uint64_t threads_for_cluster = std::min(shares[i] + 1, max_threads(i));
+                threads[i] = std::thread([&, i, threads_for_cluster]() {
+                    detail::bisection b(points, params);
+                    try_split(i, b, threads_for_cluster);
+                });
+            }
+            for (auto& t : threads) t.join();
+        } else {
+            auto is_large = [&](uint64_t i) {
+                return (todo[i].end - todo[i].begin) * num_threads > round_points and
+                       max_threads(i) > 1;
+            };
+
+            /* clusters with more than their share of the points, data-parallel */
+            {
+                detail::bisection b(points, params);
+                for (uint64_t i = 0; i != todo.size(); ++i) {
+                    if (is_large(i)) try_split(i, b, max_threads(i));
+                }
+            }
+
+            /* the others, one per thread */
+            std::atomic<uint64_t> next_cluster{0};
+            std::vector<std::thread> threads(num_threads);
+            for (auto& t : threads) {
+                t = std::thread([&]() {
+                    detail::bisection b(points, params);
+                    for (uint64_t i = next_cluster++; i < todo.size(); i = next_cluster++) {
+                        if (!is_large(i)) try_split(i, b, 1);
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+        }
+
+        for (uint64_t i = 0; i != todo.size(); ++i) {
+            if (split[i]) {
+                next.push_back(children[i].first);
+                next.push_back(children[i].second);
+            } else {
+                done.push_back(todo[i]);
+            }
+        }
+        todo.swap(next);
+
+        if (!todo.empty()) {
+            double sse = 0;
+            for (auto const& c : done) sse += c.sse;
+            for (auto const& c : todo) sse += c.sse;
+            data.rounds.push_back({done.size() + todo.size(), sse});
+        }
+    }
+
+    /* number the clusters in order of their smallest point */
+    for (auto const& c : done) {
+        std::sort(ids.begin() + c.begin, ids.begin() + c.end);
+    }
+    std::sort(done.begin(), done.end(),
+              [&](cluster const& x, cluster const& y) { return ids[x.begin] < ids[y.begin]; });
+    data.num_clusters = done.size();
+    data.clusters.resize(num_points);
+    for (uint64_t cluster_id = 0; cluster_id != done.size(); ++cluster_id) {
+        for (uint64_t i = done[cluster_id].begin; i != done[cluster_id].end; ++i) {
+            data.clusters[ids[i]] = cluster_id;
+        }
+    }
+
+    return data;
+}
+
+}  // namespace fulgor
@@ -8,11 +8,13 @@ struct differential {
     struct builder {
         builder()
             : m_num_total_integers(0)
-            , m_num_sets(0) { }
+            , m_num_sets(0)
+            , m_num_scratch_allocations(0) { }
         builder(uint32_t num_colors)
             : m_num_total_integers(0)
             , m_num_sets(0)
-            , m_num_colors(num_colors) { }
+            , m_num_colors(num_colors)
+            , m_num_scratch_allocations(0) { }
 
         void init_color_sets_builder(uint64_t num_colors) {
             m_num_colors = num_colors;
@@ -22,22 +24,27 @@ struct differential {
 
         void reserve_num_bits(uint64_t num_bits) { m_bvb.reserve(num_bits); }
 
-        void process_partition(std::vector<uint32_t> const& representative){
+        /*
+            The representative is taken by swap, not copied: on return, representative
+            holds the buffer of the previous one, ready to be reused by the caller.
+        */
+        void process_partition(std::vector<uint32_t>& representative){
             m_representative_offsets.push_back(m_bvb.num_bits());
-            m_curr_representative = representative;
+            m_curr_representative.swap(representative);
             if (m_clusters.num_bits() > 0) m_clusters.set(m_clusters.num_bits() - 1);
 
-            uint64_t size = representative.size();
+            auto const& rp = m_curr_representative;
+            uint64_t size = rp.size();
 
             bits::util::write_delta(m_bvb, size);
             m_num_total_integers += size + 1;  // size plus size number
             m_num_sets += 1;
 
             if (size > 0) {
-                uint32_t prev_val = representative[0];
+                uint32_t prev_val = rp[0];
                 bits::util::write_delta(m_bvb, prev_val);
                 for (uint64_t i = 1; i < size; ++i) {
-                    uint32_t val = representative[i];
+                    uint32_t val = rp[i];
                     assert(val >= prev_val + 1);
                     bits::util::write_delta(m_bvb, val - (prev_val + 1));
                     prev_val = val;
@@ -50,8 +57,9 @@ struct differential {
             m_color_set_offsets.push_back(m_bvb.num_bits());
             uint64_t it_size = it.size();
             uint64_t rp_size = m_curr_representative.size();
-            std::vector<uint32_t> diff_set;
-            diff_set.reserve(m_num_colors);
+            auto& diff_set = m_diff_set;  // scratch, reused across color sets
+            const uint64_t capacity = diff_set.capacity();
+            diff_set.clear();
 
             m_clusters.push_back(false);
 
@@ -80,6 +88,8 @@ struct differential {
                 j += 1;
             }
 
+            m_num_scratch_allocations += diff_set.capacity() != capacity;
+
             uint64_t size = diff_set.size();
             bits::util::write_delta(m_bvb, size);
             bits::util::write_delta(m_bvb, it_size);
@@ -102,12 +112,17 @@ struct differential {
 
         }
 
+        uint64_t num_sets() const { return m_num_sets; }
+        uint64_t num_bits() const { return m_bvb.num_bits(); }
+        uint64_t num_scratch_allocations() const { return m_num_scratch_allocations; }
+
         void append(differential::builder const& db) {
             if (db.m_color_set_offsets.size() - 1 == 0) return;
             uint64_t delta = m_bvb.num_bits();
             m_bvb.append(db.m_bvb);
             m_num_total_integers += db.m_num_total_integers;
             m_num_sets += db.m_num_sets;
+            m_num_scratch_allocations += db.m_num_scratch_allocations;
             m_clusters.set(m_clusters.num_bits() - 1);
             m_clusters.append(db.m_clusters);
 
@@ -169,6 +184,8 @@ struct differential {
         std::vector<uint64_t> m_representative_offsets, m_color_set_offsets;
 
         std::vector<uint32_t> m_curr_representative;
+        std::vector<uint32_t> m_diff_set;
+        uint64_t m_num_scratch_allocations;
     };
 
     struct forward_iterator {
@@ -303,6 +320,36 @@ struct differential {
         return forward_iterator(this, set_begin, representative_begin);
     }
 
+    /*
+        Same as calling color_set() for each of the n ids, but resolving all offsets first,
+        then prefetching the headers of the sets and of their representatives, and only
+        then building the iterators, so that the cache misses overlap.
+    */
+    void color_sets(uint32_t const* color_ids, const uint64_t n,
+                    std::vector<forward_iterator>& iterators) const  //
+    {
+        uint64_t set_begin[constants::color_set_prefetch_batch_size];
+        uint64_t representative_begin[constants::color_set_prefetch_batch_size];
+        for (uint64_t i = 0; i < n; i += constants::color_set_prefetch_batch_size) {
+            const uint64_t batch_size =
+                std::min<uint64_t>(constants::color_set_prefetch_batch_size, n - i);
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                const uint64_t color_id = color_ids[i + j];
+                assert(color_id < num_color_sets());
+                set_begin[j] = m_color_set_offsets.access(color_id);
+                representative_begin[j] = m_representative_offsets.access(
+                    m_clusters_rank1_index.rank1(m_clusters, color_id));
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                util::prefetch_bit(m_color_sets, set_begin[j]);
+                util::prefetch_bit(m_color_sets, representative_begin[j]);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                iterators.emplace_back(this, set_begin[j], representative_begin[j]);
+            }
+        }
+    }
+
     uint64_t num_color_sets() const { return m_color_set_offsets.size(); }
     uint64_t num_partitions() const { return m_representative_offsets.size(); }
     uint64_t num_colors() const { return m_num_colors; }
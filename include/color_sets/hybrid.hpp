@@ -94,6 +94,35 @@ struct hybrid {
             }
         }
 
+        /*
+            Append the color set color_set_id of h. Its encoding is copied bit by bit when
+            it would not change with the number of colors of this builder (that is always
+            the case for small delta-gaps sets); otherwise the set is decoded and re-encoded.
+        */
+        void append_color_set(hybrid const& h, const uint64_t color_set_id) {
+            auto it = h.color_set(color_set_id);
+            const uint64_t size = it.size();
+            const bool same_encoding = h.m_num_colors == m_num_colors or
+                                       (it.encoding_type() == encoding_t::delta_gaps and
+                                        size < m_sparse_set_threshold_size);
+            if (!same_encoding) {
+                m_decoded.resize(size);
+                for (uint64_t i = 0; i != size; ++i, ++it) m_decoded[i] = *it;
+                encode_color_set(m_decoded.data(), size);
+                return;
+            }
+            const uint64_t begin = h.m_offsets.access(color_set_id);
+            const uint64_t end = h.m_offsets.access(color_set_id + 1);
+            auto bits_it = h.m_color_sets.get_iterator_at(begin);
+            for (uint64_t pos = begin; pos < end; pos += 64) {
+                const uint64_t len = std::min<uint64_t>(64, end - pos);
+                m_bvb.append_bits(bits_it.take(len), len);
+            }
+            m_offsets.push_back(m_bvb.num_bits());
+            m_num_total_integers += size;
+            m_num_color_sets += 1;
+        }
+
         void append(hybrid::builder& hb) {
             if (hb.m_num_color_sets == 0) return;
             m_bvb.append(hb.m_bvb);
@@ -108,6 +137,67 @@ struct hybrid {
             assert(m_num_color_sets == m_offsets.size() - 1);
         }
 
+        /*
+            Append all the parts, in order, using num_threads threads. The position of
+            every part is known in advance, so the parts are copied concurrently: each
+            thread copies the 64-bit words that a part does not share with the previous
+            one; the bits of the shared words are copied at the end. Parts are consumed.
+        */
+        void append(std::vector<hybrid::builder>& parts, const uint64_t num_threads) {
+            const uint64_t num_parts = parts.size();
+            std::vector<uint64_t> bit_offsets(num_parts + 1);
+            std::vector<uint64_t> set_offsets(num_parts + 1);
+            bit_offsets[0] = m_bvb.num_bits();
+            set_offsets[0] = m_num_color_sets;
+            for (uint64_t i = 0; i != num_parts; ++i) {
+                bit_offsets[i + 1] = bit_offsets[i] + parts[i].m_bvb.num_bits();
+                set_offsets[i + 1] = set_offsets[i] + parts[i].m_num_color_sets;
+                m_num_total_integers += parts[i].m_num_total_integers;
+            }
+            m_bvb.resize(bit_offsets[num_parts]);
+            m_offsets.resize(set_offsets[num_parts] + 1);
+            m_num_color_sets = set_offsets[num_parts];
+
+            /* number of bits of part i that go into the last word of part i-1 */
+            auto num_shared_bits = [&](const uint64_t i) {
+                return std::min((64 - bit_offsets[i] % 64) % 64,
+                                bit_offsets[i + 1] - bit_offsets[i]);
+            };
+
+            std::vector<bits::bit_vector> part_bits(num_parts);
+            std::atomic<uint64_t> next_part(0);
+            auto copy_parts = [&]() {
+                for (uint64_t i = next_part++; i < num_parts; i = next_part++) {
+                    auto& part = parts[i];
+                    for (uint64_t j = 1; j != part.m_offsets.size(); ++j) {
+                        m_offsets[set_offsets[i] + j] = bit_offsets[i] + part.m_offsets[j];
+                    }
+                    std::vector<uint64_t>().swap(part.m_offsets);
+                    part.m_bvb.build(part_bits[i]);
+                    const uint64_t size = part_bits[i].num_bits();
+                    uint64_t pos = num_shared_bits(i);
+                    if (pos == size) continue;
+                    auto bits_it = part_bits[i].get_iterator_at(pos);
+                    for (; pos < size; pos += 64) {
+                        const uint64_t len = std::min<uint64_t>(64, size - pos);
+                        m_bvb.set_bits(bit_offsets[i] + pos, bits_it.take(len), len);
+                    }
+                }
+            };
+            std::vector<std::thread> threads(std::min(num_threads, num_parts));
+            for (auto& t : threads) t = std::thread(copy_parts);
+            for (auto& t : threads) t.join();
+
+            for (uint64_t i = 0; i != num_parts; ++i) {
+                const uint64_t len = num_shared_bits(i);
+                if (len == 0) continue;
+                m_bvb.set_bits(bit_offsets[i], part_bits[i].get_iterator_at(0).take(len), len);
+            }
+            parts.clear();
+            assert(m_num_color_sets == m_offsets.size() - 1);
+            assert(m_offsets.back() == m_bvb.num_bits());
+        }
+
         void build(hybrid& h) {
             h.m_num_colors = m_num_colors;
             h.m_sparse_set_threshold_size = m_sparse_set_threshold_size;
@@ -137,6 +227,9 @@ struct hybrid {
             init(m_num_colors);
         }
 
+        uint64_t num_color_sets() const { return m_num_color_sets; }
+        uint64_t num_bits() const { return m_bvb.num_bits(); }
+
     private:
         uint32_t m_num_colors;
         uint32_t m_sparse_set_threshold_size;
@@ -146,6 +239,7 @@ struct hybrid {
 
         bits::bit_vector::builder m_bvb;
         std::vector<uint64_t> m_offsets;
+        std::vector<uint32_t> m_decoded;
     };
 
     struct forward_iterator {
@@ -312,6 +406,36 @@ struct hybrid {
         return forward_iterator(this, begin);
     }
 
+    /*
+        Same as calling color_set() for each of the n ids, but in three phases:
+        first all offsets are resolved, then the headers of the sets are prefetched,
+        and only then the iterators are built, so that the cache misses overlap.
+    */
+    void color_sets(uint32_t const* color_set_ids, const uint64_t n,
+                    std::vector<forward_iterator>& iterators) const  //
+    {
+        uint64_t offsets[constants::color_set_prefetch_batch_size];
+        for (uint64_t i = 0; i < n; i += constants::color_set_prefetch_batch_size) {
+            const uint64_t batch_size =
+                std::min<uint64_t>(constants::color_set_prefetch_batch_size, n - i);
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                assert(color_set_ids[i + j] < num_color_sets());
+                offsets[j] = m_offsets.access(color_set_ids[i + j]);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) prefetch(offsets[j]);
+            for (uint64_t j = 0; j != batch_size; ++j) iterators.emplace_back(this, offsets[j]);
+        }
+    }
+
+    /* prefetch the header of the color set encoded at the given offset */
+    void prefetch(uint64_t offset) const { util::prefetch_bit(m_color_sets, offset); }
+
+    /* position, in bits, of the encoding of the given color set */
+    uint64_t offset(uint64_t color_set_id) const {
+        assert(color_set_id < num_color_sets());
+        return m_offsets.access(color_set_id);
+    }
+
     uint32_t num_colors() const { return m_num_colors; }
     uint64_t num_color_sets() const { return m_offsets.size() - 1; }
 
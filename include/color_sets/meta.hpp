@@ -38,6 +38,7 @@ struct meta {
         void init_color_sets_builder(uint64_t num_colors, uint64_t num_partitions) {
             m_num_colors = num_colors;
             m_color_sets_builders.resize(num_partitions);
+            m_num_reserved_bits.resize(num_partitions, 0);
         }
 
         void init_partition(uint64_t partition_id, uint64_t num_colors_in_partition) {
@@ -45,8 +46,10 @@ struct meta {
             m_color_sets_builders[partition_id].init(num_colors_in_partition);
         }
 
+        /* the reservation also holds for the builders later moved into the partition */
         void reserve_num_bits(uint64_t partition_id, uint64_t num_bits) {
             assert(partition_id < m_color_sets_builders.size());
+            m_num_reserved_bits[partition_id] = num_bits;
             m_color_sets_builders[partition_id].reserve_num_bits(num_bits);
         }
 
@@ -56,6 +59,21 @@ struct meta {
             m_color_sets_builders[partition_id].encode_color_set(color_set, size);
         }
 
+        /*
+            Append the color sets encoded, for the same partition, by another builder.
+            If the partition is still empty, b is moved rather than copied.
+        */
+        void append_color_sets(uint64_t partition_id, typename ColorSets::builder& b) {
+            assert(partition_id < m_color_sets_builders.size());
+            auto& dst = m_color_sets_builders[partition_id];
+            if (dst.num_color_sets() == 0) {
+                dst = std::move(b);
+                dst.reserve_num_bits(m_num_reserved_bits[partition_id]);
+            } else {
+                dst.append(b);
+            }
+        }
+
         void encode_metacolor_set(uint32_t const* metacolor_set, const uint64_t size) {
             assert(size < (1ULL << m_meta_color_sets_builder.width()));
             m_meta_color_sets_builder.push_back(size);
@@ -82,6 +100,7 @@ struct meta {
     private:
         bits::compact_vector::builder m_meta_color_sets_builder;
         std::vector<typename ColorSets::builder> m_color_sets_builders;
+        std::vector<uint64_t> m_num_reserved_bits;  // per partition
 
         uint64_t m_num_colors;
         uint64_t m_offset;
@@ -243,6 +262,46 @@ struct meta {
         return forward_iterator(this, begin);
     }
 
+    /*
+        Same as calling color_set() for each of the n ids, but in phases: first all
+        offsets are resolved and the headers of the meta color sets prefetched, then the
+        first partial set of each color set is located through the partition endpoints
+        and its header prefetched, and only then the iterators are built, so that the
+        cache misses overlap.
+    */
+    void color_sets(uint32_t const* color_set_ids, const uint64_t n,
+                    std::vector<forward_iterator>& iterators) const  //
+    {
+        uint64_t begin[constants::color_set_prefetch_batch_size];
+        uint64_t partial_begin[constants::color_set_prefetch_batch_size];
+        uint32_t partition_id[constants::color_set_prefetch_batch_size];
+        for (uint64_t i = 0; i < n; i += constants::color_set_prefetch_batch_size) {
+            const uint64_t batch_size =
+                std::min<uint64_t>(constants::color_set_prefetch_batch_size, n - i);
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                assert(color_set_ids[i + j] < num_color_sets());
+                begin[j] = m_meta_color_sets_offsets.access(color_set_ids[i + j]);
+            }
+            const uint64_t width = m_meta_color_sets.width();
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                /* the size and the first meta color */
+                util::prefetch_bit(m_meta_color_sets, begin[j] * width);
+                util::prefetch_bit(m_meta_color_sets, (begin[j] + 2) * width - 1);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                const uint32_t meta_color = m_meta_color_sets[begin[j] + 1];
+                const uint32_t p = partition_of(meta_color);
+                partition_id[j] = p;
+                partial_begin[j] = m_partial_color_sets[p].offset(
+                    meta_color - m_partition_endpoints[p].num_color_sets_before);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                m_partial_color_sets[partition_id[j]].prefetch(partial_begin[j]);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) iterators.emplace_back(this, begin[j]);
+        }
+    }
+
     std::vector<ColorSets> const& partial_colors() const { return m_partial_color_sets; }
 
     uint32_t num_colors() const { return m_num_colors; }
@@ -271,6 +330,18 @@ struct meta {
     }
 
 private:
+    /* the partition of the given meta color: the last one that starts at or before it */
+    uint32_t partition_of(const uint32_t meta_color) const {
+        auto it = std::upper_bound(m_partition_endpoints.begin(), m_partition_endpoints.end(),
+                                   meta_color, [](uint32_t x, partition_endpoint const& e) {
+                                       return x < e.num_color_sets_before;
+                                   });
+        assert(it != m_partition_endpoints.begin());
+        const uint32_t partition_id = std::distance(m_partition_endpoints.begin(), it) - 1;
+        assert(partition_id < num_partitions());
+        return partition_id;
+    }
+
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
         visitor.visit(t.m_num_colors);
@@ -53,9 +53,9 @@ struct meta_differential {
         }
 
         void process_partition(differential& d) {
-            m_partial_color_sets.push_back(d);
             m_partition_endpoints.push_back({m_prev_docs, d.num_color_sets()});
             m_prev_docs += d.num_colors();
+            m_partial_color_sets.push_back(std::move(d));
         }
 
         void process_metacolor_set(vector<uint32_t>& relative_colors) {
@@ -275,6 +275,37 @@ struct meta_differential {
         return forward_iterator(this, begin_partition_set, begin_rel);
     }
 
+    /*
+        Same as calling color_set() for each of the n ids, but resolving all offsets first,
+        then prefetching the heads of the partition sets and of the relative colors, and
+        only then building the iterators, so that the cache misses overlap.
+    */
+    void color_sets(uint32_t const* color_set_ids, const uint64_t n,
+                    std::vector<forward_iterator>& iterators) const  //
+    {
+        uint64_t begin_partition_set[constants::color_set_prefetch_batch_size];
+        uint64_t begin_rel[constants::color_set_prefetch_batch_size];
+        for (uint64_t i = 0; i < n; i += constants::color_set_prefetch_batch_size) {
+            const uint64_t batch_size =
+                std::min<uint64_t>(constants::color_set_prefetch_batch_size, n - i);
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                const uint64_t color_set_id = color_set_ids[i + j];
+                assert(color_set_id < num_color_sets());
+                begin_partition_set[j] =
+                    m_partition_sets_offsets.access(m_partition_sets_partitions_rank1_index.rank1(
+                        m_partition_sets_partitions, color_set_id));
+                begin_rel[j] = m_relative_colors_offsets.access(color_set_id);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                util::prefetch_bit(m_partition_sets, begin_partition_set[j]);
+                util::prefetch_bit(m_relative_colors, begin_rel[j]);
+            }
+            for (uint64_t j = 0; j != batch_size; ++j) {
+                iterators.emplace_back(this, begin_partition_set[j], begin_rel[j]);
+            }
+        }
+    }
+
     uint32_t num_colors() const { return m_num_colors; }
     uint64_t num_color_sets() const { return m_relative_colors_offsets.size() - 1; }
     uint64_t num_partitions() const { return m_partition_endpoints.size(); }
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <iostream>
+
+namespace fulgor {
+
+/*
+    A blocking FIFO queue that holds at most a given number of items.
+    Producers block while the queue is full; consumers block while it is empty.
+    After close(), pop() drains the remaining items and then returns false.
+*/
+template <typename T>
+struct bounded_queue {
+    bounded_queue(uint64_t capacity) : m_capacity(capacity), m_closed(false) {
+        assert(capacity > 0);
+    }
+
+    void push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [&] { return m_items.size() < m_capacity; });
+            assert(!m_closed);
+            m_items.push_back(std::move(item));
+        }
+        m_not_empty.notify_one();
+    }
+
+    bool pop(T& item) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [&] { return !m_items.empty() or m_closed; });
+            if (m_items.empty()) return false;  // closed and drained
+            item = std::move(m_items.front());
+            m_items.pop_front();
+        }
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_not_empty.notify_all();
+    }
+
+private:
+    uint64_t m_capacity;
+    bool m_closed;
+    std::deque<T> m_items;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full, m_not_empty;
+};
+
+/*
+    Runs critical sections in increasing ticket order: a thread holding ticket t
+    sleeps until all tickets < t have been served.
+*/
+struct turnstile {
+    turnstile() : m_next_ticket(0) {}
+
+    template <typename Func>
+    void run_in_order(const uint64_t ticket, Func f) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_turn.wait(lock, [&] { return m_next_ticket == ticket; });
+            f();
+            m_next_ticket += 1;
+        }
+        m_turn.notify_all();
+    }
+
+private:
+    uint64_t m_next_ticket;
+    std::mutex m_mutex;
+    std::condition_variable m_turn;
+};
+
+/*
+    One double-ended queue of tasks per worker. A worker pushes and pops tasks at the
+    back of its own deque (the most recent tasks, whose data is still in its cache),
+    while idle workers steal from the front of the others' deques (the oldest tasks).
+    Each deque has its own lock and cache line, so that workers only contend when
+    stealing from the same victim.
+*/
+template <typename Task>
+struct work_stealing_deques {
+    work_stealing_deques(uint64_t num_workers) : m_deques(num_workers) {
+        assert(num_workers > 0);
+    }
+
+    void push(const uint64_t worker_id, Task task) {
+        auto& d = m_deques[worker_id];
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.tasks.push_back(std::move(task));
+        d.size.store(d.tasks.size(), std::memory_order_relaxed);
+    }
+
+    bool pop(const uint64_t worker_id, Task& task) {
+        auto& d = m_deques[worker_id];
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (d.tasks.empty()) return false;
+        task = std::move(d.tasks.back());
+        d.tasks.pop_back();
+        d.size.store(d.tasks.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    /* steal from the other deques, starting from the one after the thief's own */
+    bool steal(const uint64_t thief_id, Task& task) {
+        const uint64_t num_workers = m_deques.size();
+        for (uint64_t i = 1; i != num_workers; ++i) {
+            auto& d = m_deques[(thief_id + i) % num_workers];
+            if (d.size.load(std::memory_order_relaxed) == 0) continue;  // don't lock
+            std::lock_guard<std::mutex> lock(d.mutex);
+            if (d.tasks.empty()) continue;
+            task = std::move(d.tasks.front());
+            d.tasks.pop_front();
+            d.size.store(d.tasks.size(), std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    bool empty() const {
+        for (auto const& d : m_deques) {
+            if (d.size.load(std::memory_order_relaxed) != 0) return false;
+        }
+        return true;
+    }
+
+private:
+    struct alignas(64) deque {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::atomic<uint64_t> size{0};
+    };
+    std::vector<deque> m_deques;
+};
+
+/*
+    A map from 128-bit hashes to 64-bit values supporting concurrent find-or-insert.
+    Keys are spread over stripes by their high bits: each stripe is an open-addressing
+    table with linear probing, guarded by its own lock and grown independently,
+    so that threads only contend when they hit the same stripe.
+*/
+struct striped_hash128_map {
+    static constexpr uint64_t empty = uint64_t(-1);
+
+    striped_hash128_map(uint64_t num_stripes = 64) {
+        uint64_t n = 1;
+        while (n < num_stripes) n *= 2;
+        m_stripes = std::vector<stripe>(n);
+        m_stripe_mask = n - 1;
+    }
+
+    /*
+        Return the value of key and false if key is present. Otherwise store
+        make_value() (called under the stripe lock) and return it with true.
+    */
+    template <typename Func>
+    std::pair<uint64_t, bool> find_or_insert(__uint128_t key, Func make_value) {
+        const uint64_t h = static_cast<uint64_t>(key) ^ static_cast<uint64_t>(key >> 64);
+        auto& s = m_stripes[(h >> 48) & m_stripe_mask];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.entries.empty()) s.entries.resize(16);
+        const uint64_t mask = s.entries.size() - 1;
+        uint64_t i = h & mask;
+        while (s.entries[i].value != empty) {
+            if (s.entries[i].key == key) return {s.entries[i].value, false};
+            i = (i + 1) & mask;
+        }
+        const uint64_t value = make_value();
+        assert(value != empty);
+        s.entries[i] = {key, value};
+        s.size += 1;
+        if (4 * s.size > 3 * s.entries.size()) s.grow();
+        return {value, true};
+    }
+
+    uint64_t size() const {
+        uint64_t n = 0;
+        for (auto const& s : m_stripes) n += s.size;
+        return n;
+    }
+
+private:
+    struct entry {
+        __uint128_t key = 0;
+        uint64_t value = empty;
+    };
+
+    struct stripe {
+        std::mutex mutex;
+        std::vector<entry> entries;
+        uint64_t size = 0;
+
+        void grow() {
+            std::vector<entry> tmp(2 * entries.size());
+            const uint64_t mask = tmp.size() - 1;
+            for (auto const& e : entries) {
+                if (e.value == empty) continue;
+                uint64_t i = (static_cast<uint64_t>(e.key) ^ static_cast<uint64_t>(e.key >> 64)) &
+                             mask;
+                while (tmp[i].value != empty) i = (i + 1) & mask;
+                tmp[i] = e;
+            }
+            entries.swap(tmp);
+        }
+    };
+
+    std::vector<stripe> m_stripes;
+    uint64_t m_stripe_mask;
+};
+
+/*
+    A set of tasks with dependencies, run by a pool of workers. A task becomes ready
+    when all the tasks it depends on are done. Tasks made ready by a task that ends
+    are started before the other ready tasks, so that a chain of tasks is carried to
+    its end (and its memory released) before new chains are started; the tasks ready
+    from the beginning are started in the order they were added. Each task declares
+    the memory it needs: a ready task is started only if it fits in the memory budget
+    together with the running tasks, or if it needs no memory; if no task is running
+    and none fits, the ready task added first is started. A task can hand over part of
+    its memory to a task that depends on it, e.g. for the output it leaves to that task:
+    this part stays in use until the latter task ends, so that the outputs waiting to
+    be consumed are also bounded by the budget. Tasks receive the id of the worker
+    running them, so that they can reuse per-worker buffers. The time taken by each
+    task is printed when it ends. If a task throws, no further task is started and
+    run() rethrows the exception.
+*/
+struct task_graph {
+    typedef std::function<void(uint64_t worker_id)> function_type;
+
+    uint64_t add(std::string name, function_type f, std::vector<uint64_t> const& dependencies = {},
+                 uint64_t memory_in_bytes = 0) {
+        const uint64_t id = m_tasks.size();
+        m_tasks.push_back(
+            {std::move(name), std::move(f), {}, 0, memory_in_bytes, memory_in_bytes, 0, 0});
+        for (uint64_t d : dependencies) {
+            assert(d < id);
+            m_tasks[d].successors.push_back(id);
+            m_tasks[id].num_pending += 1;
+        }
+        return id;
+    }
+
+    void run(uint64_t num_workers, uint64_t memory_budget_in_bytes) {
+        assert(num_workers > 0);
+        m_memory_budget = memory_budget_in_bytes;
+        m_memory_in_use = 0;
+        m_num_running = 0;
+        m_num_done = 0;
+        m_error = nullptr;
+        m_ready.clear();
+        for (uint64_t id = 0; id != m_tasks.size(); ++id) {
+            if (m_tasks[id].num_pending == 0) m_ready.push_back(id);
+        }
+        m_start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> workers(std::min<uint64_t>(num_workers, m_tasks.size()));
+        for (uint64_t worker_id = 0; worker_id != workers.size(); ++worker_id) {
+            workers[worker_id] = std::thread([this, worker_id]() { work(worker_id); });
+        }
+        for (auto& w : workers) w.join();
+        if (m_error) std::rethrow_exception(m_error);
+        assert(m_num_done == m_tasks.size());
+    }
+
+    /* memory_in_bytes of the memory of task from is released when task to (which must
+       depend on it) ends */
+    void hand_over_memory(uint64_t from, uint64_t to, uint64_t memory_in_bytes) {
+        assert(from < to and to < m_tasks.size());
+        assert(memory_in_bytes <= m_tasks[from].memory_released_in_bytes);
+        m_tasks[from].memory_released_in_bytes -= memory_in_bytes;
+        m_tasks[to].memory_released_in_bytes += memory_in_bytes;
+    }
+
+    uint64_t num_tasks() const { return m_tasks.size(); }
+
+private:
+    struct task {
+        std::string name;
+        function_type f;
+        std::vector<uint64_t> successors;
+        uint64_t num_pending;
+        uint64_t memory_in_bytes;           // taken when the task starts
+        uint64_t memory_released_in_bytes;  // when it ends, including what is handed over
+        double begin, end;  // seconds since the start of run()
+    };
+
+    std::vector<task> m_tasks;
+    std::deque<uint64_t> m_ready;
+    uint64_t m_memory_budget, m_memory_in_use, m_num_running, m_num_done;
+    std::exception_ptr m_error;
+    std::chrono::steady_clock::time_point m_start;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    double seconds_since_start() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    /* the first ready task that fits in memory, or m_ready.end() */
+    std::deque<uint64_t>::iterator next_task() {
+        auto it = m_ready.begin();
+        for (; it != m_ready.end(); ++it) {
+            const uint64_t memory = m_tasks[*it].memory_in_bytes;
+            if (memory == 0 or m_memory_in_use + memory <= m_memory_budget) return it;
+        }
+        if (m_num_running == 0) return std::min_element(m_ready.begin(), m_ready.end());
+        return it;
+    }
+
+    void work(uint64_t worker_id) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            std::deque<uint64_t>::iterator it;
+            m_cv.wait(lock, [&] {
+                if (m_error or m_num_done + m_num_running == m_tasks.size()) return true;
+                it = next_task();
+                return it != m_ready.end();
+            });
+            if (m_error or m_num_done + m_num_running == m_tasks.size()) break;
+
+            const uint64_t id = *it;
+            m_ready.erase(it);
+            auto& t = m_tasks[id];
+            m_memory_in_use += t.memory_in_bytes;
+            m_num_running += 1;
+            t.begin = seconds_since_start();
+            lock.unlock();
+
+            std::exception_ptr error = nullptr;
+            try {
+                t.f(worker_id);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            t.end = seconds_since_start();
+            m_memory_in_use -= t.memory_released_in_bytes;
+            m_num_running -= 1;
+            m_num_done += 1;
+            if (error and !m_error) m_error = error;
+            for (auto s = t.successors.rbegin(); s != t.successors.rend(); ++s) {
+                if (--m_tasks[*s].num_pending == 0) m_ready.push_front(*s);
+            }
+            std::cout << "  ** task '" << t.name << "' took " << t.end - t.begin
+                      << " seconds (started at " << t.begin << ", worker " << worker_id << ")"
+                      << std::endl;
+            m_cv.notify_all();
+        }
+        m_cv.notify_all();
+    }
+};
+
+}  // namespace fulgor
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "index.hpp"
+
+namespace fulgor {
+
+/*
+    Several indexes (shards), built on disjoint sets of references, queried as one index.
+    The colors of shard s are shifted by the number of colors of shards 0..s-1.
+
+    The color set of a kmer in the collection is the union of its (shifted) color sets in
+    the shards, so a color of shard s is in the full intersection for a sequence only if
+    every kmer of the sequence that is positive in some shard is positive in shard s:
+    shards that do not cover all positive kmers contribute nothing, the others contribute
+    their own intersection. For threshold-union, a color scores the same in its shard as in
+    the collection, so each shard is queried with the min_score of the whole collection.
+*/
+template <typename FulgorIndex>
+struct federated_index {
+    typedef typename FulgorIndex::color_sets_type color_sets_type;
+
+    void load(std::vector<std::string> const& index_filenames, const bool verbose) {
+        m_shards.resize(index_filenames.size());
+        m_color_offsets.assign(index_filenames.size() + 1, 0);
+        for (uint64_t s = 0; s != m_shards.size(); ++s) {
+            if (verbose) essentials::logger("loading shard '" + index_filenames[s] + "'...");
+            essentials::load(m_shards[s], index_filenames[s].c_str());
+            if (m_shards[s].k() != m_shards[0].k()) {
+                throw std::runtime_error("all shards must be built with the same k");
+            }
+            m_color_offsets[s + 1] = m_color_offsets[s] + m_shards[s].num_colors();
+        }
+        if (verbose) essentials::logger("DONE");
+    }
+
+    void pseudoalign_full_intersection(std::string const& sequence,
+                                       std::vector<uint32_t>& colors) const {
+        if (sequence.length() < k()) return;
+        colors.clear();
+        thread_local query_state q;
+        q.init(m_shards.size());
+
+        /* lookup phase */
+        for (uint64_t s = 0; s != m_shards.size(); ++s) {
+            q.num_positive_kmers[s] =
+                m_shards[s].lookup(sequence, q.unitig_ids[s], &q.positive_kmers[s]);
+        }
+
+        /* kmers that are positive in at least one shard */
+        uint64_t num_positive_kmers = 0;
+        for (uint64_t w = 0; w != q.positive_kmers[0].size(); ++w) {
+            uint64_t word = 0;
+            for (auto const& positive_kmers : q.positive_kmers) word |= positive_kmers[w];
+            num_positive_kmers += __builtin_popcountll(word);
+        }
+        if (num_positive_kmers == 0) return;
+
+        /* color phase, only for the shards covering all the positive kmers */
+        for (uint64_t s = 0; s != m_shards.size(); ++s) {
+            if (q.num_positive_kmers[s] != num_positive_kmers) continue;
+            q.colors.clear();
+            m_shards[s].intersect_unitigs(q.unitig_ids[s], q.colors);
+            for (uint32_t c : q.colors) colors.push_back(c + m_color_offsets[s]);
+        }
+    }
+
+    void pseudoalign_threshold_union(std::string const& sequence, std::vector<uint32_t>& colors,
+                                     const double threshold) const {
+        if (sequence.length() < k()) return;
+        colors.clear();
+        thread_local query_state q;
+        q.init(m_shards.size());
+
+        /* lookup phase */
+        for (uint64_t s = 0; s != m_shards.size(); ++s) {
+            q.num_positive_kmers[s] =
+                m_shards[s].lookup(sequence, q.unitig_ids[s], &q.positive_kmers[s]);
+        }
+
+        uint64_t num_positive_kmers = 0;
+        for (uint64_t w = 0; w != q.positive_kmers[0].size(); ++w) {
+            uint64_t word = 0;
+            for (auto const& positive_kmers : q.positive_kmers) word |= positive_kmers[w];
+            num_positive_kmers += __builtin_popcountll(word);
+        }
+        const uint64_t min_score = static_cast<double>(num_positive_kmers) * threshold;
+
+        /* color phase, with the min_score of the whole collection */
+        for (uint64_t s = 0; s != m_shards.size(); ++s) {
+            if (q.unitig_ids[s].empty()) continue;
+            q.colors.clear();
+            m_shards[s].threshold_union_unitigs(q.unitig_ids[s], q.colors, min_score);
+            for (uint32_t c : q.colors) colors.push_back(c + m_color_offsets[s]);
+        }
+    }
+
+    uint64_t k() const { return m_shards.front().k(); }
+    uint64_t num_shards() const { return m_shards.size(); }
+    uint64_t num_colors() const { return m_color_offsets.back(); }
+    FulgorIndex const& shard(uint64_t s) const { return m_shards[s]; }
+
+    /* visits the shards only: the index is not serialized as a whole */
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(m_shards);
+    }
+
+private:
+    std::vector<FulgorIndex> m_shards;
+    std::vector<uint64_t> m_color_offsets;
+
+    /* per-thread buffers, reused across queries */
+    struct query_state {
+        void init(uint64_t num_shards) {
+            unitig_ids.resize(num_shards);
+            positive_kmers.resize(num_shards);
+            num_positive_kmers.resize(num_shards);
+            for (auto& ids : unitig_ids) ids.clear();
+        }
+        std::vector<std::vector<scored_id>> unitig_ids;
+        std::vector<std::vector<uint64_t>> positive_kmers;
+        std::vector<uint64_t> num_positive_kmers;
+        std::vector<uint32_t> colors;
+    };
+};
+
+}  // namespace fulgor
@@ -0,0 +1,122 @@
+#ifndef FULGOR_H
+#define FULGOR_H
+
+/*
+    C interface of libfulgor, for querying a Fulgor index from other languages and
+    programs without going through the command line tools.
+
+    An index is opened once and then queried with batches of sequences. The results
+    of a batch are written into flat arrays provided by the caller, in CSR layout: the
+    results of the i-th sequence are out[offsets[i]] .. out[offsets[i+1]-1], so offsets
+    must have room for num_seqs + 1 values. The library does not allocate memory for
+    the results of each sequence: the buffers of the caller are filled in place, and
+    the scratch space of the queries is kept per thread and reused across calls.
+
+    If the results of a batch do not fit into the capacity of out, the function stops at
+    the first sequence whose results do not fit, sets *num_processed to the number of
+    sequences written so far (offsets[0..*num_processed] are valid) and returns
+    FULGOR_ERROR_BUFFER_TOO_SMALL: the caller can consume them and resume the batch from
+    sequence *num_processed. A sequence has at most fulgor_index_num_colors() colors and
+    at most length - k + 1 kmer conservation triples.
+
+    A fulgor_index is read-only after fulgor_index_open(): all query functions can be
+    called concurrently on the same index from any number of threads. All functions
+    return FULGOR_OK on success or an error code, whose message is returned by
+    fulgor_last_error() in the same thread.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FULGOR_ABI_VERSION 1
+
+/* the shared library exports these functions only */
+#if defined(__GNUC__)
+#define FULGOR_API __attribute__((visibility("default")))
+#else
+#define FULGOR_API
+#endif
+
+/* status codes */
+#define FULGOR_OK 0
+#define FULGOR_ERROR_INVALID_ARGUMENT 1
+#define FULGOR_ERROR_IO 2                /* the index file cannot be read */
+#define FULGOR_ERROR_UNSUPPORTED_INDEX 3 /* unknown index file extension */
+#define FULGOR_ERROR_BUFFER_TOO_SMALL 4
+#define FULGOR_ERROR_OUT_OF_MEMORY 5
+#define FULGOR_ERROR_INTERNAL 6
+
+/* flags of fulgor_index_open() */
+#define FULGOR_OPEN_DEFAULT 0u
+#define FULGOR_OPEN_HUGE_PAGES 1u /* back the index arrays with transparent huge pages */
+
+typedef struct fulgor_index fulgor_index;
+
+/* as in the output of the kmer-conservation tool */
+typedef struct fulgor_kmer_conservation_triple {
+    uint32_t start_pos_in_query;
+    uint32_t num_kmers;
+    uint32_t color_set_id;
+} fulgor_kmer_conservation_triple;
+
+/* the FULGOR_ABI_VERSION the library was compiled with */
+FULGOR_API uint32_t fulgor_abi_version(void);
+
+/* message of the last error of the calling thread ("" if none); valid until the next call */
+FULGOR_API const char* fulgor_last_error(void);
+
+/*
+    Load the index from filename: its type (.fur, .mfur, .dfur, .mdfur) is given by the
+    extension, as for the command line tools. On success, *index must be released with
+    fulgor_index_close().
+*/
+FULGOR_API int fulgor_index_open(const char* filename, uint32_t flags, fulgor_index** index);
+FULGOR_API void fulgor_index_close(fulgor_index* index);
+
+FULGOR_API uint64_t fulgor_index_k(const fulgor_index* index);
+FULGOR_API uint64_t fulgor_index_num_colors(const fulgor_index* index);
+FULGOR_API uint64_t fulgor_index_num_unitigs(const fulgor_index* index);
+FULGOR_API uint64_t fulgor_index_num_color_sets(const fulgor_index* index);
+
+/* name of the reference of the given color: not null-terminated, owned by the index */
+FULGOR_API int fulgor_index_filename(const fulgor_index* index, uint64_t color,
+                                     const char** name, uint64_t* length);
+
+/*
+    Pseudoalign the sequences seqs[0..num_seqs-1], of lengths lengths[0..num_seqs-1],
+    with full intersection: the colors of each sequence are written, in increasing order,
+    to colors (of the given capacity) as described above.
+*/
+FULGOR_API int fulgor_pseudoalign(const fulgor_index* index, const char* const* seqs,
+                                  const uint64_t* lengths, uint64_t num_seqs, uint32_t* colors,
+                                  uint64_t capacity, uint64_t* offsets, uint64_t* num_processed);
+
+/* as fulgor_pseudoalign(), but with threshold union: threshold must be in (0.0, 1.0] */
+FULGOR_API int fulgor_threshold_union(const fulgor_index* index, const char* const* seqs,
+                                      const uint64_t* lengths, uint64_t num_seqs,
+                                      double threshold, uint32_t* colors, uint64_t capacity,
+                                      uint64_t* offsets, uint64_t* num_processed);
+
+/* the kmer conservation triples of each sequence, as fulgor_pseudoalign() for colors */
+FULGOR_API int fulgor_kmer_conservation(const fulgor_index* index, const char* const* seqs,
+                                        const uint64_t* lengths, uint64_t num_seqs,
+                                        fulgor_kmer_conservation_triple* triples,
+                                        uint64_t capacity, uint64_t* offsets,
+                                        uint64_t* num_processed);
+
+/*
+    Decode the color set of the given id into colors (of the given capacity) and set
+    *size to its size. If capacity < *size, nothing is written and
+    FULGOR_ERROR_BUFFER_TOO_SMALL is returned.
+*/
+FULGOR_API int fulgor_color_set(const fulgor_index* index, uint64_t color_set_id,
+                                uint32_t* colors, uint64_t capacity, uint64_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FULGOR_H */
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <numeric>
+
+namespace fulgor {
+
+/*
+    Access frequencies of the color sets, recorded while pseudoaligning a sample.
+    The counters are shared by all query threads.
+*/
+struct color_set_profile {
+    color_set_profile() : m_num_color_sets(0) {}
+    color_set_profile(uint64_t num_color_sets) { init(num_color_sets); }
+
+    void init(uint64_t num_color_sets) {
+        m_num_color_sets = num_color_sets;
+        m_counts = std::make_unique<std::atomic<uint32_t>[]>(num_color_sets);
+        for (uint64_t i = 0; i != num_color_sets; ++i) {
+            m_counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint64_t color_set_id) {
+        assert(color_set_id < m_num_color_sets);
+        m_counts[color_set_id].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t num_color_sets() const { return m_num_color_sets; }
+
+    std::vector<uint32_t> counts() const {
+        std::vector<uint32_t> counts(m_num_color_sets);
+        for (uint64_t i = 0; i != m_num_color_sets; ++i) {
+            counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+    void save(std::string const& filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.is_open()) throw std::runtime_error("cannot open file '" + filename + "'");
+        auto c = counts();
+        out.write(reinterpret_cast<char const*>(&m_num_color_sets), sizeof(uint64_t));
+        out.write(reinterpret_cast<char const*>(c.data()), c.size() * sizeof(uint32_t));
+        out.close();
+    }
+
+    static std::vector<uint32_t> load(std::string const& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("cannot open file '" + filename + "'");
+        uint64_t num_color_sets = 0;
+        in.read(reinterpret_cast<char*>(&num_color_sets), sizeof(uint64_t));
+        std::vector<uint32_t> counts(num_color_sets);
+        in.read(reinterpret_cast<char*>(counts.data()), num_color_sets * sizeof(uint32_t));
+        if (!in) throw std::runtime_error("corrupted profile file '" + filename + "'");
+        in.close();
+        return counts;
+    }
+
+private:
+    uint64_t m_num_color_sets;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_counts;
+};
+
+/*
+    A sidecar structure holding the most frequently accessed color sets fully decoded,
+    within a given memory budget. A set is stored as a sorted array of uint32_t or
+    as a bitmap of num_colors bits, whichever takes less space.
+*/
+struct hot_color_sets {
+    struct set_view {
+        bool is_bitmap() const { return bitmap != nullptr; }
+        bool contains(uint32_t color) const {
+            assert(is_bitmap());
+            return bitmap[color >> 6] & (uint64_t(1) << (color & 63));
+        }
+        uint32_t const* array;
+        uint64_t const* bitmap;
+        uint32_t size;
+    };
+
+    hot_color_sets() : m_num_colors(0), m_num_color_sets(0), m_num_bytes(0) {}
+
+    template <typename ColorSets>
+    void build(ColorSets const& color_sets, std::vector<uint32_t> const& counts,
+               const uint64_t budget_in_bytes)  //
+    {
+        m_num_colors = color_sets.num_colors();
+        m_num_color_sets = color_sets.num_color_sets();
+        if (counts.size() != m_num_color_sets) {
+            throw std::runtime_error("profile has " + std::to_string(counts.size()) +
+                                     " color sets but the index has " +
+                                     std::to_string(m_num_color_sets));
+        }
+
+        const uint64_t num_words_per_bitmap = (m_num_colors + 63) / 64;
+        const uint64_t num_bytes_per_bitmap = num_words_per_bitmap * sizeof(uint64_t);
+
+        /* select the hottest sets that fit in the budget */
+        std::vector<uint32_t> ids(m_num_color_sets);
+        std::iota(ids.begin(), ids.end(), 0);
+        std::sort(ids.begin(), ids.end(), [&](uint32_t x, uint32_t y) {
+            return counts[x] > counts[y] or (counts[x] == counts[y] and x < y);
+        });
+        std::vector<uint32_t> selected;
+        m_num_bytes = 0;
+        for (uint32_t id : ids) {
+            if (counts[id] == 0) break;
+            uint64_t size = color_sets.color_set(id).size();
+            uint64_t num_bytes = std::min(size * sizeof(uint32_t), num_bytes_per_bitmap) +
+                                 sizeof(slot);
+            if (m_num_bytes + num_bytes > budget_in_bytes) continue;
+            m_num_bytes += num_bytes;
+            selected.push_back(id);
+        }
+        std::sort(selected.begin(), selected.end());
+
+        /* membership bitmap with sampled ranks: slots are assigned in color_set_id order */
+        m_hot.assign((m_num_color_sets + 63) / 64, 0);
+        for (uint32_t id : selected) m_hot[id >> 6] |= uint64_t(1) << (id & 63);
+        m_block_ranks.resize(m_hot.size() / words_per_block + 1);
+        for (uint64_t i = 0, rank = 0; i != m_hot.size(); ++i) {
+            if (i % words_per_block == 0) m_block_ranks[i / words_per_block] = rank;
+            rank += __builtin_popcountll(m_hot[i]);
+        }
+
+        /* decode the selected sets */
+        m_slots.clear();
+        m_slots.reserve(selected.size());
+        m_arrays.clear();
+        m_bitmaps.clear();
+        for (uint32_t id : selected) {
+            auto it = color_sets.color_set(id);
+            const uint32_t size = it.size();
+            slot s;
+            s.size = size;
+            if (size * sizeof(uint32_t) <= num_bytes_per_bitmap) {
+                s.is_bitmap = false;
+                s.offset = m_arrays.size();
+                for (uint32_t i = 0; i != size; ++i, ++it) m_arrays.push_back(*it);
+            } else {
+                s.is_bitmap = true;
+                s.offset = m_bitmaps.size();
+                m_bitmaps.resize(m_bitmaps.size() + num_words_per_bitmap, 0);
+                uint64_t* bitmap = m_bitmaps.data() + s.offset;
+                for (uint32_t i = 0; i != size; ++i, ++it) {
+                    uint32_t color = *it;
+                    bitmap[color >> 6] |= uint64_t(1) << (color & 63);
+                }
+            }
+            m_slots.push_back(s);
+        }
+    }
+
+    /* return true and fill view if the color set is hot */
+    bool find(uint64_t color_set_id, set_view& view) const {
+        assert(color_set_id < m_num_color_sets);
+        const uint64_t word_id = color_set_id >> 6;
+        const uint64_t word = m_hot[word_id];
+        const uint64_t mask = uint64_t(1) << (color_set_id & 63);
+        if (!(word & mask)) return false;
+        uint64_t rank = m_block_ranks[word_id / words_per_block];
+        for (uint64_t i = word_id - word_id % words_per_block; i != word_id; ++i) {
+            rank += __builtin_popcountll(m_hot[i]);
+        }
+        rank += __builtin_popcountll(word & (mask - 1));
+        assert(rank < m_slots.size());
+        slot const& s = m_slots[rank];
+        view.size = s.size;
+        view.array = s.is_bitmap ? nullptr : m_arrays.data() + s.offset;
+        view.bitmap = s.is_bitmap ? m_bitmaps.data() + s.offset : nullptr;
+        return true;
+    }
+
+    /* intersect the given (non-empty) list of hot sets */
+    void intersect(std::vector<set_view>& views, std::vector<uint32_t>& colors) const {
+        assert(!views.empty());
+        assert(colors.empty());
+        std::sort(views.begin(), views.end(), [](set_view const& x, set_view const& y) {
+            return x.is_bitmap() < y.is_bitmap() or
+                   (x.is_bitmap() == y.is_bitmap() and x.size < y.size);
+        });
+
+        if (views.front().is_bitmap()) {
+            /* all bitmaps: AND them word by word */
+            const uint64_t num_words = (m_num_colors + 63) / 64;
+            for (uint64_t w = 0; w != num_words; ++w) {
+                uint64_t word = views.front().bitmap[w];
+                for (uint64_t i = 1; i != views.size() and word; ++i) word &= views[i].bitmap[w];
+                while (word) {
+                    colors.push_back(w * 64 + __builtin_ctzll(word));
+                    word &= word - 1;
+                }
+            }
+            return;
+        }
+
+        /* candidates from the smallest array, then filter by the others */
+        colors.assign(views.front().array, views.front().array + views.front().size);
+        for (uint64_t i = 1; i != views.size() and !colors.empty(); ++i) {
+            auto const& v = views[i];
+            uint64_t size = 0;
+            if (v.is_bitmap()) {
+                for (uint32_t c : colors) {
+                    if (v.contains(c)) colors[size++] = c;
+                }
+            } else {
+                uint32_t const* begin = v.array;
+                uint32_t const* end = v.array + v.size;
+                for (uint32_t c : colors) {
+                    begin = std::lower_bound(begin, end, c);
+                    if (begin == end) break;
+                    if (*begin == c) colors[size++] = c;
+                }
+            }
+            colors.resize(size);
+        }
+    }
+
+    uint32_t num_colors() const { return m_num_colors; }
+    uint64_t num_hot_color_sets() const { return m_slots.size(); }
+    uint64_t num_bytes() const { return m_num_bytes; }
+
+private:
+    static constexpr uint64_t words_per_block = 8;
+
+    struct slot {
+        uint64_t offset;
+        uint32_t size;
+        bool is_bitmap;
+    };
+
+    uint32_t m_num_colors;
+    uint64_t m_num_color_sets;
+    uint64_t m_num_bytes;
+
+    std::vector<uint64_t> m_hot;
+    std::vector<uint64_t> m_block_ranks;
+    std::vector<slot> m_slots;
+    std::vector<uint32_t> m_arrays;
+    std::vector<uint64_t> m_bitmaps;
+};
+
+}  // namespace fulgor
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25  // Linux >= 6.1
+#endif
+
+namespace fulgor {
+
+/*
+    Back the large arrays of a loaded index with transparent huge pages (2 MiB).
+    The index is walked with its visitor: every std::vector of trivially copyable
+    values of at least 2 MiB has the 2 MiB-aligned part of its buffer advised with
+    MADV_HUGEPAGE and, where the kernel supports it, collapsed at once with
+    MADV_COLLAPSE (otherwise khugepaged collapses it in the background). The unaligned
+    head and tail of each buffer, at most 4 MiB per array, keep 4 KiB pages.
+
+    The arrays are owned by std::vector (also inside SSHash and bits), so they cannot
+    be moved to hugetlbfs without changing their allocators; with glibc >= 2.35,
+    GLIBC_TUNABLES=glibc.malloc.hugetlb=1 additionally aligns large allocations.
+*/
+struct huge_pages_report {
+    std::string thp_mode;  // as in /sys/kernel/mm/transparent_hugepage/enabled
+    uint64_t num_arrays = 0;
+    uint64_t num_bytes = 0;               // of the advised arrays
+    uint64_t advised_bytes = 0;           // 2 MiB-aligned part
+    uint64_t collapsed_bytes = 0;         // collapsed by MADV_COLLAPSE
+    uint64_t anon_huge_bytes_before = 0;  // AnonHugePages of the process
+    uint64_t anon_huge_bytes_after = 0;
+
+    double coverage() const {
+        return num_bytes ? double(anon_huge_bytes_after - anon_huge_bytes_before) / num_bytes
+                         : 0.0;
+    }
+
+    void print(std::ostream& out) const {
+        constexpr double MiB = 1024.0 * 1024.0;
+        out << "huge pages: THP mode '" << thp_mode << "', " << num_arrays << " arrays of "
+            << num_bytes / MiB << " [MiB], " << advised_bytes / MiB << " [MiB] advised, "
+            << collapsed_bytes / MiB << " [MiB] collapsed at once\n";
+        out << "  AnonHugePages: " << anon_huge_bytes_before / MiB << " [MiB] -> "
+            << anon_huge_bytes_after / MiB << " [MiB] (coverage of the index arrays "
+            << coverage() * 100.0 << "%)" << std::endl;
+    }
+
+    void print_json(std::ostream& out) const {
+        out << "{\"thp_mode\": \"" << thp_mode << "\", \"num_arrays\": " << num_arrays
+            << ", \"num_bytes\": " << num_bytes << ", \"advised_bytes\": " << advised_bytes
+            << ", \"collapsed_bytes\": " << collapsed_bytes
+            << ", \"anon_huge_bytes_before\": " << anon_huge_bytes_before
+            << ", \"anon_huge_bytes_after\": " << anon_huge_bytes_after
+            << ", \"coverage\": " << coverage() << "}";
+    }
+};
+
+namespace detail {
+
+struct nop_visitor {
+    template <typename T>
+    void visit(T&) {}
+};
+
+template <typename T, typename = void>
+struct has_visit : std::false_type {};
+
+template <typename T>
+struct has_visit<T, std::void_t<decltype(std::declval<T&>().visit(std::declval<nop_visitor&>()))>>
+    : std::true_type {};
+
+inline uint64_t anon_huge_bytes() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string key;
+    uint64_t value = 0;
+    while (in >> key) {
+        if (key == "AnonHugePages:") {
+            in >> value;
+            return value << 10;  // reported in kB
+        }
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+inline std::string thp_mode() {
+    std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string line;
+    std::getline(in, line);
+    auto begin = line.find('['), end = line.find(']');
+    if (begin == std::string::npos or end == std::string::npos) return "unavailable";
+    return line.substr(begin + 1, end - begin - 1);
+}
+
+struct huge_pages_advisor {
+    static constexpr uint64_t huge_page_size = uint64_t(1) << 21;
+
+    huge_pages_advisor(huge_pages_report& report) : m_report(report) {}
+
+    template <typename T>
+    void visit(T& val) {
+        if constexpr (has_visit<T>::value) val.visit(*this);
+    }
+
+    template <typename T, typename Allocator>
+    void visit(std::vector<T, Allocator>& vec) {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            advise(reinterpret_cast<uintptr_t>(vec.data()), vec.size() * sizeof(T));
+        } else {
+            for (auto& v : vec) visit(v);
+        }
+    }
+
+private:
+    huge_pages_report& m_report;
+
+    void advise(uintptr_t begin, uint64_t num_bytes) {
+        if (num_bytes < huge_page_size) return;
+        m_report.num_arrays += 1;
+        m_report.num_bytes += num_bytes;
+        const uintptr_t aligned_begin = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+        const uintptr_t aligned_end = (begin + num_bytes) & ~(huge_page_size - 1);
+        if (aligned_end <= aligned_begin) return;
+#if defined(__linux__)
+        void* addr = reinterpret_cast<void*>(aligned_begin);
+        const uint64_t length = aligned_end - aligned_begin;
+        if (madvise(addr, length, MADV_HUGEPAGE) != 0) return;
+        m_report.advised_bytes += length;
+        if (madvise(addr, length, MADV_COLLAPSE) == 0) m_report.collapsed_bytes += length;
+#endif
+    }
+};
+
+}  // namespace detail
+
+template <typename Index>
+huge_pages_report advise_huge_pages(Index& index) {
+    huge_pages_report report;
+    report.thp_mode = detail::thp_mode();
+    report.anon_huge_bytes_before = detail::anon_huge_bytes();
+    detail::huge_pages_advisor advisor(report);
+    index.visit(advisor);
+    report.anon_huge_bytes_after = detail::anon_huge_bytes();
+    return report;
+}
+
+}  // namespace fulgor
@@ -7,6 +7,9 @@
 
 #include "filenames.hpp"
 #include "util.hpp"
+#include "hot_color_sets.hpp"
+#include "profiler.hpp"
+#include "huge_pages.hpp"
 
 namespace fulgor {
 
@@ -21,11 +24,16 @@ struct index {
     struct meta_builder;
     struct differential_builder;
     struct meta_differential_builder;
+    struct reorder_builder;
+    struct update_builder;
+    struct merge_builder;
 
     index()
         : m_vnum(constants::current_version_number::x,  //
                  constants::current_version_number::y,  //
                  constants::current_version_number::z)  //
+        , m_hot_color_sets(nullptr)
+        , m_color_set_profile(nullptr)  //
     {}
 
     typename color_sets_type::iterator_type color_set(uint64_t color_set_id) const {
@@ -43,6 +51,52 @@ struct index {
                                      std::vector<uint32_t>& results,  //
                                      const double threshold) const;   //
 
+    /*
+        The two phases of pseudoalignment, exposed for querying several indexes at once.
+        lookup() appends to unitig_ids the unitigs hit by the positive kmers of sequence,
+        scored by the number of kmers hitting them, and returns the number of positive
+        kmers; if positive_kmers is given, it is set to the bitmap of their positions.
+        The color phase then works on these unitigs: intersect_unitigs() computes the
+        intersection of their color sets, threshold_union_unitigs() the colors whose
+        score is at least min_score.
+    */
+    uint64_t lookup(std::string const& sequence, std::vector<scored_id>& unitig_ids,
+                    std::vector<uint64_t>* positive_kmers = nullptr) const;
+
+    void intersect_unitigs(std::vector<scored_id>& unitig_ids,  //
+                           std::vector<uint32_t>& results) const;
+
+    void threshold_union_unitigs(std::vector<scored_id>& unitig_ids,  //
+                                 std::vector<uint32_t>& results,      //
+                                 const uint64_t min_score) const;
+
+    /*
+        The temporaries of the color phase. Callers that query many sequences keep one
+        per thread and pass it to the overloads below, which reuse its memory instead of
+        allocating it again for each sequence.
+    */
+    struct color_phase_buffers {
+        /* merge() of hybrid color sets subtracts the scores of complemented sets */
+        typedef std::conditional_t<ColorSets::type == index_t::HYBRID, int32_t, uint32_t>
+            score_type;
+
+        std::vector<uint32_t> color_set_ids;
+        std::vector<scored_id> scored_color_set_ids;
+        std::vector<typename ColorSets::iterator_type> iterators;
+        std::vector<scored<typename ColorSets::iterator_type>> scored_iterators;
+        std::vector<score_type> scores;
+        std::vector<uint32_t> partition_scores;
+    };
+
+    void intersect_unitigs(std::vector<scored_id>& unitig_ids,  //
+                           std::vector<uint32_t>& results,      //
+                           color_phase_buffers& buffers) const;
+
+    void threshold_union_unitigs(std::vector<scored_id>& unitig_ids,  //
+                                 std::vector<uint32_t>& results,      //
+                                 const uint64_t min_score,            //
+                                 color_phase_buffers& buffers) const;
+
     void kmer_conservation(std::string const& sequence,                                           //
                            std::vector<kmer_conservation_triple>& kmer_conservation_info) const;  //
 
@@ -65,6 +119,10 @@ struct index {
     ColorSets const& get_color_sets() const { return m_color_sets; }
     filenames const& get_filenames() const { return m_filenames; }
 
+    /* Query-time attachments: they are not serialized with the index. */
+    void set_hot_color_sets(hot_color_sets const* hcs) { m_hot_color_sets = hcs; }
+    void set_color_set_profile(color_set_profile* profile) { m_color_set_profile = profile; }
+
     template <typename Visitor>
     void visit(Visitor& visitor) {
         visit_impl(visitor, *this);
@@ -99,6 +157,9 @@ private:
     bits::rank9 m_u2c_rank1_index;
     ColorSets m_color_sets;
     filenames m_filenames;
+
+    hot_color_sets const* m_hot_color_sets;
+    color_set_profile* m_color_set_profile;
 };
 
 }  // namespace fulgor
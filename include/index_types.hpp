@@ -10,6 +10,10 @@ typedef index<hybrid> hybrid_colors_index_type;
 typedef hybrid_colors_index_type index_type;  // in use
 }  // namespace fulgor
 
+#include "builders/reorder_builder.hpp"
+#include "builders/update_builder.hpp"
+#include "builders/merge_builder.hpp"
+
 #include "builders/meta_builder.hpp"
 #include "color_sets/meta.hpp"
 
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fulgor {
+namespace numa {
+
+/*
+    NUMA placement of the index and of the query threads (Linux only).
+
+    - interleave: the pages of the index are spread round-robin over all nodes, so that
+      every worker sees the same average latency and no node's memory bandwidth becomes
+      the bottleneck;
+    - replicate: the index is loaded once per node, with the memory bound to that node,
+      and every worker queries the replica of the node it is pinned to. This costs one
+      copy of the index per node but makes all index accesses local.
+
+    In both modes the workers are pinned to cores, round-robin over the nodes. Each worker
+    takes whole read groups from the parser and queries them on its own node, so a read
+    group is always processed by a worker on the node holding the replica it uses.
+    Memory policies and affinities are set with raw system calls, so libnuma is not
+    needed; where they are not available (e.g. in some containers) a warning is printed
+    and the default placement is used.
+*/
+enum class mode : uint8_t { none, interleave, replicate };
+
+inline mode parse_mode(std::string const& s) {
+    if (s == "interleave") return mode::interleave;
+    if (s == "replicate") return mode::replicate;
+    throw std::runtime_error("unknown NUMA mode '" + s + "': use 'interleave' or 'replicate'");
+}
+
+namespace detail {
+
+/* parse a list such as "0-3,8-11" */
+inline std::vector<uint32_t> parse_list(std::string const& list) {
+    std::vector<uint32_t> values;
+    uint64_t begin = 0;
+    while (begin < list.size()) {
+        uint64_t end = list.find(',', begin);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(begin, end - begin);
+        uint64_t dash = range.find('-');
+        if (!range.empty()) {
+            uint32_t first = std::stoul(range.substr(0, dash));
+            uint32_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (uint32_t v = first; v <= last; ++v) values.push_back(v);
+        }
+        begin = end + 1;
+    }
+    return values;
+}
+
+inline std::string read_line(std::string const& filename) {
+    std::ifstream in(filename);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+}  // namespace detail
+
+struct topology {
+    /* the nodes with at least one core available to the process */
+    static topology detect() {
+        topology t;
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool has_affinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        auto nodes = detail::parse_list(detail::read_line("/sys/devices/system/node/online"));
+        for (uint32_t node : nodes) {
+            auto cpus = detail::parse_list(detail::read_line(
+                "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+            std::vector<uint32_t> available;
+            for (uint32_t cpu : cpus) {
+                if (!has_affinity or (cpu < CPU_SETSIZE and CPU_ISSET(cpu, &allowed))) {
+                    available.push_back(cpu);
+                }
+            }
+            if (available.empty()) continue;
+            t.m_nodes.push_back(node);
+            t.m_cpus.push_back(std::move(available));
+        }
+#endif
+        if (t.m_nodes.empty()) {  // no NUMA information: a single node
+            t.m_nodes.push_back(0);
+            t.m_cpus.emplace_back();
+            for (uint32_t cpu = 0; cpu != std::thread::hardware_concurrency(); ++cpu) {
+                t.m_cpus.back().push_back(cpu);
+            }
+        }
+        return t;
+    }
+
+    uint64_t num_nodes() const { return m_nodes.size(); }
+    uint32_t node_id(uint64_t i) const { return m_nodes[i]; }  // as numbered by the kernel
+    std::vector<uint32_t> const& cpus(uint64_t i) const { return m_cpus[i]; }
+
+    /* node (as an index in [0, num_nodes())) and core of the w-th worker */
+    std::pair<uint64_t, uint32_t> place(uint64_t w) const {
+        const uint64_t i = w % num_nodes();
+        auto const& c = m_cpus[i];
+        return {i, c[(w / num_nodes()) % c.size()]};
+    }
+
+    void print(std::ostream& out) const {
+        out << "NUMA topology: " << num_nodes() << " node(s)";
+        for (uint64_t i = 0; i != num_nodes(); ++i) {
+            out << (i == 0 ? " (" : ", ") << "node " << m_nodes[i] << ": " << m_cpus[i].size()
+                << " cores";
+        }
+        out << ")" << std::endl;
+    }
+
+private:
+    std::vector<uint32_t> m_nodes;
+    std::vector<std::vector<uint32_t>> m_cpus;
+};
+
+/* pin the calling thread to the given cores */
+inline bool pin(std::vector<uint32_t> const& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+/*
+    Set the memory policy of the calling thread: MPOL_BIND or MPOL_INTERLEAVE on the
+    given nodes (as numbered by the kernel), or MPOL_DEFAULT if nodes is empty.
+*/
+inline bool set_memory_policy(std::vector<uint32_t> const& nodes, const bool interleave) {
+#if defined(__linux__)
+    constexpr uint64_t bits_per_word = 8 * sizeof(unsigned long);
+    constexpr uint64_t max_nodes = 1024;
+    unsigned long mask[max_nodes / bits_per_word] = {0};
+    for (uint32_t node : nodes) {
+        if (node < max_nodes) mask[node / bits_per_word] |= 1UL << (node % bits_per_word);
+    }
+    const int policy = nodes.empty() ? MPOL_DEFAULT : interleave ? MPOL_INTERLEAVE : MPOL_BIND;
+    return syscall(__NR_set_mempolicy, policy, nodes.empty() ? nullptr : mask,
+                   nodes.empty() ? 0 : max_nodes + 1) == 0;
+#else
+    (void)nodes;
+    (void)interleave;
+    return false;
+#endif
+}
+
+/* interleave the memory allocated by the calling thread over all nodes */
+inline bool interleave(topology const& t) {
+    std::vector<uint32_t> nodes;
+    for (uint64_t i = 0; i != t.num_nodes(); ++i) nodes.push_back(t.node_id(i));
+    return set_memory_policy(nodes, true);
+}
+
+inline bool reset() { return set_memory_policy({}, false); }
+
+/*
+    Run f(i) for every node i, in parallel, each in a thread pinned to the cores of node i
+    and whose memory is bound to node i: all pages touched by f(i) are local to node i.
+*/
+inline void run_on_nodes(topology const& t, std::function<void(uint64_t)> f) {
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(t.num_nodes());
+    for (uint64_t i = 0; i != t.num_nodes(); ++i) {
+        threads.emplace_back([&, i]() {
+            if (!pin(t.cpus(i)) or !set_memory_policy({t.node_id(i)}, false)) {
+                std::cerr << "warning: could not bind to NUMA node " << t.node_id(i)
+                          << std::endl;
+            }
+            try {
+                f(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    for (auto const& e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+}
+
+}  // namespace numa
+}  // namespace fulgor
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <zlib.h>
+#if defined(FULGOR_USE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrency.hpp"
+
+namespace fulgor {
+
+/*
+    Output file of the query tools, compressed according to its extension: ".gz" for
+    gzip, ".zst" for zstd (only when compiled with -D FULGOR_USE_ZSTD=On); any other
+    file is written as is. The output is cut into blocks of block_size bytes, which a
+    pool of threads compresses in parallel into independent gzip members (or zstd
+    frames) and writes to the file in order: the concatenation of the members (frames)
+    is a valid gzip (zstd) file, which standard tools decompress as a whole.
+
+    As for std::ofstream, write() must not be called concurrently: the query workers
+    already serialize their writes. close() flushes the last block, waits for the
+    compression threads and rethrows their error, if any.
+*/
+struct output_file {
+    enum class compression : uint8_t { none, gzip, zstd };
+
+    static constexpr uint64_t block_size = uint64_t(1) << 22;
+    static constexpr int gzip_level = 6;  // as gzip and pigz
+    static constexpr int zstd_level = 3;  // as zstd
+
+    output_file() : m_compression(compression::none), m_next_ticket(0), m_is_open(false) {}
+
+    ~output_file() {
+        try {
+            close();
+        } catch (std::exception const& e) {
+            std::cerr << "error in writing the output: " << e.what() << std::endl;
+        }
+    }
+
+    static compression compression_of(std::string const& filename) {
+        auto ends_with = [&](std::string const& ext) {
+            return filename.size() >= ext.size() and
+                   filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+        };
+        if (ends_with(".gz")) return compression::gzip;
+        if (ends_with(".zst")) return compression::zstd;
+        return compression::none;
+    }
+
+    /* return false if the file cannot be opened (or is .zst without zstd support) */
+    bool open(std::string const& filename, const uint64_t num_threads) {
+        assert(!m_is_open);
+        m_filename = filename;
+        m_compression = compression_of(filename);
+#if !defined(FULGOR_USE_ZSTD)
+        if (m_compression == compression::zstd) {
+            std::cerr << "zstd output requires compiling with -D FULGOR_USE_ZSTD=On" << std::endl;
+            return false;
+        }
+#endif
+        m_file.open(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!m_file) return false;
+        m_is_open = true;
+        if (m_compression == compression::none) return true;
+
+        m_block.reserve(block_size);
+        m_blocks = std::make_unique<bounded_queue<block>>(2 * std::max<uint64_t>(num_threads, 1));
+        for (uint64_t i = 0; i != std::max<uint64_t>(num_threads, 1); ++i) {
+            m_threads.emplace_back([this]() { compress(); });
+        }
+        return true;
+    }
+
+    bool is_open() const { return m_is_open; }
+    compression type() const { return m_compression; }
+
+    void write(char const* data, uint64_t size) {
+        if (m_compression == compression::none) {
+            m_file.write(data, size);
+            return;
+        }
+        while (size != 0) {
+            const uint64_t n = std::min(size, block_size - m_block.size());
+            m_block.append(data, n);
+            data += n;
+            size -= n;
+            if (m_block.size() == block_size) flush_block();
+        }
+    }
+
+    void close() {
+        if (!m_is_open) return;
+        m_is_open = false;
+        if (m_compression != compression::none) {
+            if (!m_block.empty()) flush_block();
+            m_blocks->close();
+            for (auto& t : m_threads) t.join();
+            m_threads.clear();
+        }
+        m_file.close();
+        if (m_error) std::rethrow_exception(m_error);
+        if (m_file.fail()) throw std::runtime_error("cannot write the output file");
+    }
+
+    /*
+        Close the file and remove it, after an error that left it incomplete. Only regular
+        files are removed, not symbolic links (e.g. /dev/stdout) or devices: return false
+        if the file is kept.
+    */
+    bool discard() {
+        try {
+            close();
+        } catch (std::exception const&) {  // the output is removed anyway
+        }
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(std::filesystem::symlink_status(m_filename, ec))) {
+            return false;
+        }
+        return std::filesystem::remove(m_filename, ec);
+    }
+
+private:
+    struct block {
+        uint64_t ticket = 0;
+        std::string data;
+    };
+
+    std::string m_filename;
+    compression m_compression;
+    std::ofstream m_file;
+    std::string m_block;
+    uint64_t m_next_ticket;
+    bool m_is_open;
+    std::unique_ptr<bounded_queue<block>> m_blocks;
+    std::vector<std::thread> m_threads;
+    turnstile m_writer;
+    std::exception_ptr m_error;
+    std::mutex m_error_mutex;
+    std::atomic<bool> m_failed{false};
+
+    void flush_block() {
+        block b;
+        b.ticket = m_next_ticket++;
+        b.data.swap(m_block);
+        m_block.reserve(block_size);
+        m_blocks->push(std::move(b));
+    }
+
+    void compress() {
+        block b;
+        std::string out;
+        while (m_blocks->pop(b)) {
+            out.clear();
+            try {
+                if (!m_failed) {
+                    if (m_compression == compression::gzip) {
+                        compress_gzip(b.data, out);
+                    } else {
+                        compress_zstd(b.data, out);
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_error_mutex);
+                if (!m_error) m_error = std::current_exception();
+                m_failed = true;
+            }
+            /* every ticket must be served, or the writers of the next blocks would wait */
+            m_writer.run_in_order(b.ticket, [&]() {
+                if (!m_failed) m_file.write(out.data(), out.size());
+            });
+        }
+    }
+
+    static void compress_gzip(std::string const& in, std::string& out) {
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+        out.resize(deflateBound(&strm, in.size()));
+        strm.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(in.data()));
+        strm.avail_in = in.size();
+        strm.next_out = reinterpret_cast<unsigned char*>(&out[0]);
+        strm.avail_out = out.size();
+        const int ret = deflate(&strm, Z_FINISH);
+        out.resize(out.size() - strm.avail_out);
+        deflateEnd(&strm);
+        if (ret != Z_STREAM_END) throw std::runtime_error("gzip compression failed");
+    }
+
+    static void compress_zstd(std::string const& in, std::string& out) {
+#if defined(FULGOR_USE_ZSTD)
+        out.resize(ZSTD_compressBound(in.size()));
+        const size_t size = ZSTD_compress(&out[0], out.size(), in.data(), in.size(), zstd_level);
+        if (ZSTD_isError(size)) {
+            throw std::runtime_error(std::string("zstd compression failed: ") +
+                                     ZSTD_getErrorName(size));
+        }
+        out.resize(size);
+#else
+        (void)in;
+        (void)out;
+        throw std::runtime_error("zstd output requires compiling with -D FULGOR_USE_ZSTD=On");
+#endif
+    }
+};
+
+}  // namespace fulgor
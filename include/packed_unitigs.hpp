@@ -0,0 +1,219 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>  // for mkfifo
+#include <unistd.h>
+
+namespace fulgor {
+
+/*
+    An append-only sequence of unitigs, with bases packed in 2 bits.
+    Complete 64-bit words are kept in memory until they exceed ram_limit_in_bytes;
+    from then on they are spilled to a binary file in tmp_dirname.
+    The unitigs are replayed, in insertion order, as FASTA records by write_fasta().
+*/
+struct packed_unitigs {
+    packed_unitigs(std::string const& spill_filename, const uint64_t ram_limit_in_bytes)
+        : m_spill_filename(spill_filename)
+        , m_ram_limit_in_words(std::max<uint64_t>(ram_limit_in_bytes / sizeof(uint64_t), 1))
+        , m_num_bases(0)
+        , m_num_spilled_words(0)
+        , m_curr_word(0)
+        , m_curr_shift(0) {}
+
+    ~packed_unitigs() {
+        if (m_spill.is_open()) m_spill.close();
+        if (m_num_spilled_words > 0) std::remove(m_spill_filename.c_str());
+    }
+
+    void push_back(char const* unitig, const uint64_t size) {
+        assert(size > 0);
+        assert(size < (uint64_t(1) << 32));
+        for (uint64_t i = 0; i != size; ++i) {
+            uint64_t code = 0;
+            switch (unitig[i]) {
+                case 'A':
+                    code = 0;
+                    break;
+                case 'C':
+                    code = 1;
+                    break;
+                case 'G':
+                    code = 2;
+                    break;
+                case 'T':
+                    code = 3;
+                    break;
+                default:
+                    throw std::runtime_error("unexpected base '" + std::string(1, unitig[i]) +
+                                             "' in unitig");
+            }
+            m_curr_word |= code << m_curr_shift;
+            m_curr_shift += 2;
+            if (m_curr_shift == 64) {
+                m_words.push_back(m_curr_word);
+                m_curr_word = 0;
+                m_curr_shift = 0;
+                if (m_words.size() == m_ram_limit_in_words) spill();
+            }
+        }
+        m_lengths.push_back(size);
+        m_num_bases += size;
+    }
+
+    void write_fasta(std::ostream& out) {
+        if (m_spill.is_open()) {
+            m_spill.close();  // flushes the last words
+            if (!m_spill) throw std::runtime_error("error writing spilled unitigs");
+        }
+        std::ifstream spilled;
+        if (m_num_spilled_words > 0) {
+            spilled.open(m_spill_filename.c_str(), std::ios::binary);
+            if (!spilled.is_open()) throw std::runtime_error("cannot open spilled unitigs");
+        }
+
+        constexpr char bases[] = {'A', 'C', 'G', 'T'};
+        std::vector<uint64_t> spilled_words;
+        uint64_t word_id = 0;  // next word to be read
+        uint64_t pos_in_spilled_words = 0;
+        auto next_word = [&]() -> uint64_t {
+            uint64_t w = 0;
+            if (word_id < m_num_spilled_words) {
+                if (pos_in_spilled_words == spilled_words.size()) {
+                    spilled_words.resize(
+                        std::min<uint64_t>(1 << 20, m_num_spilled_words - word_id));
+                    spilled.read(reinterpret_cast<char*>(spilled_words.data()),
+                                 spilled_words.size() * sizeof(uint64_t));
+                    if (!spilled) throw std::runtime_error("error reading spilled unitigs");
+                    pos_in_spilled_words = 0;
+                }
+                w = spilled_words[pos_in_spilled_words++];
+            } else if (word_id - m_num_spilled_words < m_words.size()) {
+                w = m_words[word_id - m_num_spilled_words];
+            } else {
+                w = m_curr_word;  // last, partial word
+            }
+            ++word_id;
+            return w;
+        };
+
+        std::string line;
+        uint64_t word = 0;
+        uint64_t shift = 64;
+        for (uint32_t length : m_lengths) {
+            line.resize(length);
+            for (uint32_t i = 0; i != length; ++i) {
+                if (shift == 64) {
+                    word = next_word();
+                    shift = 0;
+                }
+                line[i] = bases[(word >> shift) & 3];
+                shift += 2;
+            }
+            out << ">\n";
+            out.write(line.data(), line.size());
+            out << '\n';
+        }
+    }
+
+    /*
+        Build dict on the unitigs. The dictionary only reads from a file, so the
+        unitigs are fed to it through a named pipe at input_filename, so that no
+        FASTA file is written; if a pipe cannot be created, a regular file is written.
+    */
+    template <typename Dictionary, typename Configuration>
+    void build_dictionary(Dictionary& dict, std::string const& input_filename,
+                          Configuration const& config)  //
+    {
+        std::remove(input_filename.c_str());  // stale file of a failed run
+        const bool streamed = mkfifo(input_filename.c_str(), 0600) == 0;
+        std::thread feeder;
+        std::exception_ptr feeder_error;
+        std::atomic<bool> feeder_done(false);
+        if (streamed) {
+            feeder = std::thread([&]() {
+                bool opened = false;
+                try {
+                    std::ofstream out(input_filename.c_str());
+                    if (!out.is_open()) throw std::runtime_error("cannot open unitig pipe");
+                    opened = true;
+                    write_fasta(out);
+                } catch (...) {
+                    feeder_error = std::current_exception();
+                    /* the reader sees the end of the file once a writer opened and closed it */
+                    if (!opened) std::ofstream(input_filename.c_str());
+                }
+                feeder_done = true;
+            });
+        } else {
+            std::ofstream out(input_filename.c_str());
+            if (!out.is_open()) throw std::runtime_error("cannot open output file");
+            write_fasta(out);
+        }
+
+        try {
+            dict.build(input_filename, config);
+        } catch (...) {
+            if (streamed) {  // unblock the feeder, then rethrow
+                /* non-blocking: the feeder may be done already, with no writer left */
+                const int fd = ::open(input_filename.c_str(), O_RDONLY | O_NONBLOCK);
+                char buf[4096];
+                while (fd != -1 and (::read(fd, buf, sizeof(buf)) > 0 or !feeder_done)) {
+                    std::this_thread::yield();
+                }
+                feeder.join();
+                if (fd != -1) ::close(fd);
+            }
+            std::remove(input_filename.c_str());
+            if (feeder_error) std::rethrow_exception(feeder_error);  // the cause, if any
+            throw;
+        }
+        if (streamed) feeder.join();
+        if (feeder_error) {  // dict was built on a truncated input
+            std::remove(input_filename.c_str());
+            std::rethrow_exception(feeder_error);
+        }
+        try {  // remove unitig file
+            std::remove(input_filename.c_str());
+        } catch (std::exception const& e) { std::cerr << e.what() << std::endl; }
+    }
+
+    uint64_t num_unitigs() const { return m_lengths.size(); }
+    uint64_t num_bases() const { return m_num_bases; }
+    uint64_t num_spilled_bytes() const { return m_num_spilled_words * sizeof(uint64_t); }
+    uint64_t num_bytes_in_memory() const {
+        return (m_words.size() + 1) * sizeof(uint64_t) + m_lengths.size() * sizeof(uint32_t);
+    }
+
+private:
+    std::string m_spill_filename;
+    uint64_t m_ram_limit_in_words;
+    uint64_t m_num_bases;
+    uint64_t m_num_spilled_words;
+    uint64_t m_curr_word, m_curr_shift;
+    std::vector<uint64_t> m_words;
+    std::vector<uint32_t> m_lengths;
+    std::ofstream m_spill;
+
+    void spill() {
+        if (!m_spill.is_open()) {
+            m_spill.open(m_spill_filename.c_str(), std::ios::binary);
+            if (!m_spill.is_open()) throw std::runtime_error("cannot open spill file");
+        }
+        m_spill.write(reinterpret_cast<char const*>(m_words.data()),
+                      m_words.size() * sizeof(uint64_t));
+        if (!m_spill) throw std::runtime_error("error writing spilled unitigs");
+        m_num_spilled_words += m_words.size();
+        m_words.clear();
+    }
+};
+
+}  // namespace fulgor
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "concurrency.hpp"
+
+namespace fulgor {
+
+/*
+    Decompression front end for the FASTX parser. The FASTX parser inflates each input
+    file with one thread, which caps the throughput of the whole query on many cores.
+    Here a gzipped query file is inflated by background threads into a pipe, and the
+    parser reads the plain text from filename() (a /dev/fd path to the pipe):
+
+    - BGZF (bgzip) files are split into batches of whole blocks, which are inflated in
+      parallel and written to the pipe in order (blocks are independent deflate streams,
+      whose compressed and decompressed sizes are in their headers and trailers);
+    - plain gzip files (also multi-member) are inflated by a single thread, which still
+      takes decompression off the parsing thread.
+
+    Files that are not gzipped are read directly by the parser.
+*/
+struct parallel_gunzip {
+    enum class format : uint8_t { plain, gzip, bgzf };
+
+    static constexpr uint64_t batch_size = uint64_t(1) << 20;  // compressed bytes per batch
+    static constexpr uint64_t max_bgzf_block_size = uint64_t(1) << 16;
+
+    parallel_gunzip(std::string const& filename, const uint64_t num_threads)
+        : m_filename(filename)
+        , m_format(format::plain)
+        , m_num_threads(num_threads)
+        , m_pipe{-1, -1}
+        , m_num_blocks(0)
+        , m_num_bytes(0)
+        , m_num_active_inflaters(num_threads)
+        , m_failed(false)
+        , m_batches(2 * std::max<uint64_t>(num_threads, 1)) {
+        if (num_threads == 0) return;
+        m_format = detect(filename);
+        if (m_format == format::plain) return;
+
+        if (pipe(m_pipe) != 0) throw std::runtime_error("cannot create pipe");
+        fcntl(m_pipe[1], F_SETPIPE_SZ, 1 << 20);  // best effort
+        if (m_format == format::bgzf) {
+            m_threads.emplace_back([this]() { read_bgzf(); });
+            for (uint64_t i = 0; i != m_num_threads; ++i) {
+                m_threads.emplace_back([this]() {
+                    block_sigpipe();
+                    inflate_bgzf();
+                });
+            }
+        } else {
+            m_threads.emplace_back([this]() {
+                block_sigpipe();
+                inflate_gzip();
+            });
+        }
+    }
+
+    ~parallel_gunzip() {
+        /* if the parser stopped early, make the threads fail instead of blocking */
+        m_failed = true;
+        if (m_pipe[0] != -1) close(m_pipe[0]);
+        for (auto& t : m_threads) t.join();
+        close_pipe();
+    }
+
+    /* the file to be read by the parser */
+    std::string filename() const {
+        if (m_format == format::plain) return m_filename;
+        return "/dev/fd/" + std::to_string(m_pipe[0]);
+    }
+
+    format input_format() const { return m_format; }
+    uint64_t num_threads() const { return m_format == format::bgzf ? m_num_threads : 1; }
+
+    /* wait for the decompression to finish and rethrow its error, if any */
+    void finish() {
+        for (auto& t : m_threads) t.join();
+        m_threads.clear();
+        if (m_error) std::rethrow_exception(m_error);
+    }
+
+    uint64_t num_blocks() const { return m_num_blocks; }  // BGZF only
+    uint64_t num_bytes() const { return m_num_bytes; }    // decompressed
+
+    static format detect(std::string const& filename) {
+        unsigned char header[18];
+        std::FILE* f = std::fopen(filename.c_str(), "rb");
+        if (!f) return format::plain;
+        const uint64_t n = std::fread(header, 1, sizeof(header), f);
+        std::fclose(f);
+        if (n < 10 or header[0] != 0x1f or header[1] != 0x8b or header[2] != 8) {
+            return format::plain;
+        }
+        return n == sizeof(header) and bgzf_block_size(header) ? format::bgzf : format::gzip;
+    }
+
+private:
+    /*
+        A write to the pipe after the parser closed it fails with EPIPE, reported as an
+        error, instead of raising SIGPIPE: the signal is blocked in the writing threads
+        only, so that the disposition of the process is left as it is.
+    */
+    static void block_sigpipe() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    }
+
+    std::string m_filename;
+    format m_format;
+    uint64_t m_num_threads;
+    int m_pipe[2];
+    std::atomic<uint64_t> m_num_blocks;
+    std::atomic<uint64_t> m_num_bytes;
+    std::atomic<uint64_t> m_num_active_inflaters;
+    std::atomic<bool> m_failed;
+    std::vector<std::thread> m_threads;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+
+    struct batch {
+        uint64_t ticket = 0;
+        std::string data;  // whole BGZF blocks
+    };
+    bounded_queue<batch> m_batches;
+    turnstile m_writer;
+
+    /*
+        Return the total size of the BGZF block starting with header, or 0 if it is not
+        a BGZF block: FEXTRA must be set, with a 'BC' subfield holding the size minus 1.
+    */
+    static uint64_t bgzf_block_size(unsigned char const* header) {
+        if (!(header[3] & 4)) return 0;
+        const uint64_t xlen = header[10] | (header[11] << 8);
+        if (xlen < 6 or header[12] != 'B' or header[13] != 'C' or header[14] != 2 or
+            header[15] != 0) {
+            return 0;
+        }
+        return (header[16] | (header[17] << 8)) + 1;
+    }
+
+    /* record the first error: the threads keep going, but without writing */
+    void fail(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) m_error = error;
+        m_failed = true;
+    }
+
+    /* the parser sees the end of the file once the write end is closed */
+    void close_pipe() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pipe[1] != -1) {
+            close(m_pipe[1]);
+            m_pipe[1] = -1;
+        }
+    }
+
+    void write(char const* data, uint64_t size) {
+        m_num_bytes += size;
+        while (size != 0) {
+            ssize_t n = ::write(m_pipe[1], data, size);
+            if (n <= 0) throw std::runtime_error("cannot write decompressed query data");
+            data += n;
+            size -= n;
+        }
+    }
+
+    void read_bgzf() {
+        std::FILE* f = std::fopen(m_filename.c_str(), "rb");
+        try {
+            if (!f) throw std::runtime_error("cannot open file '" + m_filename + "'");
+            batch b;
+            unsigned char header[18];
+            while (!m_failed) {
+                const uint64_t n = std::fread(header, 1, sizeof(header), f);
+                if (n == 0) break;
+                const uint64_t block_size = n == sizeof(header) ? bgzf_block_size(header) : 0;
+                if (block_size < sizeof(header) + 8) {
+                    throw std::runtime_error("'" + m_filename + "' is not a valid BGZF file");
+                }
+                const uint64_t offset = b.data.size();
+                b.data.resize(offset + block_size);
+                std::memcpy(&b.data[offset], header, sizeof(header));
+                const uint64_t rest = block_size - sizeof(header);
+                if (std::fread(&b.data[offset + sizeof(header)], 1, rest, f) != rest) {
+                    throw std::runtime_error("'" + m_filename + "' is truncated");
+                }
+                if (b.data.size() >= batch_size) {
+                    const uint64_t ticket = b.ticket;
+                    m_batches.push(std::move(b));
+                    b = batch();
+                    b.ticket = ticket + 1;
+                }
+            }
+            if (!b.data.empty()) m_batches.push(std::move(b));
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        if (f) std::fclose(f);
+        m_batches.close();
+    }
+
+    void inflate_bgzf() {
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+        const bool initialized = inflateInit2(&strm, -15) == Z_OK;
+        std::string out;
+        batch b;
+        while (m_batches.pop(b)) {
+            out.clear();
+            try {
+                if (!initialized) throw std::runtime_error("inflateInit2 failed");
+                if (!m_failed) inflate_batch(strm, b.data, out);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            /* every ticket must be served, or the writers of the next batches would wait */
+            m_writer.run_in_order(b.ticket, [&]() {
+                if (m_failed) return;
+                try {
+                    write(out.data(), out.size());
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+            });
+        }
+        if (initialized) inflateEnd(&strm);
+        if (--m_num_active_inflaters == 0) close_pipe();
+    }
+
+    void inflate_batch(z_stream& strm, std::string& data, std::string& out) {
+        for (uint64_t offset = 0; offset != data.size();) {
+            auto block = reinterpret_cast<unsigned char*>(&data[offset]);
+            const uint64_t block_size = bgzf_block_size(block);
+            const uint64_t xlen = block[10] | (block[11] << 8);
+            unsigned char const* trailer = block + block_size - 8;
+            const uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+                                 (uint32_t(trailer[3]) << 24);
+            const uint32_t isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) |
+                                   (uint32_t(trailer[7]) << 24);
+            if (12 + xlen + 8 > block_size or isize > max_bgzf_block_size) {
+                throw std::runtime_error("invalid BGZF block in '" + m_filename + "'");
+            }
+            const uint64_t out_offset = out.size();
+            out.resize(out_offset + isize);
+            auto decoded = reinterpret_cast<unsigned char*>(&out[out_offset]);
+            inflateReset(&strm);
+            strm.next_in = block + 12 + xlen;
+            strm.avail_in = block_size - 12 - xlen - 8;
+            strm.next_out = decoded;
+            strm.avail_out = isize;
+            const int ret = inflate(&strm, Z_FINISH);
+            if (ret != Z_STREAM_END or strm.avail_out != 0 or crc32(0, decoded, isize) != crc) {
+                throw std::runtime_error("corrupted BGZF block in '" + m_filename + "'");
+            }
+            offset += block_size;
+            m_num_blocks += 1;
+        }
+    }
+
+    void inflate_gzip() {
+        std::FILE* f = std::fopen(m_filename.c_str(), "rb");
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+        const bool initialized = inflateInit2(&strm, 15 + 16) == Z_OK;
+        try {
+            if (!f) throw std::runtime_error("cannot open file '" + m_filename + "'");
+            if (!initialized) throw std::runtime_error("inflateInit2 failed");
+            std::vector<unsigned char> in(batch_size), out(4 * batch_size);
+            bool in_member = false;  // a member was started and has not ended yet
+            while (!m_failed) {
+                if (strm.avail_in == 0) {
+                    strm.avail_in = std::fread(in.data(), 1, in.size(), f);
+                    strm.next_in = in.data();
+                    if (strm.avail_in == 0) {
+                        if (std::ferror(f)) {
+                            throw std::runtime_error("cannot read file '" + m_filename + "'");
+                        }
+                        if (in_member) {
+                            throw std::runtime_error("truncated gzip file '" + m_filename + "'");
+                        }
+                        break;
+                    }
+                }
+                strm.next_out = out.data();
+                strm.avail_out = out.size();
+                const int ret = inflate(&strm, Z_NO_FLUSH);
+                if (ret != Z_OK and ret != Z_STREAM_END and ret != Z_BUF_ERROR) {
+                    throw std::runtime_error("corrupted gzip file '" + m_filename + "'");
+                }
+                in_member = ret != Z_STREAM_END;
+                write(reinterpret_cast<char const*>(out.data()), out.size() - strm.avail_out);
+                if (ret == Z_STREAM_END) inflateReset(&strm);  // next member, if any
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        if (initialized) inflateEnd(&strm);
+        if (f) std::fclose(f);
+        close_pipe();
+    }
+};
+
+}  // namespace fulgor
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fulgor {
+
+/*
+    A group of hardware performance counters for the calling thread, read with one
+    read() on Linux via perf_event_open. Only user-space events are counted. The
+    cycle counter leads the group: if it cannot be opened (no PMU access, e.g.
+    because of /proc/sys/kernel/perf_event_paranoid or in some virtual machines)
+    nothing is counted; other events that cannot be opened read as zero.
+*/
+struct perf_counters {
+    static constexpr uint64_t num_events = 5;
+    enum event : uint8_t { cycles, instructions, llc_misses, dtlb_misses, branch_misses };
+
+    static constexpr char const* event_names[num_events] = {
+        "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"};
+
+    typedef std::array<uint64_t, num_events> values_type;
+
+    perf_counters() : m_num_open(0) { m_fds.fill(-1); }
+    perf_counters(perf_counters const&) = delete;
+    perf_counters& operator=(perf_counters const&) = delete;
+
+    ~perf_counters() {
+#if defined(__linux__)
+        for (int fd : m_fds) {
+            if (fd != -1) close(fd);
+        }
+#endif
+    }
+
+    /* open and start the counters; return the number of events being counted */
+    uint64_t open() {
+#if defined(__linux__)
+        constexpr uint64_t cache_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint64_t configs[num_events][2] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_miss},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache_miss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        int leader = -1;
+        for (uint64_t e = 0; e != num_events; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = configs[e][0];
+            attr.config = configs[e][1];
+            attr.disabled = leader == -1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd == -1) {
+                if (leader == -1) return 0;
+                continue;
+            }
+            if (leader == -1) leader = fd;
+            m_fds[e] = fd;
+            m_positions[e] = m_num_open++;
+        }
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+        return m_num_open;
+    }
+
+    bool is_open() const { return m_num_open != 0; }
+    bool available(uint64_t e) const { return m_fds[e] != -1; }
+
+    void read(values_type& values) const {
+        values.fill(0);
+#if defined(__linux__)
+        if (!is_open()) return;
+        uint64_t buffer[1 + num_events];  // number of events, then their values
+        if (::read(m_fds[0], buffer, sizeof(buffer)) <= 0) return;
+        for (uint64_t e = 0; e != num_events; ++e) {
+            if (available(e)) values[e] = buffer[1 + m_positions[e]];
+        }
+#endif
+    }
+
+private:
+    std::array<int, num_events> m_fds;
+    std::array<uint64_t, num_events> m_positions;  // in the group
+    uint64_t m_num_open;
+};
+
+}  // namespace fulgor
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <iomanip>
+
+#include "perf_counters.hpp"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+namespace fulgor {
+
+/*
+    Per-stage instrumentation of the query hot paths, compiled in only with
+    -DFULGOR_PROFILE (cmake option FULGOR_PROFILE). Otherwise every call below is
+    an empty inline function and profiler::enabled is false.
+
+    Each thread accumulates cycles per phase and event counters in its own record,
+    with no synchronization on the hot path; the records are summed when printed.
+    A phase_timer charges the cycles elapsed since its construction (or since the
+    last call to next()) to its current phase.
+
+    Hardware counters (perf_counters) are enabled at run time with
+    enable_perf_counters(), whether or not FULGOR_PROFILE is defined: a worker_scope
+    opens them for its thread and charges the events of the whole worker to it.
+    With FULGOR_PROFILE, phase timers also charge the events to their phase, at the
+    price of one read() system call per phase change.
+*/
+namespace profiler {
+
+enum class phase : uint8_t {
+    parsing,            // waiting for the FASTX parser
+    lookup,             // streaming kmer lookups (lookup_advanced)
+    u2c,                // unitig deduplication and u2c rank queries
+    iterators,          // color set iterator construction
+    intersection,       // full intersection of the color sets
+    threshold_union,    // threshold-union merge of the color sets
+    kmer_conservation,  // lookups and u2c queries for kmer-conservation
+    num_phases
+};
+
+enum class counter : uint8_t {
+    reads,
+    kmers,                // kmers looked up
+    positive_kmers,       // kmers found in the index
+    distinct_unitigs,     // per read
+    distinct_color_sets,  // per read
+    decoded_integers,     // integers in the accessed color sets (an upper bound on those decoded)
+    num_counters
+};
+
+static constexpr uint64_t num_phases = static_cast<uint64_t>(phase::num_phases);
+static constexpr uint64_t num_counters = static_cast<uint64_t>(counter::num_counters);
+
+constexpr char const* phase_names[num_phases] = {
+    "parsing",      "lookup",          "u2c", "iterators",
+    "intersection", "threshold_union", "kmer_conservation"};
+constexpr char const* counter_names[num_counters] = {
+    "reads", "kmers", "positive_kmers", "distinct_unitigs", "distinct_color_sets",
+    "decoded_integers"};
+
+inline uint64_t cycles() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+struct thread_record {
+    std::array<uint64_t, num_phases> cycles{};
+    std::array<uint64_t, num_phases> calls{};
+    std::array<uint64_t, num_counters> counters{};
+    std::array<perf_counters::values_type, num_phases> phase_events{};
+    perf_counters::values_type worker_events{};
+    std::unique_ptr<perf_counters> perf;  // only if perf counters are enabled and open
+};
+
+/* Owns the records of all threads, so that they outlive the threads. */
+struct registry {
+    static registry& instance() {
+        static registry r;
+        return r;
+    }
+
+    thread_record& local() {
+        thread_local thread_record* record = nullptr;
+        if (!record) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_records.push_back(std::make_unique<thread_record>());
+            record = m_records.back().get();
+        }
+        return *record;
+    }
+
+    /* sum of the records of all threads; to be called when the threads are done */
+    thread_record sum() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        thread_record total;
+        for (auto const& r : m_records) {
+            for (uint64_t i = 0; i != num_phases; ++i) {
+                total.cycles[i] += r->cycles[i];
+                total.calls[i] += r->calls[i];
+            }
+            for (uint64_t i = 0; i != num_counters; ++i) total.counters[i] += r->counters[i];
+            for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+                for (uint64_t i = 0; i != num_phases; ++i) {
+                    total.phase_events[i][e] += r->phase_events[i][e];
+                }
+                total.worker_events[e] += r->worker_events[e];
+            }
+        }
+        return total;
+    }
+
+    /* the worker events of each thread that counted them */
+    std::vector<perf_counters::values_type> worker_events() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<perf_counters::values_type> events;
+        for (auto const& r : m_records) {
+            if (r->perf) events.push_back(r->worker_events);
+        }
+        return events;
+    }
+
+    void enable_perf_counters() { m_perf_enabled = true; }
+    bool perf_enabled() const { return m_perf_enabled; }
+
+    /* events that could be opened in every thread */
+    std::array<bool, perf_counters::num_events> perf_available() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::array<bool, perf_counters::num_events> available;
+        available.fill(true);
+        for (auto const& r : m_records) {
+            if (!r->perf) continue;
+            for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+                available[e] = available[e] and r->perf->available(e);
+            }
+        }
+        return available;
+    }
+
+    uint64_t num_threads() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_records.size();
+    }
+
+    /* cycles per nanosecond, measured since the registry was created */
+    double cycles_per_ns() const {
+        const uint64_t c = cycles() - m_start_cycles;
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - m_start_time)
+                                .count();
+        return ns ? double(c) / ns : 1.0;
+    }
+
+private:
+    registry()
+        : m_start_cycles(cycles())
+        , m_start_time(std::chrono::steady_clock::now())
+        , m_perf_enabled(false) {}
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<thread_record>> m_records;
+    uint64_t m_start_cycles;
+    std::chrono::steady_clock::time_point m_start_time;
+    std::atomic<bool> m_perf_enabled;
+};
+
+inline void enable_perf_counters() { registry::instance().enable_perf_counters(); }
+inline bool perf_counters_enabled() { return registry::instance().perf_enabled(); }
+
+/*
+    Opens the perf counters of the calling thread, if enabled, and charges to the
+    thread the events counted during the lifetime of the scope.
+*/
+struct worker_scope {
+    worker_scope() : m_record(registry::instance().local()) {
+        if (!registry::instance().perf_enabled()) return;
+        if (!m_record.perf) {
+            auto perf = std::make_unique<perf_counters>();
+            if (perf->open() == 0) return;
+            m_record.perf = std::move(perf);
+        }
+        m_record.perf->read(m_begin);
+    }
+
+    ~worker_scope() {
+        if (!m_record.perf) return;
+        perf_counters::values_type end;
+        m_record.perf->read(end);
+        for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+            m_record.worker_events[e] += end[e] - m_begin[e];
+        }
+    }
+
+private:
+    thread_record& m_record;
+    perf_counters::values_type m_begin;
+};
+
+#ifdef FULGOR_PROFILE
+
+static constexpr bool enabled = true;
+
+inline void count(counter c, uint64_t n) {
+    registry::instance().local().counters[static_cast<uint64_t>(c)] += n;
+}
+
+struct phase_timer {
+    phase_timer(phase p) : m_record(registry::instance().local()), m_phase(p) {
+        if (m_record.perf) m_record.perf->read(m_begin_events);
+        m_begin = cycles();
+    }
+    ~phase_timer() { stop(); }
+
+    void next(phase p) {
+        stop();
+        m_phase = p;
+        m_begin = cycles();
+    }
+
+private:
+    thread_record& m_record;
+    phase m_phase;
+    uint64_t m_begin;
+    perf_counters::values_type m_begin_events;
+
+    void stop() {
+        const uint64_t i = static_cast<uint64_t>(m_phase);
+        m_record.cycles[i] += cycles() - m_begin;
+        m_record.calls[i] += 1;
+        if (m_record.perf) {
+            perf_counters::values_type end;
+            m_record.perf->read(end);
+            for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+                m_record.phase_events[i][e] += end[e] - m_begin_events[e];
+            }
+            m_begin_events = end;
+        }
+    }
+};
+
+#else
+
+static constexpr bool enabled = false;
+
+inline void count(counter, uint64_t) {}
+
+struct phase_timer {
+    phase_timer(phase) {}
+    void next(phase) {}
+};
+
+#endif
+
+inline void print_json(std::ostream& out) {
+    auto& r = registry::instance();
+    const auto total = r.sum();
+    const double cycles_per_ns = r.cycles_per_ns();
+    out << "{\n  \"num_threads\": " << r.num_threads() << ",\n  \"cycles_per_ns\": "
+        << cycles_per_ns << ",\n  \"phases\": {";
+    for (uint64_t i = 0; i != num_phases; ++i) {
+        out << (i ? ",\n    " : "\n    ") << "\"" << phase_names[i] << "\": {\"cycles\": "
+            << total.cycles[i] << ", \"calls\": " << total.calls[i]
+            << ", \"seconds\": " << total.cycles[i] / cycles_per_ns / 1e9 << "}";
+    }
+    out << "\n  },\n  \"counters\": {";
+    for (uint64_t i = 0; i != num_counters; ++i) {
+        out << (i ? ", " : "") << "\"" << counter_names[i] << "\": " << total.counters[i];
+    }
+    out << "}\n}" << std::endl;
+}
+
+inline void print_tsv(std::ostream& out) {
+    auto& r = registry::instance();
+    const auto total = r.sum();
+    const double cycles_per_ns = r.cycles_per_ns();
+    out << "kind\tname\tcycles\tcalls\tseconds\n";
+    for (uint64_t i = 0; i != num_phases; ++i) {
+        out << "phase\t" << phase_names[i] << '\t' << total.cycles[i] << '\t' << total.calls[i]
+            << '\t' << total.cycles[i] / cycles_per_ns / 1e9 << '\n';
+    }
+    for (uint64_t i = 0; i != num_counters; ++i) {
+        out << "counter\t" << counter_names[i] << '\t' << total.counters[i] << "\t\t\n";
+    }
+    out << std::flush;
+}
+
+/*
+    Print a table of the hardware events: one row per worker thread and the total,
+    then (with FULGOR_PROFILE) one row per phase. Rates are per read and, for
+    instructions, per cycle (IPC).
+*/
+inline void print_perf_counters(std::ostream& out, const uint64_t num_reads) {
+    auto& r = registry::instance();
+    const auto workers = r.worker_events();
+    if (workers.empty()) {
+        out << "perf counters: not available (check /proc/sys/kernel/perf_event_paranoid)"
+            << std::endl;
+        return;
+    }
+    const auto available = r.perf_available();
+    const auto total = r.sum();
+
+    auto print_row = [&](std::string const& name, perf_counters::values_type const& v) {
+        out << std::left << std::setw(20) << name << std::right;
+        for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+            if (available[e]) {
+                out << std::setw(16) << v[e];
+            } else {
+                out << std::setw(16) << "n/a";
+            }
+        }
+        const double cycles = v[perf_counters::cycles];
+        if (available[perf_counters::instructions] and cycles) {
+            out << std::setw(8) << std::setprecision(3) << std::fixed
+                << v[perf_counters::instructions] / cycles << std::defaultfloat << '\n';
+        } else {
+            out << std::setw(8) << "n/a" << '\n';
+        }
+    };
+
+    out << "perf counters (user space):\n" << std::left << std::setw(20) << "" << std::right;
+    for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+        out << std::setw(16) << perf_counters::event_names[e];
+    }
+    out << std::setw(8) << "IPC" << '\n';
+    for (uint64_t t = 0; t != workers.size(); ++t) {
+        print_row("thread " + std::to_string(t), workers[t]);
+    }
+    print_row("total", total.worker_events);
+    if (num_reads) {
+        out << std::left << std::setw(20) << "per read" << std::right;
+        for (uint64_t e = 0; e != perf_counters::num_events; ++e) {
+            if (available[e]) {
+                out << std::setw(16) << std::setprecision(2) << std::fixed
+                    << double(total.worker_events[e]) / num_reads << std::defaultfloat;
+            } else {
+                out << std::setw(16) << "n/a";
+            }
+        }
+        out << '\n';
+    }
+    if (enabled) {
+        for (uint64_t i = 0; i != num_phases; ++i) {
+            if (total.calls[i] == 0) continue;
+            print_row(std::string("phase ") + phase_names[i], total.phase_events[i]);
+        }
+    }
+    out << std::flush;
+}
+
+/* refill a read group of the FASTX parser, charging the wait to the parsing phase */
+template <typename Parser, typename ReadGroup>
+bool refill(Parser& rparser, ReadGroup& rg) {
+    phase_timer timer(phase::parsing);
+    return rparser.refill(rg);
+}
+
+/*
+    Write the profile to output_filename + ".stages.json" and ".stages.tsv",
+    or as TSV to stderr if the output is not a regular file (e.g., /dev/stdout).
+*/
+inline void write(std::string const& output_filename) {
+    if (!enabled) return;
+    if (output_filename.rfind("/dev/", 0) == 0) {
+        print_tsv(std::cerr);
+        return;
+    }
+    std::ofstream json(output_filename + ".stages.json");
+    print_json(json);
+    std::ofstream tsv(output_filename + ".stages.tsv");
+    print_tsv(tsv);
+}
+
+}  // namespace profiler
+}  // namespace fulgor
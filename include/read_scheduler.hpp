@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "concurrency.hpp"
+#include "profiler.hpp"
+
+namespace fulgor {
+
+/*
+    Work-stealing scheduler of the reads of a FASTX parser. A worker that runs out of
+    work first tries to steal, then takes a read group from the parser and splits it
+    into tasks of about task_size_in_bases bases, which it pushes to its own deque:
+    a read group with long or costly reads is thus shared among the idle workers
+    instead of being processed by a single one, in particular at the end of the input.
+    The reads are moved out of the read group, so that the group can be given back to
+    the parser while its tasks are still pending.
+
+    For each worker, the scheduler records the time spent processing reads (busy) and
+    waiting for the parser or for work to steal (idle).
+*/
+template <typename Record>
+struct read_scheduler {
+    static constexpr uint64_t default_task_size_in_bases = uint64_t(1) << 14;
+
+    read_scheduler(const uint64_t num_workers,
+                   const uint64_t task_size_in_bases = default_task_size_in_bases)
+        : m_task_size_in_bases(task_size_in_bases)
+        , m_deques(num_workers)
+        , m_stats(num_workers)
+        , m_parser_done(false)
+        , m_num_splitting(0)
+        , m_start(clock_type::now()) {}
+
+    /* run f(record) on reads until the parser is exhausted and no task is left */
+    template <typename Parser, typename Func>
+    void run(Parser& rparser, const uint64_t worker_id, Func f) {
+        auto& stats = m_stats[worker_id];
+        auto rg = rparser.getReadGroup();
+        task t;
+        auto idle_begin = clock_type::now();
+        while (true) {
+            bool stolen = false;
+            if (!m_deques.pop(worker_id, t)) {
+                /* read before stealing: tasks are pushed before m_num_splitting drops */
+                const bool parser_done = m_parser_done;
+                const bool splitting = m_num_splitting != 0;
+                if (m_deques.steal(worker_id, t)) {
+                    stolen = true;
+                } else if (!parser_done) {
+                    m_num_splitting += 1;
+                    if (profiler::refill(rparser, rg)) {
+                        split(rg, worker_id);
+                    } else {
+                        m_parser_done = true;
+                    }
+                    m_num_splitting -= 1;
+                    continue;
+                } else if (splitting) {  // the last read groups are being split
+                    std::this_thread::yield();
+                    continue;
+                } else {
+                    break;
+                }
+            }
+            auto busy_begin = clock_type::now();
+            stats.idle_time += busy_begin - idle_begin;
+            for (auto const& record : t.reads) f(record);
+            idle_begin = clock_type::now();
+            stats.busy_time += idle_begin - busy_begin;
+            stats.num_tasks += 1;
+            stats.num_stolen_tasks += stolen;
+            stats.num_reads += t.reads.size();
+        }
+        stats.idle_time += clock_type::now() - idle_begin;
+        stats.end_time = clock_type::now() - m_start;
+    }
+
+    void print(std::ostream& out) const {
+        auto seconds = [](duration_type d) { return std::chrono::duration<double>(d).count(); };
+        duration_type first_end = duration_type::max(), last_end = duration_type::zero();
+        out << "worker\tbusy_s\tidle_s\ttasks\tstolen_tasks\treads\tend_s\n";
+        for (uint64_t w = 0; w != m_stats.size(); ++w) {
+            auto const& s = m_stats[w];
+            out << w << '\t' << std::fixed << std::setprecision(3) << seconds(s.busy_time)
+                << '\t' << seconds(s.idle_time) << '\t' << s.num_tasks << '\t'
+                << s.num_stolen_tasks << '\t' << s.num_reads << '\t' << seconds(s.end_time)
+                << '\n';
+            first_end = std::min(first_end, s.end_time);
+            last_end = std::max(last_end, s.end_time);
+        }
+        out << "tail (first to last worker done): " << seconds(last_end - first_end) << " s"
+            << std::defaultfloat << std::endl;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_type;
+    typedef clock_type::duration duration_type;
+
+    struct task {
+        std::vector<Record> reads;
+    };
+
+    struct alignas(64) worker_stats {
+        duration_type busy_time = duration_type::zero();
+        duration_type idle_time = duration_type::zero();
+        duration_type end_time = duration_type::zero();
+        uint64_t num_tasks = 0;
+        uint64_t num_stolen_tasks = 0;
+        uint64_t num_reads = 0;
+    };
+
+    uint64_t m_task_size_in_bases;
+    work_stealing_deques<task> m_deques;
+    std::vector<worker_stats> m_stats;
+    std::atomic<bool> m_parser_done;
+    std::atomic<uint64_t> m_num_splitting;
+    clock_type::time_point m_start;
+
+    template <typename ReadGroup>
+    void split(ReadGroup& rg, const uint64_t worker_id) {
+        task t;
+        uint64_t num_bases = 0;
+        for (auto& record : rg) {
+            num_bases += record.seq.length();
+            t.reads.push_back(std::move(record));
+            if (num_bases >= m_task_size_in_bases) {
+                m_deques.push(worker_id, std::move(t));
+                t = task();
+                num_bases = 0;
+            }
+        }
+        if (!t.reads.empty()) m_deques.push(worker_id, std::move(t));
+    }
+};
+
+}  // namespace fulgor
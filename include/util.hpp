@@ -7,6 +7,7 @@
 #include <sstream>
 #include <chrono>
 #include <algorithm>  // for std::set_intersection
+#include <sys/resource.h>
 
 #include "external/smhasher/src/City.h"
 #include "external/smhasher/src/City.cpp"
@@ -20,6 +21,9 @@ namespace constants {
 
 constexpr double invalid_threshold = -1.0;
 constexpr uint64_t default_ram_limit_in_GiB = 8;
+constexpr uint64_t default_hot_sets_budget_in_MiB = 256;
+constexpr uint64_t default_max_representative_splits = 0;  // no refinement
+constexpr uint64_t color_set_prefetch_batch_size = 32;  // color sets resolved per batch
 static const std::string default_tmp_dirname(".");
 static const std::string fulgor_filename_extension("fur");
 static const std::string meta_colored_fulgor_filename_extension("mfur");
@@ -41,6 +45,8 @@ struct build_configuration {
         , num_threads(1)
         , ram_limit_in_GiB(constants::default_ram_limit_in_GiB)
         , num_colors(0)
+        , clustering_mini_batch_size(0)
+        , max_representative_splits(constants::default_max_representative_splits)
         , tmp_dirname(constants::default_tmp_dirname)
         //
         , verbose(false)
@@ -55,12 +61,15 @@ struct build_configuration {
     uint32_t num_threads;  // for building and checking correctness
     uint32_t ram_limit_in_GiB;
     uint64_t num_colors;
+    uint64_t clustering_mini_batch_size;  // 0 for full-batch k-means
+    uint64_t max_representative_splits;   // per differential group, 0 for none
 
     std::string tmp_dirname;
     std::string file_base_name;
     std::string filenames_list;
 
     std::string index_filename_to_partition;
+    std::string color_set_profile_filename;  // optional, to seed reordering
 
     bool verbose;
     bool check;
@@ -69,6 +78,14 @@ struct build_configuration {
     bool diff_colored;
 };
 
+template <typename T>
+struct scored {
+    T item;
+    uint32_t score;
+};
+
+typedef scored<uint64_t> scored_id;
+
 struct kmer_conservation_triple {
     uint32_t start_pos_in_query;
     uint32_t num_kmers;
@@ -82,14 +99,47 @@ void print_cmd(int argc, char** argv) {
     std::cout << std::endl;
 }
 
+/* peak resident set size of the process so far */
+uint64_t peak_rss_in_bytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return uint64_t(usage.ru_maxrss) * 1024;  // ru_maxrss is in KiB on Linux
+}
+
+void print_peak_rss() {
+    std::cout << "peak RSS so far: " << peak_rss_in_bytes() / (1024.0 * 1024.0 * 1024.0)
+              << " [GiB]" << std::endl;
+}
+
 std::string filename(std::string const& path) { return path.substr(path.find_last_of("/\\") + 1); }
 
+std::string extension(std::string const& path) {
+    auto pos = path.find_last_of('.');
+    return pos == std::string::npos ? std::string() : path.substr(pos + 1);
+}
+
+std::vector<std::string> split(std::string const& s, const char delim) {
+    std::vector<std::string> tokens;
+    std::stringstream ss(s);
+    std::string token;
+    while (std::getline(ss, token, delim)) {
+        if (!token.empty()) tokens.push_back(token);
+    }
+    return tokens;
+}
+
 void check_version_number(essentials::version_number const& vnum) {
     if (vnum.x != constants::current_version_number::x) {
         throw std::runtime_error("MAJOR index version mismatch: Fulgor index needs rebuilding");
     }
 }
 
+/* Hint the cache to load the word of the bit vector that holds the bit at position pos. */
+template <typename BitVector>
+inline void prefetch_bit(BitVector const& bv, const uint64_t pos) {
+    __builtin_prefetch(bv.data().data() + (pos >> 6));
+}
+
 /*
     Return the largest power of 2 that is <= n.
     Note: could use bitwise tricks for more efficiency.
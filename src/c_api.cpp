@@ -0,0 +1,311 @@
+/*
+    libfulgor: the C interface declared in include/fulgor.h.
+
+    This translation unit is compiled on its own into the fulgor_lib library targets
+    (see CMakeLists.txt): it pulls in the query code only, so the library does not
+    depend on GGCAT, which is needed just for building indexes.
+*/
+
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "external/sshash/src/dictionary.cpp"
+#include "external/sshash/src/info.cpp"
+
+#include "include/index.hpp"
+#include "include/color_sets/hybrid.hpp"
+#include "include/color_sets/differential.hpp"
+#include "include/color_sets/meta.hpp"
+#include "include/color_sets/meta_differential.hpp"
+#include "src/lookup.cpp"
+#include "src/ps_full_intersection.cpp"
+#include "src/ps_threshold_union.cpp"
+#include "src/kmer_conservation.cpp"
+
+#include "include/fulgor.h"
+
+/*
+    The opaque handle of the C interface: a type-erased index of any of the four
+    color set layouts. The queries take per-thread scratch space, so that the index
+    itself stays read-only and can be shared by all threads of the caller.
+*/
+struct fulgor_index {
+    struct scratch {
+        std::string sequence;
+        std::vector<fulgor::scored_id> unitig_ids;
+        std::vector<uint32_t> colors;
+        std::vector<fulgor::kmer_conservation_triple> triples;
+    };
+
+    virtual ~fulgor_index() {}
+
+    virtual uint64_t k() const = 0;
+    virtual uint64_t num_colors() const = 0;
+    virtual uint64_t num_unitigs() const = 0;
+    virtual uint64_t num_color_sets() const = 0;
+    virtual std::string_view filename(uint64_t color) const = 0;
+
+    /* threshold == constants::invalid_threshold for full intersection */
+    virtual void pseudoalign(scratch& s, const double threshold) const = 0;
+    virtual void kmer_conservation(scratch& s) const = 0;
+    virtual void color_set(uint64_t color_set_id, std::vector<uint32_t>& colors) const = 0;
+};
+
+namespace fulgor {
+namespace c_api {
+
+template <typename FulgorIndex>
+struct index_handle : fulgor_index {
+    FulgorIndex index;
+
+    uint64_t k() const override { return index.k(); }
+    uint64_t num_colors() const override { return index.num_colors(); }
+    uint64_t num_unitigs() const override { return index.num_unitigs(); }
+    uint64_t num_color_sets() const override { return index.num_color_sets(); }
+    std::string_view filename(uint64_t color) const override { return index.filename(color); }
+
+    /* as index::pseudoalign_full_intersection() and pseudoalign_threshold_union() */
+    void pseudoalign(scratch& s, const double threshold) const override {
+        s.colors.clear();
+        if (s.sequence.length() < index.k()) return;
+        s.unitig_ids.clear();
+        const uint64_t num_positive_kmers = index.lookup(s.sequence, s.unitig_ids);
+        auto& buffers = local_buffers();
+        if (threshold == constants::invalid_threshold) {
+            index.intersect_unitigs(s.unitig_ids, s.colors, buffers);
+        } else {
+            const uint64_t min_score = static_cast<double>(num_positive_kmers) * threshold;
+            index.threshold_union_unitigs(s.unitig_ids, s.colors, min_score, buffers);
+        }
+    }
+
+    void kmer_conservation(scratch& s) const override {
+        s.triples.clear();
+        index.kmer_conservation(s.sequence, s.triples);
+    }
+
+    void color_set(uint64_t color_set_id, std::vector<uint32_t>& colors) const override {
+        colors.clear();
+        auto it = index.color_set(color_set_id);
+        const uint64_t size = it.size();
+        for (uint64_t i = 0; i != size; ++i, it.next()) colors.push_back(it.value());
+    }
+
+    /* the color phase buffers depend on the color set layout, so they are kept apart */
+    static typename FulgorIndex::color_phase_buffers& local_buffers() {
+        thread_local typename FulgorIndex::color_phase_buffers buffers;
+        return buffers;
+    }
+};
+
+struct error : std::runtime_error {
+    error(int status, std::string const& message)
+        : std::runtime_error(message), status(status) {}
+    int status;
+};
+
+inline std::string& last_error() {
+    thread_local std::string message;
+    return message;
+}
+
+inline fulgor_index::scratch& local_scratch() {
+    thread_local fulgor_index::scratch s;
+    return s;
+}
+
+/* run f, turning the exceptions it throws into status codes */
+template <typename Func>
+int guard(Func f) {
+    try {
+        f();
+        last_error().clear();
+        return FULGOR_OK;
+    } catch (error const& e) {
+        last_error() = e.what();
+        return e.status;
+    } catch (std::bad_alloc const&) {
+        last_error() = "out of memory";
+        return FULGOR_ERROR_OUT_OF_MEMORY;
+    } catch (std::exception const& e) {
+        last_error() = e.what();
+        return FULGOR_ERROR_INTERNAL;
+    } catch (...) {
+        last_error() = "unknown error";
+        return FULGOR_ERROR_INTERNAL;
+    }
+}
+
+inline uint32_t to_c(uint32_t color) { return color; }
+
+inline fulgor_kmer_conservation_triple to_c(kmer_conservation_triple const& t) {
+    return {t.start_pos_in_query, t.num_kmers, t.color_set_id};
+}
+
+inline void check(bool condition, char const* message) {
+    if (!condition) throw error(FULGOR_ERROR_INVALID_ARGUMENT, message);
+}
+
+template <typename FulgorIndex>
+fulgor_index* load(std::string const& filename, const uint32_t flags) {
+    auto handle = std::make_unique<index_handle<FulgorIndex>>();
+    essentials::load(handle->index, filename.c_str());
+    if (flags & FULGOR_OPEN_HUGE_PAGES) advise_huge_pages(handle->index);
+    return handle.release();
+}
+
+inline fulgor_index* open_index(std::string const& filename, const uint32_t flags) {
+    if (!std::ifstream(filename).good()) {
+        throw error(FULGOR_ERROR_IO, "cannot open index file '" + filename + "'");
+    }
+    if (sshash::util::ends_with(filename,
+                                constants::meta_diff_colored_fulgor_filename_extension)) {
+        return load<index<meta_differential>>(filename, flags);
+    } else if (sshash::util::ends_with(filename,
+                                       constants::meta_colored_fulgor_filename_extension)) {
+        return load<index<meta<hybrid>>>(filename, flags);
+    } else if (sshash::util::ends_with(filename,
+                                       constants::diff_colored_fulgor_filename_extension)) {
+        return load<index<differential>>(filename, flags);
+    } else if (sshash::util::ends_with(filename, constants::fulgor_filename_extension)) {
+        return load<index<hybrid>>(filename, flags);
+    }
+    throw error(FULGOR_ERROR_UNSUPPORTED_INDEX, "wrong index filename '" + filename + "'");
+}
+
+/*
+    Run query(s) on each sequence of the batch, which fills results with its output,
+    and append the results to out in CSR layout, as described in fulgor.h.
+*/
+template <typename Input, typename Output, typename Query>
+int run_batch(fulgor_index const* index, const char* const* seqs, const uint64_t* lengths,
+              const uint64_t num_seqs, Output* out, const uint64_t capacity, uint64_t* offsets,
+              uint64_t* num_processed, std::vector<Input> fulgor_index::scratch::*results,
+              Query query) {
+    uint64_t i = 0;
+    int status = guard([&]() {
+        check(index and offsets, "null index or offsets");
+        check(num_seqs == 0 or (seqs and lengths), "null sequences or lengths");
+        check(capacity == 0 or out, "null output buffer");
+        auto& s = local_scratch();
+        offsets[0] = 0;
+        for (; i != num_seqs; ++i) {
+            check(seqs[i] or lengths[i] == 0, "null sequence");
+            s.sequence.assign(seqs[i], lengths[i]);
+            query(s);
+            auto const& r = s.*results;
+            const uint64_t begin = offsets[i];
+            if (r.size() > capacity - begin) {
+                throw error(FULGOR_ERROR_BUFFER_TOO_SMALL,
+                            "output buffer too small for sequence " + std::to_string(i) +
+                                " of the batch (" + std::to_string(r.size()) + " results)");
+            }
+            for (uint64_t j = 0; j != r.size(); ++j) out[begin + j] = to_c(r[j]);
+            offsets[i + 1] = begin + r.size();
+        }
+    });
+    if (num_processed) *num_processed = i;
+    return status;
+}
+
+}  // namespace c_api
+}  // namespace fulgor
+
+using namespace fulgor::c_api;
+
+extern "C" {
+
+uint32_t fulgor_abi_version(void) { return FULGOR_ABI_VERSION; }
+
+const char* fulgor_last_error(void) { return last_error().c_str(); }
+
+int fulgor_index_open(const char* filename, uint32_t flags, fulgor_index** index) {
+    return guard([&]() {
+        check(filename and index, "null filename or index");
+        *index = nullptr;
+        *index = open_index(filename, flags);
+    });
+}
+
+void fulgor_index_close(fulgor_index* index) { delete index; }
+
+uint64_t fulgor_index_k(const fulgor_index* index) { return index ? index->k() : 0; }
+
+uint64_t fulgor_index_num_colors(const fulgor_index* index) {
+    return index ? index->num_colors() : 0;
+}
+
+uint64_t fulgor_index_num_unitigs(const fulgor_index* index) {
+    return index ? index->num_unitigs() : 0;
+}
+
+uint64_t fulgor_index_num_color_sets(const fulgor_index* index) {
+    return index ? index->num_color_sets() : 0;
+}
+
+int fulgor_index_filename(const fulgor_index* index, uint64_t color, const char** name,
+                          uint64_t* length) {
+    return guard([&]() {
+        check(index and name and length, "null index, name or length");
+        check(color < index->num_colors(), "color out of range");
+        auto filename = index->filename(color);
+        *name = filename.data();
+        *length = filename.size();
+    });
+}
+
+int fulgor_pseudoalign(const fulgor_index* index, const char* const* seqs,
+                       const uint64_t* lengths, uint64_t num_seqs, uint32_t* colors,
+                       uint64_t capacity, uint64_t* offsets, uint64_t* num_processed) {
+    return run_batch(index, seqs, lengths, num_seqs, colors, capacity, offsets, num_processed,
+                     &fulgor_index::scratch::colors, [&](fulgor_index::scratch& s) {
+                         index->pseudoalign(s, fulgor::constants::invalid_threshold);
+                     });
+}
+
+int fulgor_threshold_union(const fulgor_index* index, const char* const* seqs,
+                           const uint64_t* lengths, uint64_t num_seqs, double threshold,
+                           uint32_t* colors, uint64_t capacity, uint64_t* offsets,
+                           uint64_t* num_processed) {
+    if (!(threshold > 0.0 and threshold <= 1.0)) {
+        if (num_processed) *num_processed = 0;
+        last_error() = "threshold must be a float in (0.0,1.0]";
+        return FULGOR_ERROR_INVALID_ARGUMENT;
+    }
+    return run_batch(index, seqs, lengths, num_seqs, colors, capacity, offsets, num_processed,
+                     &fulgor_index::scratch::colors,
+                     [&](fulgor_index::scratch& s) { index->pseudoalign(s, threshold); });
+}
+
+int fulgor_kmer_conservation(const fulgor_index* index, const char* const* seqs,
+                             const uint64_t* lengths, uint64_t num_seqs,
+                             fulgor_kmer_conservation_triple* triples, uint64_t capacity,
+                             uint64_t* offsets, uint64_t* num_processed) {
+    return run_batch(index, seqs, lengths, num_seqs, triples, capacity, offsets,
+                     num_processed, &fulgor_index::scratch::triples,
+                     [&](fulgor_index::scratch& s) { index->kmer_conservation(s); });
+}
+
+int fulgor_color_set(const fulgor_index* index, uint64_t color_set_id, uint32_t* colors,
+                     uint64_t capacity, uint64_t* size) {
+    return guard([&]() {
+        check(index and size, "null index or size");
+        check(color_set_id < index->num_color_sets(), "color set id out of range");
+        auto& s = local_scratch();
+        index->color_set(color_set_id, s.colors);
+        *size = s.colors.size();
+        if (s.colors.size() > capacity) {
+            throw error(FULGOR_ERROR_BUFFER_TOO_SMALL,
+                        "output buffer too small for the color set");
+        }
+        check(s.colors.empty() or colors, "null output buffer");
+        std::copy(s.colors.begin(), s.colors.end(), colors);
+    });
+}
+
+}  // extern "C"
@@ -11,6 +11,7 @@ void index<ColorSets>::kmer_conservation(
     constexpr uint64_t invalid = uint64_t(-1);
 
     if (sequence.length() < m_k2u.k()) return;
+    profiler::phase_timer timer(profiler::phase::kmer_conservation);
 
     kmer_conservation_info.clear();
     sshash::streaming_query<kmer_type, true> query(&m_k2u);
@@ -51,6 +52,13 @@ void index<ColorSets>::kmer_conservation(
 
     // push last one if we have to
     push_triple();
+
+    if constexpr (profiler::enabled) {
+        uint64_t num_positive_kmers = 0;
+        for (auto const& kct : kmer_conservation_info) num_positive_kmers += kct.num_kmers;
+        profiler::count(profiler::counter::kmers, num_kmers);
+        profiler::count(profiler::counter::positive_kmers, num_positive_kmers);
+    }
 }
 
 }  // namespace fulgor
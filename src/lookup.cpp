@@ -0,0 +1,41 @@
+#include "include/index.hpp"
+#include "external/sshash/include/streaming_query.hpp"
+
+namespace fulgor {
+
+template <typename ColorSets>
+uint64_t index<ColorSets>::lookup(std::string const& sequence,
+                                  std::vector<scored_id>& unitig_ids,
+                                  std::vector<uint64_t>* positive_kmers) const {
+    if (sequence.length() < m_k2u.k()) return 0;
+    profiler::phase_timer timer(profiler::phase::lookup);
+    const uint64_t num_kmers = sequence.length() - m_k2u.k() + 1;
+    if (positive_kmers) positive_kmers->assign((num_kmers + 63) / 64, 0);
+
+    uint64_t num_positive_kmers_in_sequence = 0;
+    { /* stream through with multiplicities */
+        sshash::streaming_query<kmer_type, true> query(&m_k2u);
+        query.reset();
+        for (uint64_t i = 0, prev_unitig_id = -1; i != num_kmers; ++i) {
+            char const* kmer = sequence.data() + i;
+            auto answer = query.lookup_advanced(kmer);
+            if (answer.kmer_id != sshash::constants::invalid_uint64) {  // kmer is positive
+                num_positive_kmers_in_sequence += 1;
+                if (positive_kmers) (*positive_kmers)[i / 64] |= uint64_t(1) << (i % 64);
+                if (answer.contig_id != prev_unitig_id) {
+                    unitig_ids.push_back({answer.contig_id, 1});
+                    prev_unitig_id = answer.contig_id;
+                } else {
+                    assert(!unitig_ids.empty());
+                    unitig_ids.back().score += 1;
+                }
+            }
+        }
+    }
+
+    profiler::count(profiler::counter::kmers, num_kmers);
+    profiler::count(profiler::counter::positive_kmers, num_positive_kmers_in_sequence);
+    return num_positive_kmers_in_sequence;
+}
+
+}  // namespace fulgor
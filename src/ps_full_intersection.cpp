@@ -1,5 +1,4 @@
 #include "include/index.hpp"
-#include "external/sshash/include/streaming_query.hpp"
 
 namespace fulgor {
 
@@ -337,40 +336,52 @@ void meta_intersect(std::vector<Iterator>& iterators, std::vector<uint32_t>& col
     }
 }
 
+template <typename Iterator>
+void count_decoded_integers(std::vector<Iterator> const& iterators) {
+    if constexpr (profiler::enabled) {
+        uint64_t n = 0;
+        for (auto const& it : iterators) n += it.size();
+        profiler::count(profiler::counter::decoded_integers, n);
+    }
+}
+
 template <typename ColorSets>
 void index<ColorSets>::pseudoalign_full_intersection(std::string const& sequence,
                                                      std::vector<uint32_t>& colors) const {
     if (sequence.length() < m_k2u.k()) return;
     colors.clear();
-    std::vector<uint64_t> unitig_ids;
-
-    { /* stream through */
-        sshash::streaming_query<kmer_type, true> query(&m_k2u);
-        query.reset();
-        const uint64_t num_kmers = sequence.length() - m_k2u.k() + 1;
-        for (uint64_t i = 0, prev_unitig_id = -1; i != num_kmers; ++i) {
-            char const* kmer = sequence.data() + i;
-            auto answer = query.lookup_advanced(kmer);
-            if (answer.kmer_id != sshash::constants::invalid_uint64) {  // kmer is positive
-                if (answer.contig_id != prev_unitig_id) {
-                    unitig_ids.push_back(answer.contig_id);
-                    prev_unitig_id = answer.contig_id;
-                }
-            }
-        }
-    }
+    std::vector<scored_id> unitig_ids;
+    lookup(sequence, unitig_ids);
+    intersect_unitigs(unitig_ids, colors);
+}
+
+template <typename ColorSets>
+void index<ColorSets>::intersect_unitigs(std::vector<scored_id>& unitig_ids,
+                                         std::vector<uint32_t>& colors) const {
+    color_phase_buffers buffers;
+    intersect_unitigs(unitig_ids, colors, buffers);
+}
 
+template <typename ColorSets>
+void index<ColorSets>::intersect_unitigs(std::vector<scored_id>& unitig_ids,
+                                         std::vector<uint32_t>& colors,
+                                         color_phase_buffers& buffers) const {
     /* here we use it to hold the color set ids;
        in meta_intersect we use it to hold the partition ids */
-    std::vector<uint32_t> tmp;
-    std::vector<typename ColorSets::iterator_type> iterators;
+    auto& tmp = buffers.color_set_ids;
+    auto& iterators = buffers.iterators;
+    tmp.clear();
+    iterators.clear();
+    profiler::phase_timer timer(profiler::phase::u2c);
 
     /* deduplicate unitig_ids */
-    std::sort(unitig_ids.begin(), unitig_ids.end());
-    auto end_unitigs = std::unique(unitig_ids.begin(), unitig_ids.end());
+    std::sort(unitig_ids.begin(), unitig_ids.end(),
+              [](auto const& x, auto const& y) { return x.item < y.item; });
+    auto end_unitigs = std::unique(unitig_ids.begin(), unitig_ids.end(),
+                                   [](auto const& x, auto const& y) { return x.item == y.item; });
     tmp.reserve(end_unitigs - unitig_ids.begin());
     for (auto it = unitig_ids.begin(); it != end_unitigs; ++it) {
-        uint32_t unitig_id = *it;
+        uint32_t unitig_id = it->item;
         uint32_t color_set_id = u2c(unitig_id);
         tmp.push_back(color_set_id);
     }
@@ -378,13 +389,52 @@ void index<ColorSets>::pseudoalign_full_intersection(std::string const& sequence
     /* deduplicate color set ids */
     std::sort(tmp.begin(), tmp.end());
     auto end_tmp = std::unique(tmp.begin(), tmp.end());
-    iterators.reserve(end_tmp - tmp.begin());
-    for (auto it = tmp.begin(); it != end_tmp; ++it) {
-        uint64_t color_set_id = *it;
-        auto fwd_it = m_color_sets.color_set(color_set_id);
-        iterators.push_back(fwd_it);
+    profiler::count(profiler::counter::distinct_unitigs, end_unitigs - unitig_ids.begin());
+    profiler::count(profiler::counter::distinct_color_sets, end_tmp - tmp.begin());
+
+    if (m_color_set_profile) {
+        for (auto it = tmp.begin(); it != end_tmp; ++it) m_color_set_profile->add(*it);
+    }
+
+    if (m_hot_color_sets) {
+        /* intersect the decoded hot sets first, then filter the result with the others */
+        std::vector<hot_color_sets::set_view> hot;
+        hot_color_sets::set_view view;
+        auto end_cold = tmp.begin();
+        for (auto it = tmp.begin(); it != end_tmp; ++it) {
+            if (m_hot_color_sets->find(*it, view)) {
+                hot.push_back(view);
+            } else {
+                *end_cold++ = *it;
+            }
+        }
+        if (!hot.empty()) {
+            timer.next(profiler::phase::intersection);
+            m_hot_color_sets->intersect(hot, colors);
+            if (colors.empty()) return;
+            timer.next(profiler::phase::iterators);
+            m_color_sets.color_sets(tmp.data(), end_cold - tmp.begin(), iterators);
+            count_decoded_integers(iterators);
+            timer.next(profiler::phase::intersection);
+            for (auto& fwd_it : iterators) {
+                uint64_t size = 0;
+                for (uint32_t c : colors) {
+                    fwd_it.next_geq(c);
+                    if (fwd_it.value() == c) colors[size++] = c;
+                }
+                colors.resize(size);
+                if (colors.empty()) break;
+            }
+            return;
+        }
     }
 
+    timer.next(profiler::phase::iterators);
+    iterators.reserve(end_tmp - tmp.begin());
+    m_color_sets.color_sets(tmp.data(), end_tmp - tmp.begin(), iterators);
+    count_decoded_integers(iterators);
+
+    timer.next(profiler::phase::intersection);
     tmp.clear();  // don't need color set ids anymore
     if constexpr (ColorSets::type == index_t::META) {
         meta_intersect<typename ColorSets::iterator_type, false>(iterators, colors, tmp);
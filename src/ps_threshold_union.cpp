@@ -1,24 +1,14 @@
-#include <numeric>  // for std::accumulate
-
 #include "include/index.hpp"
-#include "external/sshash/include/streaming_query.hpp"
 
 namespace fulgor {
 
-template <typename T>
-struct scored {
-    T item;
-    uint32_t score;
-};
-
-typedef scored<uint64_t> scored_id;
-
 template <typename Iterator>
-void merge(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors, int64_t min_score) {
+void merge(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors, int64_t min_score,
+           std::vector<int32_t>& scores) {
     if (iterators.empty()) return;
 
     uint32_t num_colors = iterators[0].item.num_colors();
-    std::vector<int32_t> scores(num_colors, 0);
+    scores.assign(num_colors, 0);
     for (auto& it : iterators) {
         if (it.item.encoding_type() == encoding_t::complement_delta_gaps) {
             it.item.reinit_for_complemented_set_iteration();
@@ -41,12 +31,13 @@ void merge(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors, int6
 
 template <typename Iterator>
 void merge_meta(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
-                const uint64_t min_score) {
+                const uint64_t min_score, std::vector<uint32_t>& partition_ids,
+                std::vector<uint32_t>& scores) {
     if (iterators.empty()) return;
 
     const uint32_t num_partitions = iterators[0].item.num_partitions();
     const uint32_t num_colors = iterators[0].item.num_colors();
-    std::vector<uint32_t> partition_ids;
+    partition_ids.clear();
     partition_ids.reserve(num_partitions);
 
     // the number of partitions is relatively small, so this does not impact efficiency
@@ -73,7 +64,7 @@ void merge_meta(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
         candidate_partition = next_partition;
     }
 
-    std::vector<uint32_t> scores(num_colors, 0);
+    scores.assign(num_colors, 0);
     for (auto& it : iterators) {
         it.item.init();
         it.item.change_partition();
@@ -121,7 +112,8 @@ void merge_meta(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
 
 template <typename Iterator>
 void merge_diff(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
-                const uint64_t min_score) {
+                const uint64_t min_score, std::vector<uint32_t>& scores,
+                std::vector<uint32_t>& partition_scores) {
     if (iterators.empty()) return;
     const uint32_t num_colors = iterators[0].item.num_colors();
     const uint32_t num_iterators = iterators.size();
@@ -130,8 +122,8 @@ void merge_diff(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
         return a.item.representative_begin() < b.item.representative_begin();
     });
 
-    std::vector<uint32_t> partition_scores(num_colors, 0);
-    std::vector<uint32_t> scores(num_colors, 0);
+    partition_scores.assign(num_colors, 0);
+    scores.assign(num_colors, 0);
     uint32_t score = 0;
     uint32_t partition_size = 0;
     for (uint32_t iterator_id = 0; iterator_id < num_iterators; iterator_id++) {
@@ -186,13 +178,14 @@ void merge_diff(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
 
 template <typename Iterator>
 void merge_metadiff(std::vector<Iterator>& iterators, std::vector<uint32_t>& colors,
-                    const uint64_t min_score) {
+                    const uint64_t min_score, std::vector<uint32_t>& partition_ids,
+                    std::vector<uint32_t>& scores, std::vector<uint32_t>& partition_scores) {
     if (iterators.empty()) return;
 
     const uint32_t num_partitions = iterators[0].item.num_partitions();
     const uint32_t num_colors = iterators[0].item.num_colors();
     const uint32_t num_iterators = iterators.size();
-    std::vector<uint32_t> partition_ids;
+    partition_ids.clear();
     partition_ids.reserve(num_partitions);
 
     // the number of partitions is relatively small, so this does not impact efficiency
@@ -219,8 +212,8 @@ void merge_metadiff(std::vector<Iterator>& iterators, std::vector<uint32_t>& col
         candidate_partition = next_partition;
     }
 
-    std::vector<uint32_t> scores(num_colors, 0);
-    std::vector<uint32_t> partition_scores(num_colors, 0);
+    scores.assign(num_colors, 0);
+    partition_scores.assign(num_colors, 0);
     for (auto& it : iterators) {
         it.item.init();
         it.item.change_partition();
@@ -323,36 +316,32 @@ void index<ColorSets>::pseudoalign_threshold_union(std::string const& sequence,
                                                    const double threshold) const {
     if (sequence.length() < m_k2u.k()) return;
     colors.clear();
-
     std::vector<scored_id> unitig_ids;
-    uint64_t num_positive_kmers_in_sequence = 0;
-    { /* stream through with multiplicities */
-        sshash::streaming_query<kmer_type, true> query(&m_k2u);
-        query.reset();
-        const uint64_t num_kmers = sequence.length() - m_k2u.k() + 1;
-        for (uint64_t i = 0, prev_unitig_id = -1; i != num_kmers; ++i) {
-            char const* kmer = sequence.data() + i;
-            auto answer = query.lookup_advanced(kmer);
-            if (answer.kmer_id != sshash::constants::invalid_uint64) {  // kmer is positive
-                num_positive_kmers_in_sequence += 1;
-                if (answer.contig_id != prev_unitig_id) {
-                    unitig_ids.push_back({answer.contig_id, 1});
-                    prev_unitig_id = answer.contig_id;
-                } else {
-                    assert(!unitig_ids.empty());
-                    unitig_ids.back().score += 1;
-                }
-            }
-        }
-    }
+    const uint64_t num_positive_kmers_in_sequence = lookup(sequence, unitig_ids);
+    const uint64_t min_score = static_cast<double>(num_positive_kmers_in_sequence) * threshold;
+    threshold_union_unitigs(unitig_ids, colors, min_score);
+}
 
-    /* num_positive_kmers_in_sequence must be equal to the sum of the scores  */
-    assert(num_positive_kmers_in_sequence ==
-           std::accumulate(unitig_ids.begin(), unitig_ids.end(), uint64_t(0),
-                           [](uint64_t curr_sum, auto const& u) { return curr_sum + u.score; }));
+template <typename ColorSets>
+void index<ColorSets>::threshold_union_unitigs(std::vector<scored_id>& unitig_ids,
+                                               std::vector<uint32_t>& colors,
+                                               const uint64_t min_score) const {
+    color_phase_buffers buffers;
+    threshold_union_unitigs(unitig_ids, colors, min_score, buffers);
+}
 
-    std::vector<scored_id> color_set_ids;
-    std::vector<scored<typename ColorSets::iterator_type>> iterators;
+template <typename ColorSets>
+void index<ColorSets>::threshold_union_unitigs(std::vector<scored_id>& unitig_ids,
+                                               std::vector<uint32_t>& colors,
+                                               const uint64_t min_score,
+                                               color_phase_buffers& buffers) const {
+    auto& color_set_ids = buffers.scored_color_set_ids;
+    auto& distinct_color_set_ids = buffers.color_set_ids;
+    auto& iterators = buffers.scored_iterators;
+    color_set_ids.clear();
+    distinct_color_set_ids.clear();
+    iterators.clear();
+    profiler::phase_timer timer(profiler::phase::u2c);
 
     /* deduplicate unitig_ids */
     std::sort(unitig_ids.begin(), unitig_ids.end(),
@@ -377,25 +366,46 @@ void index<ColorSets>::pseudoalign_threshold_union(std::string const& sequence,
     for (uint64_t i = 0; i != color_set_ids.size(); ++i) {
         uint64_t color_set_id = color_set_ids[i].item;
         if (color_set_id != prev_color_set_id) {
-            auto fwd_it = m_color_sets.color_set(color_set_id);
-            iterators.push_back({fwd_it, color_set_ids[i].score});
+            if (m_color_set_profile) m_color_set_profile->add(color_set_id);
+            distinct_color_set_ids.push_back(color_set_id);
+            color_set_ids[distinct_color_set_ids.size() - 1].score = color_set_ids[i].score;
             prev_color_set_id = color_set_id;
         } else {
-            assert(!iterators.empty());
-            iterators.back().score += color_set_ids[i].score;
+            assert(!distinct_color_set_ids.empty());
+            color_set_ids[distinct_color_set_ids.size() - 1].score += color_set_ids[i].score;
         }
     }
 
-    const uint64_t min_score = static_cast<double>(num_positive_kmers_in_sequence) * threshold;
+    profiler::count(profiler::counter::distinct_unitigs, color_set_ids.size());
+    profiler::count(profiler::counter::distinct_color_sets, distinct_color_set_ids.size());
+
+    /* build all iterators in one batch, so that their cache misses overlap */
+    timer.next(profiler::phase::iterators);
+    {
+        auto& fwd_its = buffers.iterators;
+        fwd_its.clear();
+        fwd_its.reserve(distinct_color_set_ids.size());
+        m_color_sets.color_sets(distinct_color_set_ids.data(), distinct_color_set_ids.size(),
+                                fwd_its);
+        iterators.reserve(fwd_its.size());
+        for (uint64_t i = 0; i != fwd_its.size(); ++i) {
+            iterators.push_back({fwd_its[i], color_set_ids[i].score});
+        }
+        count_decoded_integers(fwd_its);
+    }
+
+    timer.next(profiler::phase::threshold_union);
 
+    /* the color set ids are not needed anymore: hold the partition ids */
     if constexpr (ColorSets::type == index_t::META) {
-        merge_meta(iterators, colors, min_score);
+        merge_meta(iterators, colors, min_score, distinct_color_set_ids, buffers.scores);
     } else if constexpr (ColorSets::type == index_t::DIFF) {
-        merge_diff(iterators, colors, min_score);
+        merge_diff(iterators, colors, min_score, buffers.scores, buffers.partition_scores);
     } else if constexpr (ColorSets::type == index_t::META_DIFF) {
-        merge_metadiff(iterators, colors, min_score);
+        merge_metadiff(iterators, colors, min_score, distinct_color_set_ids, buffers.scores,
+                       buffers.partition_scores);
     } else if constexpr (ColorSets::type == index_t::HYBRID) {
-        merge(iterators, colors, min_score);
+        merge(iterators, colors, min_score, buffers.scores);
     }
 
     assert(util::check_union(iterators, colors, min_score));
@@ -0,0 +1,599 @@
+#include <random>
+#include <map>
+#include <numeric>
+
+using namespace fulgor;
+
+/*
+    Query benchmark on synthetic reads sampled from the unitigs of an index.
+    Positive reads are substrings of random unitigs (or of their reverse complement),
+    with substitution errors; negative reads are random sequences. Every query mode
+    is run with every number of threads on the same reads; the results are written
+    in JSON. With --huge-pages, all runs are repeated after backing the index with
+    transparent huge pages, to measure the throughput delta.
+*/
+
+struct bench_parameters {
+    uint64_t num_reads = 100000;
+    uint64_t read_length = 150;
+    double error_rate = 0.0;
+    double positive_fraction = 0.9;
+    double threshold = 0.8;  // for threshold-union
+    uint64_t seed = 13;
+    std::vector<uint64_t> num_threads = {1};
+    bool huge_pages = false;
+};
+
+template <typename FulgorIndex>
+std::vector<std::string> sample_reads(FulgorIndex const& index, bench_parameters const& params) {
+    constexpr char bases[] = {'A', 'C', 'G', 'T'};
+    constexpr uint64_t max_attempts = 16;  // to find a unitig at least as long as a read
+    const uint64_t k = index.k();
+    const uint64_t num_unitigs = index.num_unitigs();
+    std::mt19937_64 rng(params.seed);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+    auto spell = [&](uint64_t unitig_id) {
+        std::string seq;
+        auto it = index.get_k2u().at_contig_id(unitig_id);
+        while (it.has_next()) {
+            auto [_, kmer] = it.next();
+            if (seq.empty()) {
+                seq = kmer;
+            } else {
+                seq.push_back(kmer[k - 1]);
+            }
+        }
+        return seq;
+    };
+
+    auto reverse_complement = [](std::string& seq) {
+        std::reverse(seq.begin(), seq.end());
+        for (auto& c : seq) {
+            switch (c) {
+                case 'A':
+                    c = 'T';
+                    break;
+                case 'C':
+                    c = 'G';
+                    break;
+                case 'G':
+                    c = 'C';
+                    break;
+                case 'T':
+                    c = 'A';
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+
+    std::vector<std::string> reads;
+    reads.reserve(params.num_reads);
+    for (uint64_t i = 0; i != params.num_reads; ++i) {
+        std::string read;
+        if (coin(rng) < params.positive_fraction) {
+            std::string seq;
+            for (uint64_t a = 0; a != max_attempts; ++a) {
+                std::string s = spell(rng() % num_unitigs);
+                if (s.length() > seq.length()) seq.swap(s);
+                if (seq.length() >= params.read_length) break;
+            }
+            if (seq.length() > params.read_length) {
+                const uint64_t offset = rng() % (seq.length() - params.read_length + 1);
+                read = seq.substr(offset, params.read_length);
+            } else {  // pad with random bases: the padded kmers are (most likely) negative
+                read = seq;
+                while (read.length() < params.read_length) read.push_back(bases[rng() % 4]);
+            }
+            if (coin(rng) < 0.5) reverse_complement(read);
+            for (auto& c : read) {
+                if (coin(rng) < params.error_rate) {
+                    const uint64_t shift = 1 + rng() % 3;  // a base different from c
+                    const uint64_t b = (std::find(bases, bases + 4, c) - bases + shift) % 4;
+                    c = bases[b];
+                }
+            }
+        } else {
+            read.resize(params.read_length);
+            for (auto& c : read) c = bases[rng() % 4];
+        }
+        reads.push_back(std::move(read));
+    }
+    return reads;
+}
+
+struct bench_result {
+    std::string query;
+    uint64_t num_threads = 0;
+    bool huge_pages = false;
+    uint64_t elapsed_in_ns = 0;
+    uint64_t num_reads = 0;
+    uint64_t num_mapped_reads = 0;
+    uint64_t num_kmers = 0;
+    uint64_t lookup_time_in_ns = 0;        // summed over the threads
+    std::vector<uint32_t> color_phase_ns;  // one per mapped read, sorted
+
+    void print_json(std::ostream& out) const {
+        auto percentile = [&](double p) -> uint64_t {
+            if (color_phase_ns.empty()) return 0;
+            return color_phase_ns[std::min<uint64_t>(p * color_phase_ns.size(),
+                                                     color_phase_ns.size() - 1)];
+        };
+        const double elapsed_in_s = elapsed_in_ns / 1e9;
+        out << "{\"query\": \"" << query << "\", \"num_threads\": " << num_threads
+            << ", \"huge_pages\": " << (huge_pages ? "true" : "false")
+            << ", \"elapsed_ms\": " << elapsed_in_ns / 1e6
+            << ", \"reads_per_second\": " << num_reads / elapsed_in_s
+            << ", \"num_mapped_reads\": " << num_mapped_reads
+            << ", \"ns_per_kmer_lookup\": "
+            << (num_kmers ? double(lookup_time_in_ns) / num_kmers : 0.0);
+        if (!color_phase_ns.empty()) {
+            out << ", \"color_phase_ns\": {\"p50\": " << percentile(0.5)
+                << ", \"p90\": " << percentile(0.9) << ", \"p99\": " << percentile(0.99)
+                << ", \"p999\": " << percentile(0.999) << ", \"max\": " << color_phase_ns.back()
+                << "}";
+        }
+        out << "}";
+    }
+};
+
+enum class bench_query : uint8_t { FULL_INTERSECTION, THRESHOLD_UNION, KMER_CONSERVATION };
+
+template <typename FulgorIndex>
+bench_result run_bench(FulgorIndex const& index, std::vector<std::string> const& reads,
+                       bench_query query, const double threshold, const uint64_t num_threads) {
+    typedef std::chrono::steady_clock clock_type;
+    auto ns = [](clock_type::time_point begin, clock_type::time_point end) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    };
+    constexpr uint64_t block_size = 64;  // reads taken at once by a thread
+
+    struct thread_result {
+        uint64_t num_mapped_reads = 0, num_kmers = 0, lookup_time_in_ns = 0;
+        std::vector<uint32_t> color_phase_ns;
+    };
+    std::vector<thread_result> thread_results(num_threads);
+    std::atomic<uint64_t> next_block{0};
+    const uint64_t k = index.k();
+
+    auto exe = [&](uint64_t thread_id) {
+        auto& r = thread_results[thread_id];
+        std::vector<scored_id> unitig_ids;
+        std::vector<uint32_t> colors;
+        std::vector<kmer_conservation_triple> kmer_conservation_info;
+        while (true) {
+            const uint64_t begin = block_size * next_block++;
+            if (begin >= reads.size()) break;
+            const uint64_t end = std::min<uint64_t>(begin + block_size, reads.size());
+            for (uint64_t i = begin; i != end; ++i) {
+                auto const& read = reads[i];
+                if (read.length() < k) continue;
+                r.num_kmers += read.length() - k + 1;
+                if (query == bench_query::KMER_CONSERVATION) {
+                    auto t0 = clock_type::now();
+                    index.kmer_conservation(read, kmer_conservation_info);
+                    r.lookup_time_in_ns += ns(t0, clock_type::now());
+                    r.num_mapped_reads += !kmer_conservation_info.empty();
+                    continue;
+                }
+                unitig_ids.clear();
+                colors.clear();
+                auto t0 = clock_type::now();
+                const uint64_t num_positive_kmers = index.lookup(read, unitig_ids);
+                auto t1 = clock_type::now();
+                r.lookup_time_in_ns += ns(t0, t1);
+                if (num_positive_kmers == 0) continue;
+                if (query == bench_query::FULL_INTERSECTION) {
+                    index.intersect_unitigs(unitig_ids, colors);
+                } else {
+                    const uint64_t min_score = static_cast<double>(num_positive_kmers) * threshold;
+                    index.threshold_union_unitigs(unitig_ids, colors, min_score);
+                }
+                r.color_phase_ns.push_back(ns(t1, clock_type::now()));
+                r.num_mapped_reads += !colors.empty();
+            }
+        }
+    };
+
+    auto start = clock_type::now();
+    std::vector<std::thread> threads(num_threads);
+    for (uint64_t thread_id = 0; thread_id != num_threads; ++thread_id) {
+        threads[thread_id] = std::thread(exe, thread_id);
+    }
+    for (auto& t : threads) t.join();
+
+    bench_result result;
+    result.elapsed_in_ns = ns(start, clock_type::now());
+    result.query = query == bench_query::FULL_INTERSECTION   ? "full-intersection"
+                   : query == bench_query::THRESHOLD_UNION ? "threshold-union"
+                                                           : "kmer-conservation";
+    result.num_threads = num_threads;
+    result.num_reads = reads.size();
+    for (auto const& r : thread_results) {
+        result.num_mapped_reads += r.num_mapped_reads;
+        result.num_kmers += r.num_kmers;
+        result.lookup_time_in_ns += r.lookup_time_in_ns;
+        result.color_phase_ns.insert(result.color_phase_ns.end(), r.color_phase_ns.begin(),
+                                     r.color_phase_ns.end());
+    }
+    std::sort(result.color_phase_ns.begin(), result.color_phase_ns.end());
+    return result;
+}
+
+template <typename FulgorIndex>
+int bench(std::string const& index_filename, bench_parameters const& params,
+          std::string const& output_filename) {
+    /* progress goes to stderr, so that the JSON output can be written to stdout */
+    FulgorIndex index;
+    std::cerr << "loading index from disk..." << std::endl;
+    essentials::load(index, index_filename.c_str());
+    std::cerr << "sampling " << params.num_reads << " reads..." << std::endl;
+    auto reads = sample_reads(index, params);
+
+    std::ofstream file;
+    if (!output_filename.empty()) {
+        file.open(output_filename);
+        if (!file.is_open()) {
+            std::cerr << "could not open output file " + output_filename << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output_filename.empty() ? std::cout : file;
+
+    out << "{\n  \"index\": \"" << index_filename << "\", \"k\": " << index.k()
+        << ", \"num_colors\": " << index.num_colors()
+        << ", \"num_unitigs\": " << index.num_unitigs()
+        << ", \"num_color_sets\": " << index.num_color_sets() << ",\n";
+    out << "  \"reads\": {\"num_reads\": " << params.num_reads
+        << ", \"read_length\": " << params.read_length
+        << ", \"error_rate\": " << params.error_rate
+        << ", \"positive_fraction\": " << params.positive_fraction
+        << ", \"seed\": " << params.seed << "},\n";
+    out << "  \"threshold\": " << params.threshold << ",\n";
+
+    std::vector<bench_result> results;
+    auto run_all = [&](const bool huge_pages) {
+        for (auto query : {bench_query::FULL_INTERSECTION, bench_query::THRESHOLD_UNION,
+                           bench_query::KMER_CONSERVATION}) {
+            for (uint64_t num_threads : params.num_threads) {
+                auto result = run_bench(index, reads, query, params.threshold, num_threads);
+                result.huge_pages = huge_pages;
+                std::cerr << result.query << " with " << num_threads << " thread(s)"
+                          << (huge_pages ? " and huge pages: " : ": ")
+                          << uint64_t(result.num_reads * 1e9 / result.elapsed_in_ns)
+                          << " reads/s" << std::endl;
+                results.push_back(std::move(result));
+            }
+        }
+    };
+
+    run_all(false);
+    if (params.huge_pages) {
+        auto report = advise_huge_pages(index);
+        report.print(std::cerr);
+        out << "  \"huge_pages\": ";
+        report.print_json(out);
+        out << ",\n";
+        const uint64_t num_runs = results.size();
+        run_all(true);
+        for (uint64_t i = 0; i != num_runs; ++i) {
+            auto const& r = results[i];
+            std::cerr << r.query << " with " << r.num_threads << " thread(s): huge pages speedup "
+                      << double(r.elapsed_in_ns) / results[num_runs + i].elapsed_in_ns << "x"
+                      << std::endl;
+        }
+    }
+
+    out << "  \"runs\": [";
+    for (uint64_t i = 0; i != results.size(); ++i) {
+        out << (i == 0 ? "\n    " : ",\n    ");
+        results[i].print_json(out);
+    }
+    out << "\n  ]\n}" << std::endl;
+
+    return 0;
+}
+
+int bench(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    bench_parameters params;
+    parser.add("index_filename", "The Fulgor index filename.", "-i", true);
+    parser.add("output_filename", "JSON output filename (default is stdout).", "-o", false);
+    parser.add("num_reads",
+               "Number of reads to sample. Default value is " + std::to_string(params.num_reads) +
+                   ".",
+               "-n", false);
+    parser.add("read_length",
+               "Read length. Default value is " + std::to_string(params.read_length) + ".", "-l",
+               false);
+    parser.add("error_rate", "Per-base substitution rate of positive reads (default is 0).", "-e",
+               false);
+    parser.add("positive_fraction",
+               "Fraction of reads sampled from the unitigs; the others are random sequences. "
+               "Default value is " +
+                   std::to_string(params.positive_fraction) + ".",
+               "-p", false);
+    parser.add("threshold",
+               "Threshold for threshold-union. Default value is " +
+                   std::to_string(params.threshold) + ".",
+               "-r", false);
+    parser.add("num_threads",
+               "Comma-separated list of numbers of threads to run each query mode with (default "
+               "is 1).",
+               "-t", false);
+    parser.add("seed", "Seed for sampling reads.", "--seed", false);
+    parser.add("huge_pages",
+               "Repeat all runs after backing the index with transparent huge pages (Linux only) "
+               "and report the throughput delta.",
+               "--huge-pages", false, true);
+    if (!parser.parse()) return 1;
+
+    auto index_filename = parser.get<std::string>("index_filename");
+    std::string output_filename;
+    if (parser.parsed("output_filename")) {
+        output_filename = parser.get<std::string>("output_filename");
+    }
+    if (parser.parsed("num_reads")) params.num_reads = parser.get<uint64_t>("num_reads");
+    if (parser.parsed("read_length")) params.read_length = parser.get<uint64_t>("read_length");
+    if (parser.parsed("error_rate")) params.error_rate = parser.get<double>("error_rate");
+    if (parser.parsed("positive_fraction")) {
+        params.positive_fraction = parser.get<double>("positive_fraction");
+    }
+    if (parser.parsed("threshold")) params.threshold = parser.get<double>("threshold");
+    if (parser.parsed("seed")) params.seed = parser.get<uint64_t>("seed");
+    params.huge_pages = parser.get<bool>("huge_pages");
+    if (parser.parsed("num_threads")) {
+        params.num_threads.clear();
+        for (auto const& t : util::split(parser.get<std::string>("num_threads"), ',')) {
+            params.num_threads.push_back(std::stoull(t));
+        }
+    }
+
+    if (params.error_rate < 0.0 or params.error_rate > 1.0 or params.positive_fraction < 0.0 or
+        params.positive_fraction > 1.0) {
+        std::cerr << "error rate and fraction of positive reads must be in [0.0,1.0]"
+                  << std::endl;
+        return 1;
+    }
+    if (params.threshold == 0.0 or params.threshold > 1.0) {
+        std::cerr << "threshold must be a float in (0.0,1.0]" << std::endl;
+        return 1;
+    }
+    for (uint64_t t : params.num_threads) {
+        if (t == 0) {
+            std::cerr << "the number of threads must be positive" << std::endl;
+            return 1;
+        }
+    }
+
+    if (sshash::util::ends_with(index_filename,
+                                constants::meta_diff_colored_fulgor_filename_extension)) {
+        return bench<meta_differential_index_type>(index_filename, params, output_filename);
+    } else if (sshash::util::ends_with(index_filename,
+                                       constants::meta_colored_fulgor_filename_extension)) {
+        return bench<meta_index_type>(index_filename, params, output_filename);
+    } else if (sshash::util::ends_with(index_filename,
+                                       constants::diff_colored_fulgor_filename_extension)) {
+        return bench<differential_index_type>(index_filename, params, output_filename);
+    } else if (sshash::util::ends_with(index_filename, constants::fulgor_filename_extension)) {
+        return bench<index_type>(index_filename, params, output_filename);
+    }
+
+    std::cerr << "Wrong index filename supplied." << std::endl;
+
+    return 1;
+}
+
+/*
+    Microbenchmark of the color set iterators. A sample of color sets is bucketed by
+    encoding and by size (powers of two); for each bucket we measure iterator
+    construction, size(), full decoding with next(), rewind(), next_geq() with
+    random increasing targets and, for complemented sets, complement iteration.
+*/
+
+template <typename ColorSets, typename Iterator>
+std::string encoding_name(Iterator const& it) {
+    if constexpr (ColorSets::type == index_t::HYBRID or ColorSets::type == index_t::DIFF) {
+        switch (it.encoding_type()) {
+            case encoding_t::delta_gaps:
+                return "delta_gaps";
+            case encoding_t::bitmap:
+                return "bitmap";
+            case encoding_t::complement_delta_gaps:
+                return "complement_delta_gaps";
+            case encoding_t::symmetric_difference:
+                return "symmetric_difference";
+        }
+        return "unknown";
+    } else if constexpr (ColorSets::type == index_t::META) {
+        return "meta";
+    } else {
+        return "meta_differential";
+    }
+}
+
+template <typename FulgorIndex>
+int bench_iterators(std::string const& index_filename, const uint64_t num_samples,
+                    const uint64_t num_next_geq_targets, const uint64_t seed,
+                    std::string const& output_filename) {
+    typedef typename FulgorIndex::color_sets_type color_sets_type;
+    typedef typename color_sets_type::iterator_type iterator_type;
+    typedef std::chrono::steady_clock clock_type;
+    auto ns = [](clock_type::time_point begin, clock_type::time_point end) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    };
+
+    FulgorIndex index;
+    std::cerr << "loading index from disk..." << std::endl;
+    essentials::load(index, index_filename.c_str());
+    const uint64_t num_color_sets = index.num_color_sets();
+    const uint64_t num_colors = index.num_colors();
+
+    /* bucket a sample of color sets by (encoding, floor(log2(size))) */
+    std::mt19937_64 rng(seed);
+    std::map<std::pair<std::string, uint64_t>, std::vector<uint32_t>> buckets;
+    for (uint64_t i = 0; i != std::min(num_samples, num_color_sets); ++i) {
+        const uint32_t color_set_id =
+            num_samples >= num_color_sets ? i : rng() % num_color_sets;
+        auto it = index.color_set(color_set_id);
+        const uint64_t size = it.size();
+        const uint64_t log2_size = size ? 63 - __builtin_clzll(size) : 0;
+        buckets[{encoding_name<color_sets_type>(it), log2_size}].push_back(color_set_id);
+    }
+    std::cerr << "sampled " << std::min(num_samples, num_color_sets) << " color sets in "
+              << buckets.size() << " buckets" << std::endl;
+
+    std::ofstream file;
+    if (!output_filename.empty()) {
+        file.open(output_filename);
+        if (!file.is_open()) {
+            std::cerr << "could not open output file " + output_filename << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output_filename.empty() ? std::cout : file;
+    out << "{\n  \"index\": \"" << index_filename << "\", \"num_colors\": " << num_colors
+        << ", \"num_color_sets\": " << num_color_sets << ", \"seed\": " << seed << ",\n";
+    out << "  \"buckets\": [";
+
+    uint64_t checksum = 0;  // keeps the compiler from dropping the measured loops
+    bool first = true;
+    for (auto const& [key, ids] : buckets) {
+        auto const& [encoding, log2_size] = key;
+        const uint64_t n = ids.size();
+
+        auto t0 = clock_type::now();
+        for (uint32_t id : ids) checksum += index.color_set(id).value();
+        const double construction_ns = double(ns(t0, clock_type::now())) / n;
+
+        std::vector<iterator_type> iterators;
+        iterators.reserve(n);
+        for (uint32_t id : ids) iterators.push_back(index.color_set(id));
+
+        std::vector<uint64_t> sizes(n);
+        t0 = clock_type::now();
+        for (uint64_t i = 0; i != n; ++i) sizes[i] = iterators[i].size();
+        const double size_ns = double(ns(t0, clock_type::now())) / n;
+        const uint64_t num_ints = std::accumulate(sizes.begin(), sizes.end(), uint64_t(0));
+        checksum += num_ints;
+
+        /* the iterators are still at their beginning; size() is not timed again, as it
+           can be slow (e.g. for meta color sets) */
+        t0 = clock_type::now();
+        for (uint64_t i = 0; i != n; ++i) {
+            auto& it = iterators[i];
+            for (uint64_t j = 0; j != sizes[i]; ++j, it.next()) checksum += it.value();
+        }
+        const double decode_ns_per_int = num_ints ? double(ns(t0, clock_type::now())) / num_ints
+                                                  : 0.0;
+
+        t0 = clock_type::now();
+        for (auto& it : iterators) {
+            it.rewind();
+            checksum += it.value();
+        }
+        const double rewind_ns = double(ns(t0, clock_type::now())) / n;
+
+        std::vector<uint32_t> targets(n * num_next_geq_targets);
+        for (uint64_t i = 0; i != n; ++i) {
+            auto begin = targets.begin() + i * num_next_geq_targets;
+            auto end = begin + num_next_geq_targets;
+            for (auto t = begin; t != end; ++t) *t = rng() % num_colors;
+            std::sort(begin, end);
+        }
+        t0 = clock_type::now();
+        for (uint64_t i = 0; i != n; ++i) {
+            auto& it = iterators[i];
+            for (uint64_t j = 0; j != num_next_geq_targets; ++j) {
+                it.next_geq(targets[i * num_next_geq_targets + j]);
+                checksum += it.value();
+            }
+        }
+        const double next_geq_ns =
+            num_next_geq_targets ? double(ns(t0, clock_type::now())) / (n * num_next_geq_targets)
+                                 : 0.0;
+
+        double complement_ns_per_int = 0.0;
+        if constexpr (color_sets_type::type == index_t::HYBRID) {
+            if (encoding == "complement_delta_gaps") {
+                uint64_t num_comp_ints = 0;
+                t0 = clock_type::now();
+                for (auto& it : iterators) {
+                    it.reinit_for_complemented_set_iteration();
+                    for (; it.comp_value() < num_colors; it.next_comp()) {
+                        checksum += it.comp_value();
+                        num_comp_ints += 1;
+                    }
+                }
+                if (num_comp_ints) {
+                    complement_ns_per_int = double(ns(t0, clock_type::now())) / num_comp_ints;
+                }
+            }
+        }
+
+        out << (first ? "\n    " : ",\n    ") << "{\"encoding\": \"" << encoding
+            << "\", \"min_size\": " << (uint64_t(1) << log2_size)
+            << ", \"max_size\": " << (uint64_t(2) << log2_size) - 1 << ", \"num_sets\": " << n
+            << ", \"avg_size\": " << double(num_ints) / n
+            << ", \"construction_ns\": " << construction_ns << ", \"size_ns\": " << size_ns
+            << ", \"decode_ns_per_int\": " << decode_ns_per_int << ", \"rewind_ns\": " << rewind_ns
+            << ", \"next_geq_ns\": " << next_geq_ns;
+        if (complement_ns_per_int != 0.0) {
+            out << ", \"complement_ns_per_int\": " << complement_ns_per_int;
+        }
+        out << "}";
+        first = false;
+    }
+    out << "\n  ],\n  \"checksum\": " << checksum << "\n}" << std::endl;
+
+    return 0;
+}
+
+int bench_iterators(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename", "The Fulgor index filename.", "-i", true);
+    parser.add("output_filename", "JSON output filename (default is stdout).", "-o", false);
+    parser.add("num_samples",
+               "Number of color sets to sample (default is 100000; all of them if the index has "
+               "fewer).",
+               "-n", false);
+    parser.add("num_targets",
+               "Number of random next_geq() targets per color set (default is 16).", "-q", false);
+    parser.add("seed", "Seed for sampling.", "--seed", false);
+    if (!parser.parse()) return 1;
+
+    auto index_filename = parser.get<std::string>("index_filename");
+    std::string output_filename;
+    if (parser.parsed("output_filename")) {
+        output_filename = parser.get<std::string>("output_filename");
+    }
+    uint64_t num_samples = 100000;
+    if (parser.parsed("num_samples")) num_samples = parser.get<uint64_t>("num_samples");
+    uint64_t num_targets = 16;
+    if (parser.parsed("num_targets")) num_targets = parser.get<uint64_t>("num_targets");
+    uint64_t seed = 13;
+    if (parser.parsed("seed")) seed = parser.get<uint64_t>("seed");
+
+    if (sshash::util::ends_with(index_filename,
+                                constants::meta_diff_colored_fulgor_filename_extension)) {
+        return bench_iterators<meta_differential_index_type>(index_filename, num_samples,
+                                                             num_targets, seed, output_filename);
+    } else if (sshash::util::ends_with(index_filename,
+                                       constants::meta_colored_fulgor_filename_extension)) {
+        return bench_iterators<meta_index_type>(index_filename, num_samples, num_targets, seed,
+                                                output_filename);
+    } else if (sshash::util::ends_with(index_filename,
+                                       constants::diff_colored_fulgor_filename_extension)) {
+        return bench_iterators<differential_index_type>(index_filename, num_samples, num_targets,
+                                                        seed, output_filename);
+    } else if (sshash::util::ends_with(index_filename, constants::fulgor_filename_extension)) {
+        return bench_iterators<index_type>(index_filename, num_samples, num_targets, seed,
+                                           output_filename);
+    }
+
+    std::cerr << "Wrong index filename supplied." << std::endl;
+
+    return 1;
+}
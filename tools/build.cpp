@@ -145,6 +145,17 @@ int build(int argc, char** argv) {
                "--force", false, true);
     parser.add("meta", "Build a meta-colored index.", "--meta", false, true);
     parser.add("diff", "Build a differential-colored index.", "--diff", false, true);
+    parser.add("mini_batch",
+               "Use mini-batch k-means, with batches of this many sketches, when partitioning "
+               "the references or the color sets (default is full-batch k-means).",
+               "--mini-batch", false);
+    parser.add("rep_splits",
+               "Refine the representatives of differential color sets by splitting each group "
+               "of color sets, at most this many times, when that lowers the number of integers "
+               "to encode. Default value is " +
+                   std::to_string(constants::default_max_representative_splits) +
+                   " (no refinement).",
+               "--rep-splits", false);
 
     if (!parser.parse()) return 1;
     util::print_cmd(argc, argv);
@@ -198,6 +209,12 @@ int build(int argc, char** argv) {
     build_config.verbose = parser.get<bool>("verbose");
     build_config.check = parser.get<bool>("check");
     build_config.filenames_list = parser.get<std::string>("filenames_list");
+    if (parser.parsed("mini_batch")) {
+        build_config.clustering_mini_batch_size = parser.get<uint64_t>("mini_batch");
+    }
+    if (parser.parsed("rep_splits")) {
+        build_config.max_representative_splits = parser.get<uint64_t>("rep_splits");
+    }
     if (parser.get<uint64_t>("RAM")) {
         build_config.ram_limit_in_GiB = parser.get<uint64_t>("RAM");
     }
@@ -238,6 +255,10 @@ int color(int argc, char** argv) {
         "Temporary directory used for construction in external memory. Default is directory '" +
             constants::default_tmp_dirname + "'.",
         "-d", false);
+    parser.add("RAM",
+               "RAM limit in GiB. Default value is " +
+                   std::to_string(constants::default_ram_limit_in_GiB) + ".",
+               "-g", false);
     parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
     parser.add("verbose", "Verbose output during construction.", "--verbose", false, true);
     parser.add("check", "Check correctness after index construction (it might take some time).",
@@ -246,6 +267,17 @@ int color(int argc, char** argv) {
                "--force", false, true);
     parser.add("meta", "Build a meta-colored index.", "--meta", false, true);
     parser.add("diff", "Build a differential-colored index.", "--diff", false, true);
+    parser.add("mini_batch",
+               "Use mini-batch k-means, with batches of this many sketches, when partitioning "
+               "the references or the color sets (default is full-batch k-means).",
+               "--mini-batch", false);
+    parser.add("rep_splits",
+               "Refine the representatives of differential color sets by splitting each group "
+               "of color sets, at most this many times, when that lowers the number of integers "
+               "to encode. Default value is " +
+                   std::to_string(constants::default_max_representative_splits) +
+                   " (no refinement).",
+               "--rep-splits", false);
 
     if (!parser.parse()) return 1;
     util::print_cmd(argc, argv);
@@ -268,10 +300,17 @@ int color(int argc, char** argv) {
     if (parser.parsed("num_threads")) {
         build_config.num_threads = parser.get<uint64_t>("num_threads");
     }
+    if (parser.parsed("RAM")) build_config.ram_limit_in_GiB = parser.get<uint64_t>("RAM");
     build_config.check = parser.get<bool>("check");
     build_config.meta_colored = parser.get<bool>("meta");
     build_config.diff_colored = parser.get<bool>("diff");
     build_config.verbose = parser.get<bool>("verbose");
+    if (parser.parsed("mini_batch")) {
+        build_config.clustering_mini_batch_size = parser.get<uint64_t>("mini_batch");
+    }
+    if (parser.parsed("rep_splits")) {
+        build_config.max_representative_splits = parser.get<uint64_t>("rep_splits");
+    }
     bool force = parser.get<bool>("force");
 
     if (build_config.meta_colored and build_config.diff_colored) {
@@ -17,8 +17,12 @@
 #include "util.cpp"
 #include "build.cpp"
 #include "permute.cpp"
+#include "reorder.cpp"
+#include "update.cpp"
+#include "merge.cpp"
 #include "pseudoalign.cpp"
 #include "kmer_conservation.cpp"
+#include "bench.cpp"
 
 int help(char* arg0) {
     std::cout << "== Fulgor: a colored de Bruijn graph index "
@@ -31,17 +35,22 @@ int help(char* arg0) {
     std::cout
         << "Tools:\n"
         << "  build              build an index\n"
+        << "  update             add new references to an index\n"
+        << "  merge              merge indexes built on disjoint sets of references\n"
         << "  pseudoalign        perform pseudoalignment to an index\n"
         << "  kmer-conservation  print color set info for each positive kmer in query\n"
         << "  verify             verify that index works correctly with current library version\n"
         << "  stats              print index statistics\n"
         << "  print-filenames    print all reference filenames\n"
+        << "  bench              benchmark queries on reads sampled from an index\n"
         << std::endl;
 
     std::cout << "Advanced tools:\n"
               << "  permute            permute the reference names of an index\n"
               << "  dump               write unitigs and color sets of an index in text format\n"
               << "  color              build a meta- or a diff- or a meta-diff- index\n"
+              << "  reorder            reorder color sets and unitigs for locality of access\n"
+              << "  bench-iterators    benchmark the color set iterators of an index\n"
               << std::endl;
 
     return 1;
@@ -55,6 +64,10 @@ int main(int argc, char** argv) {
     /* basic tools */
     if (tool == "build") {
         return build(argc - 1, argv + 1);
+    } else if (tool == "update") {
+        return update(argc - 1, argv + 1);
+    } else if (tool == "merge") {
+        return merge(argc - 1, argv + 1);
     } else if (tool == "pseudoalign") {
         return pseudoalign(argc - 1, argv + 1);
     } else if (tool == "kmer-conservation") {
@@ -65,6 +78,8 @@ int main(int argc, char** argv) {
         return stats(argc - 1, argv + 1);
     } else if (tool == "print-filenames") {
         return print_filenames(argc - 1, argv + 1);
+    } else if (tool == "bench") {
+        return bench(argc - 1, argv + 1);
     }
 
     /* advanced tools */
@@ -74,6 +89,10 @@ int main(int argc, char** argv) {
         return dump(argc - 1, argv + 1);
     } else if (tool == "color") {
         return color(argc - 1, argv + 1);
+    } else if (tool == "reorder") {
+        return reorder(argc - 1, argv + 1);
+    } else if (tool == "bench-iterators") {
+        return bench_iterators(argc - 1, argv + 1);
     }
 
     std::cout << "Unsupported tool '" << tool << "'.\n" << std::endl;
@@ -3,59 +3,62 @@
 #include <sstream>
 
 #include "src/kmer_conservation.cpp"
+#include "include/parallel_gunzip.hpp"
+#include "include/read_scheduler.hpp"
+#include "include/output_file.hpp"
 
 using namespace fulgor;
 
 template <typename FulgorIndex>
 int kmer_conservation(FulgorIndex const& index,
                       fastx_parser::FastxParser<fastx_parser::ReadSeq>& rparser,
+                      read_scheduler<fastx_parser::ReadSeq>& scheduler, const uint64_t worker_id,
                       std::atomic<uint64_t>& num_reads, std::atomic<uint64_t>& num_processed_reads,
-                      std::ofstream& out_file, std::mutex& iomut, std::mutex& ofile_mut,
+                      output_file& out_file, std::mutex& iomut, std::mutex& ofile_mut,
                       const bool verbose)  //
 {
+    profiler::worker_scope worker_scope;  // for --perf-counters
     std::vector<kmer_conservation_triple> kmer_conservation_info;
     std::stringstream ss;
     uint64_t buff_size = 0;
     constexpr uint64_t buff_thresh = 50;
 
-    auto rg = rparser.getReadGroup();
-    while (rparser.refill(rg)) {
-        for (auto const& record : rg) {
-            if (record.seq.length() >= (uint64_t(1) << 32)) {
-                iomut.lock();
-                std::cout << "sequence is too long (>= 2^32): skipping" << std::endl;
-                iomut.unlock();
-            }
-            index.kmer_conservation(record.seq, kmer_conservation_info);
-            buff_size += 1;
-            if (!kmer_conservation_info.empty()) {
-                num_processed_reads += 1;
-                ss << record.name << '\t' << kmer_conservation_info.size();
-                for (auto kct : kmer_conservation_info) {
-                    ss << "\t(" << kct.start_pos_in_query << ' ' << kct.num_kmers << ' '
-                       << kct.color_set_id << ')';
-                }
-                ss << '\n';
-            } else {
-                ss << record.name << "\t0\n";
-            }
-            num_reads += 1;
-            kmer_conservation_info.clear();
-            if (verbose and num_reads > 0 and num_reads % 1000000 == 0) {
-                iomut.lock();
-                std::cout << "processed " << num_reads << " reads" << std::endl;
-                iomut.unlock();
-            }
-            if (buff_size > buff_thresh) {
-                std::string outs = ss.str();
-                ss.str("");
-                ofile_mut.lock();
-                out_file.write(outs.data(), outs.size());
-                ofile_mut.unlock();
-                buff_size = 0;
+    scheduler.run(rparser, worker_id, [&](fastx_parser::ReadSeq const& record) {
+        if (record.seq.length() >= (uint64_t(1) << 32)) {
+            iomut.lock();
+            std::cout << "sequence is too long (>= 2^32): skipping" << std::endl;
+            iomut.unlock();
+        }
+        index.kmer_conservation(record.seq, kmer_conservation_info);
+        buff_size += 1;
+        if (!kmer_conservation_info.empty()) {
+            num_processed_reads += 1;
+            ss << record.name << '\t' << kmer_conservation_info.size();
+            for (auto kct : kmer_conservation_info) {
+                ss << "\t(" << kct.start_pos_in_query << ' ' << kct.num_kmers << ' '
+                   << kct.color_set_id << ')';
             }
+            ss << '\n';
+        } else {
+            ss << record.name << "\t0\n";
         }
-    }
+        num_reads += 1;
+        profiler::count(profiler::counter::reads, 1);
+        kmer_conservation_info.clear();
+        if (verbose and num_reads > 0 and num_reads % 1000000 == 0) {
+            iomut.lock();
+            std::cout << "processed " << num_reads << " reads" << std::endl;
+            iomut.unlock();
+        }
+        if (buff_size > buff_thresh) {
+            std::string outs = ss.str();
+            ss.str("");
+            ofile_mut.lock();
+            out_file.write(outs.data(), outs.size());
+            ofile_mut.unlock();
+            buff_size = 0;
+        }
+    });
 
     // dump anything left in the buffer
     if (buff_size > 0) {
@@ -72,12 +75,14 @@ int kmer_conservation(FulgorIndex const& index,
 
 template <typename FulgorIndex>
 int kmer_conservation(std::string const& index_filename, std::string const& query_filename,
-                      std::string const& output_filename, const uint64_t num_threads,
+                      std::string const& output_filename, uint64_t num_threads,
+                      const uint64_t num_inflate_threads, const bool huge_pages,
                       const bool verbose) {
     FulgorIndex index;
     if (verbose) essentials::logger("loading index from disk...");
     essentials::load(index, index_filename.c_str());
     if (verbose) essentials::logger("DONE");
+    if (huge_pages) advise_huge_pages(index).print(std::cerr);
 
     std::ifstream is(query_filename.c_str());
     if (!is.good()) {
@@ -92,8 +97,32 @@ int kmer_conservation(std::string const& index_filename, std::string const& quer
     std::atomic<uint64_t> num_processed_reads{0};
     std::atomic<uint64_t> num_reads{0};
 
-    auto query_filenames = std::vector<std::string>({query_filename});
+    parallel_gunzip gunzip(query_filename, num_inflate_threads);
+
+    /* gzip/zstd blocks of the output are compressed by a quarter of the threads */
+    const uint64_t num_compression_threads = std::max<uint64_t>(num_threads / 4, 1);
+    output_file out_file;
+    if (!out_file.open(output_filename, num_compression_threads)) {
+        std::cerr << "could not open output file " + output_filename << std::endl;
+        return 1;
+    }
+
+    /*
+        The threads inflating the query and compressing the output are taken out of
+        num_threads, keeping at least the parser and one worker.
+    */
+    uint64_t num_helper_threads = 0;
+    if (gunzip.input_format() != parallel_gunzip::format::plain) {
+        num_helper_threads += gunzip.num_threads();
+    }
+    if (out_file.type() != output_file::compression::none) {
+        num_helper_threads += num_compression_threads;
+    }
     assert(num_threads >= 2);
+    num_threads -= std::min(num_helper_threads, num_threads - 2);
+    if (verbose) std::cout << "querying with " << num_threads - 1 << " worker thread(s)\n";
+
+    auto query_filenames = std::vector<std::string>({gunzip.filename()});
     fastx_parser::FastxParser<fastx_parser::ReadSeq> rparser(query_filenames, num_threads,
                                                              num_threads - 1);
 
@@ -103,27 +132,47 @@ int kmer_conservation(std::string const& index_filename, std::string const& quer
     std::mutex iomut;
     std::mutex ofile_mut;
 
-    std::ofstream out_file;
-    out_file.open(output_filename, std::ios::out | std::ios::trunc);
-    if (!out_file) {
-        std::cerr << "could not open output file " + output_filename << std::endl;
-        return 1;
-    }
-
+    read_scheduler<fastx_parser::ReadSeq> scheduler(num_threads - 1);
     for (uint64_t i = 1; i != num_threads; ++i) {
-        workers.push_back(std::thread([&index, &rparser, &num_reads, &num_processed_reads,
-                                       &out_file, &iomut, &ofile_mut, verbose]() {
-            kmer_conservation(index, rparser, num_reads, num_processed_reads, out_file, iomut,
-                              ofile_mut, verbose);
+        workers.push_back(std::thread([&index, &rparser, &scheduler, i, &num_reads,
+                                       &num_processed_reads, &out_file, &iomut, &ofile_mut,
+                                       verbose]() {
+            kmer_conservation(index, rparser, scheduler, i - 1, num_reads, num_processed_reads,
+                              out_file, iomut, ofile_mut, verbose);
         }));
     }
 
     for (auto& w : workers) w.join();
     rparser.stop();
+    try {
+        gunzip.finish();
+    } catch (std::exception const& e) {
+        std::cerr << "error in reading the file '" + query_filename + "': " << e.what()
+                  << std::endl;
+        if (!out_file.discard()) std::cerr << "the output is incomplete" << std::endl;
+        return 1;
+    }
+    try {
+        out_file.close();
+    } catch (std::exception const& e) {
+        std::cerr << "error in writing the file '" + output_filename + "': " << e.what()
+                  << std::endl;
+        out_file.discard();
+        return 1;
+    }
 
     t.stop();
     if (verbose) essentials::logger("DONE");
 
+    if (verbose) scheduler.print(std::cerr);
+
+    if (profiler::perf_counters_enabled()) profiler::print_perf_counters(std::cerr, num_reads);
+
+    if (profiler::enabled) {
+        profiler::write(output_filename);
+        if (verbose) essentials::logger("per-stage profile written next to the output");
+    }
+
     if (verbose) {
         std::cout << "processed " << num_reads << " reads" << std::endl;
         std::cout << "elapsed = " << t.elapsed() << " millisec / ";
@@ -144,13 +193,35 @@ int kmer_conservation(int argc, char** argv) {
     parser.add("output_filename",
                "File where output will be written. You can specify \"/dev/stdout\" to write "
                "output to stdout. In this case, it is also recommended to use the --verbose flag "
-               "to avoid printing status messages to stdout.",
+               "to avoid printing status messages to stdout. The output is compressed if the "
+               "filename ends with \".gz\" (or \".zst\", if compiled with zstd).",
                "-o", true);
-    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("num_threads",
+               "Number of threads (default is 1). They include the threads inflating a gzipped "
+               "query file and the num_threads / 4 (at least 1) threads compressing a "
+               "compressed output: the others parse the query and run the queries.",
+               "-t", false);
+    parser.add("inflate_threads",
+               "Number of threads, out of num_threads, inflating a gzipped query file ahead of "
+               "the parser: BGZF files are inflated block-parallel, plain gzip files by a single "
+               "thread. Use 0 to let the parser inflate the file. Default is num_threads / 4 "
+               "(at least 1).",
+               "--inflate-threads", false);
     parser.add("verbose", "Verbose output during query (default is false).", "--verbose", false,
                true);
+    parser.add("perf_counters",
+               "Count cycles, instructions, LLC misses, dTLB misses and branch mispredictions "
+               "of each worker thread with perf_event_open (Linux only) and print them to stderr "
+               "at the end. Compile with -D FULGOR_PROFILE=On to attribute them to query phases.",
+               "--perf-counters", false, true);
+    parser.add("huge_pages",
+               "Back the large arrays of the index with transparent huge pages (Linux only) "
+               "after loading it, and print the coverage to stderr.",
+               "--huge-pages", false, true);
     if (!parser.parse()) return 1;
 
+    if (parser.get<bool>("perf_counters")) profiler::enable_perf_counters();
+
     auto index_filename = parser.get<std::string>("index_filename");
     auto query_filename = parser.get<std::string>("query_filename");
     auto output_filename = parser.get<std::string>("output_filename");
@@ -163,25 +234,34 @@ int kmer_conservation(int argc, char** argv) {
             << "1 thread was specified, but an additional thread will be allocated for parsing"
             << std::endl;
     }
+    uint64_t num_inflate_threads = std::max<uint64_t>(num_threads / 4, 1);
+    if (parser.parsed("inflate_threads")) {
+        num_inflate_threads = parser.get<uint64_t>("inflate_threads");
+    }
 
+    bool huge_pages = parser.get<bool>("huge_pages");
     bool verbose = parser.get<bool>("verbose");
     if (verbose) util::print_cmd(argc, argv);
 
     if (sshash::util::ends_with(index_filename,
                                 constants::meta_diff_colored_fulgor_filename_extension)) {
         return kmer_conservation<meta_differential_index_type>(
-            index_filename, query_filename, output_filename, num_threads, verbose);
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            huge_pages, verbose);
     } else if (sshash::util::ends_with(index_filename,
                                        constants::meta_colored_fulgor_filename_extension)) {
         return kmer_conservation<meta_index_type>(index_filename, query_filename, output_filename,
-                                                  num_threads, verbose);
+                                                  num_threads, num_inflate_threads, huge_pages,
+                                                  verbose);
     } else if (sshash::util::ends_with(index_filename,
                                        constants::diff_colored_fulgor_filename_extension)) {
-        return kmer_conservation<differential_index_type>(index_filename, query_filename,
-                                                          output_filename, num_threads, verbose);
+        return kmer_conservation<differential_index_type>(
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            huge_pages, verbose);
     } else if (sshash::util::ends_with(index_filename, constants::fulgor_filename_extension)) {
         return kmer_conservation<index_type>(index_filename, query_filename, output_filename,
-                                             num_threads, verbose);
+                                             num_threads, num_inflate_threads, huge_pages,
+                                             verbose);
     }
 
     std::cerr << "Wrong index filename supplied." << std::endl;
@@ -0,0 +1,85 @@
+using namespace fulgor;
+
+int merge(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filenames",
+               "Comma-separated list of the Fulgor indexes to merge. They must be built with the "
+               "same k on disjoint sets of references. They are all loaded in memory at once: the "
+               "peak memory is the sum of their sizes plus the merged index being built.",
+               "-i", true);
+    parser.add("file_base_name", "File basename of the merged index.", "-o", true);
+    parser.add(
+        "tmp_dirname",
+        "Temporary directory used for construction in external memory. Default is directory '" +
+            constants::default_tmp_dirname + "'.",
+        "-d", false);
+    parser.add("RAM",
+               "RAM limit in GiB. Default value is " +
+                   std::to_string(constants::default_ram_limit_in_GiB) + ".",
+               "-g", false);
+    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("verbose", "Verbose output during construction.", "--verbose", false, true);
+    parser.add("check", "Check correctness after index construction (it might take some time).",
+               "--check", false, true);
+    parser.add("force", "Re-build the index even when an index with the same name is found.",
+               "--force", false, true);
+    if (!parser.parse()) return 1;
+    util::print_cmd(argc, argv);
+
+    auto index_filenames = util::split(parser.get<std::string>("index_filenames"), ',');
+    if (index_filenames.size() < 2) {
+        std::cerr << "Error: at least two indexes must be given." << std::endl;
+        return 1;
+    }
+    for (auto const& fn : index_filenames) {
+        if (!sshash::util::ends_with(fn, "." + constants::fulgor_filename_extension)) {
+            std::cerr << "Error: the file to merge '" << fn << "' must have extension \"."
+                      << constants::fulgor_filename_extension << "\"." << std::endl;
+            return 1;
+        }
+    }
+
+    build_configuration build_config;
+    build_config.file_base_name = parser.get<std::string>("file_base_name");
+    std::string output_filename =
+        build_config.file_base_name + "." + constants::fulgor_filename_extension;
+
+    if (std::filesystem::exists(output_filename)) {
+        std::cerr << "An index with the name '" << output_filename << "' alreay exists."
+                  << std::endl;
+        if (parser.get<bool>("force")) {
+            std::cerr << "Option '--force' specified: re-building the index." << std::endl;
+        } else {
+            std::cerr << "Use option '--force' to re-build the index." << std::endl;
+            return 1;
+        }
+    }
+
+    if (parser.parsed("tmp_dirname")) {
+        build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
+        essentials::create_directory(build_config.tmp_dirname);
+    }
+    if (parser.parsed("num_threads")) {
+        build_config.num_threads = parser.get<uint64_t>("num_threads");
+    }
+    if (parser.parsed("RAM")) build_config.ram_limit_in_GiB = parser.get<uint64_t>("RAM");
+    build_config.verbose = parser.get<bool>("verbose");
+    build_config.check = parser.get<bool>("check");
+
+    essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+    timer.start();
+    index_type index;
+    typename index_type::merge_builder builder(build_config, index_filenames);
+    builder.build(index);
+    index.print_stats();
+    timer.stop();
+    essentials::logger("DONE");
+    std::cout << "** merging the indexes took " << timer.elapsed() << " seconds / "
+              << timer.elapsed() / 60 << " minutes" << std::endl;
+
+    essentials::logger("saving index to disk...");
+    essentials::save(index, output_filename.c_str());
+    essentials::logger("DONE");
+
+    return 0;
+}
@@ -10,6 +10,15 @@ int permute(int argc, char** argv) {
             constants::default_tmp_dirname + "'.",
         "-d", false);
     parser.add("output_filename", "Output file where to save the permuted filenames.", "-o", true);
+    parser.add("RAM",
+               "RAM limit in GiB. Default value is " +
+                   std::to_string(constants::default_ram_limit_in_GiB) + ".",
+               "-g", false);
+    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("mini_batch",
+               "Use mini-batch k-means, with batches of this many sketches, when partitioning "
+               "the references (default is full-batch k-means).",
+               "--mini-batch", false);
     if (!parser.parse()) return 1;
     util::print_cmd(argc, argv);
 
@@ -18,6 +27,13 @@ int permute(int argc, char** argv) {
         build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
         essentials::create_directory(build_config.tmp_dirname);
     }
+    if (parser.parsed("num_threads")) {
+        build_config.num_threads = parser.get<uint64_t>("num_threads");
+    }
+    if (parser.parsed("RAM")) build_config.ram_limit_in_GiB = parser.get<uint64_t>("RAM");
+    if (parser.parsed("mini_batch")) {
+        build_config.clustering_mini_batch_size = parser.get<uint64_t>("mini_batch");
+    }
 
     auto index_filename = parser.get<std::string>("index_filename");
 
@@ -2,8 +2,14 @@
 #include <fstream>
 #include <sstream>
 
+#include "src/lookup.cpp"
 #include "src/ps_full_intersection.cpp"
 #include "src/ps_threshold_union.cpp"
+#include "include/federated_index.hpp"
+#include "include/numa.hpp"
+#include "include/parallel_gunzip.hpp"
+#include "include/read_scheduler.hpp"
+#include "include/output_file.hpp"
 
 using namespace fulgor;
 
@@ -24,54 +30,57 @@ std::string to_string(pseudoalignment_algorithm algo, double threshold) {
 
 template <typename FulgorIndex>
 int pseudoalign(FulgorIndex const& index, fastx_parser::FastxParser<fastx_parser::ReadSeq>& rparser,
+                read_scheduler<fastx_parser::ReadSeq>& scheduler, const uint64_t worker_id,
                 std::atomic<uint64_t>& num_reads, std::atomic<uint64_t>& num_mapped_reads,
-                pseudoalignment_algorithm algo, const double threshold, std::ofstream& out_file,
-                std::mutex& iomut, std::mutex& ofile_mut, const bool verbose)  //
+                std::atomic<uint64_t>& num_node_reads, pseudoalignment_algorithm algo,
+                const double threshold, output_file& out_file, std::mutex& iomut,
+                std::mutex& ofile_mut, const bool verbose)  //
 {
+    profiler::worker_scope worker_scope;  // for --perf-counters
     std::vector<uint32_t> colors;  // result of pseudoalignment
     std::stringstream ss;
     uint64_t buff_size = 0;
+    uint64_t num_local_reads = 0;
     constexpr uint64_t buff_thresh = 50;
 
-    auto rg = rparser.getReadGroup();
-    while (rparser.refill(rg)) {
-        for (auto const& record : rg) {
-            switch (algo) {
-                case pseudoalignment_algorithm::FULL_INTERSECTION:
-                    index.pseudoalign_full_intersection(record.seq, colors);
-                    break;
-                case pseudoalignment_algorithm::THRESHOLD_UNION:
-                    index.pseudoalign_threshold_union(record.seq, colors, threshold);
-                    break;
-                default:
-                    break;
-            }
-            buff_size += 1;
-            if (!colors.empty()) {
-                num_mapped_reads += 1;
-                ss << record.name << '\t' << colors.size();
-                for (auto c : colors) { ss << "\t" << c; }
-                ss << '\n';
-            } else {
-                ss << record.name << "\t0\n";
-            }
-            num_reads += 1;
-            colors.clear();
-            if (verbose and num_reads > 0 and num_reads % 1000000 == 0) {
-                iomut.lock();
-                std::cout << "mapped " << num_reads << " reads" << std::endl;
-                iomut.unlock();
-            }
-            if (buff_size > buff_thresh) {
-                std::string outs = ss.str();
-                ss.str("");
-                ofile_mut.lock();
-                out_file.write(outs.data(), outs.size());
-                ofile_mut.unlock();
-                buff_size = 0;
-            }
+    scheduler.run(rparser, worker_id, [&](fastx_parser::ReadSeq const& record) {
+        switch (algo) {
+            case pseudoalignment_algorithm::FULL_INTERSECTION:
+                index.pseudoalign_full_intersection(record.seq, colors);
+                break;
+            case pseudoalignment_algorithm::THRESHOLD_UNION:
+                index.pseudoalign_threshold_union(record.seq, colors, threshold);
+                break;
+            default:
+                break;
         }
-    }
+        buff_size += 1;
+        if (!colors.empty()) {
+            num_mapped_reads += 1;
+            ss << record.name << '\t' << colors.size();
+            for (auto c : colors) { ss << "\t" << c; }
+            ss << '\n';
+        } else {
+            ss << record.name << "\t0\n";
+        }
+        num_reads += 1;
+        num_local_reads += 1;
+        profiler::count(profiler::counter::reads, 1);
+        colors.clear();
+        if (verbose and num_reads > 0 and num_reads % 1000000 == 0) {
+            iomut.lock();
+            std::cout << "mapped " << num_reads << " reads" << std::endl;
+            iomut.unlock();
+        }
+        if (buff_size > buff_thresh) {
+            std::string outs = ss.str();
+            ss.str("");
+            ofile_mut.lock();
+            out_file.write(outs.data(), outs.size());
+            ofile_mut.unlock();
+            buff_size = 0;
+        }
+    });
 
     // dump anything left in the buffer
     if (buff_size > 0) {
@@ -83,18 +92,22 @@ int pseudoalign(FulgorIndex const& index, fastx_parser::FastxParser<fastx_parser
         buff_size = 0;
     }
 
+    num_node_reads += num_local_reads;
     return 0;
 }
 
+/*
+    Without a NUMA topology, replicas holds a single index. Otherwise, the w-th worker
+    is pinned to the core given by topology->place(w) and queries the replica of its
+    node (or the only one, when the index is interleaved over the nodes).
+*/
 template <typename FulgorIndex>
-int pseudoalign(std::string const& index_filename, std::string const& query_filename,
-                std::string const& output_filename, uint64_t num_threads, double threshold,
-                pseudoalignment_algorithm ps_alg, const bool verbose) {
-    FulgorIndex index;
-    if (verbose) essentials::logger("loading index from disk...");
-    essentials::load(index, index_filename.c_str());
-    if (verbose) essentials::logger("DONE");
-
+int pseudoalign(std::vector<FulgorIndex const*> const& replicas,
+                std::string const& query_filename, std::string const& output_filename,
+                uint64_t num_threads, uint64_t num_inflate_threads, double threshold,
+                pseudoalignment_algorithm ps_alg, numa::topology const* topology,
+                const bool verbose)  //
+{
     std::cerr << "query mode : " << to_string(ps_alg, threshold) << "\n";
 
     std::ifstream is(query_filename.c_str());
@@ -110,8 +123,37 @@ int pseudoalign(std::string const& index_filename, std::string const& query_file
     std::atomic<uint64_t> num_mapped_reads{0};
     std::atomic<uint64_t> num_reads{0};
 
-    auto query_filenames = std::vector<std::string>({query_filename});
+    parallel_gunzip gunzip(query_filename, num_inflate_threads);
+    if (verbose and gunzip.input_format() != parallel_gunzip::format::plain) {
+        std::cout << "inflating "
+                  << (gunzip.input_format() == parallel_gunzip::format::bgzf ? "BGZF" : "gzip")
+                  << " input with " << gunzip.num_threads() << " thread(s)" << std::endl;
+    }
+
+    /* gzip/zstd blocks of the output are compressed by a quarter of the threads */
+    const uint64_t num_compression_threads = std::max<uint64_t>(num_threads / 4, 1);
+    output_file out_file;
+    if (!out_file.open(output_filename, num_compression_threads)) {
+        std::cerr << "could not open output file " + output_filename << std::endl;
+        return 1;
+    }
+
+    /*
+        The threads inflating the query and compressing the output are taken out of
+        num_threads, keeping at least the parser and one worker.
+    */
+    uint64_t num_helper_threads = 0;
+    if (gunzip.input_format() != parallel_gunzip::format::plain) {
+        num_helper_threads += gunzip.num_threads();
+    }
+    if (out_file.type() != output_file::compression::none) {
+        num_helper_threads += num_compression_threads;
+    }
     assert(num_threads >= 2);
+    num_threads -= std::min(num_helper_threads, num_threads - 2);
+    if (verbose) std::cout << "querying with " << num_threads - 1 << " worker thread(s)\n";
+
+    auto query_filenames = std::vector<std::string>({gunzip.filename()});
     fastx_parser::FastxParser<fastx_parser::ReadSeq> rparser(query_filenames, num_threads,
                                                              num_threads - 1);
 
@@ -121,27 +163,70 @@ int pseudoalign(std::string const& index_filename, std::string const& query_file
     std::mutex iomut;
     std::mutex ofile_mut;
 
-    std::ofstream out_file;
-    out_file.open(output_filename, std::ios::out | std::ios::trunc);
-    if (!out_file) {
-        std::cerr << "could not open output file " + output_filename << std::endl;
-        return 1;
-    }
-
+    const uint64_t num_nodes = topology ? topology->num_nodes() : 1;
+    std::vector<std::atomic<uint64_t>> num_node_reads(num_nodes);
+    std::vector<uint64_t> num_node_workers(num_nodes, 0);
+    std::atomic<bool> pinned{true};
+    read_scheduler<fastx_parser::ReadSeq> scheduler(num_threads - 1);
     for (uint64_t i = 1; i != num_threads; ++i) {
-        workers.push_back(std::thread([&index, &rparser, &num_reads, &num_mapped_reads, ps_alg,
-                                       threshold, &out_file, &iomut, &ofile_mut, verbose]() {
-            pseudoalign(index, rparser, num_reads, num_mapped_reads, ps_alg, threshold, out_file,
-                        iomut, ofile_mut, verbose);
+        uint64_t node = 0;
+        uint32_t cpu = 0;
+        if (topology) std::tie(node, cpu) = topology->place(i - 1);
+        num_node_workers[node] += 1;
+        auto const& index = *replicas[node % replicas.size()];
+        auto& node_reads = num_node_reads[node];
+        workers.push_back(std::thread([&index, &rparser, &scheduler, i, &num_reads,
+                                       &num_mapped_reads, &node_reads, ps_alg, threshold,
+                                       &out_file, &iomut, &ofile_mut, verbose, topology, cpu,
+                                       &pinned]() {
+            if (topology and !numa::pin({cpu})) pinned = false;
+            pseudoalign(index, rparser, scheduler, i - 1, num_reads, num_mapped_reads,
+                        node_reads, ps_alg, threshold, out_file, iomut, ofile_mut, verbose);
         }));
     }
 
     for (auto& w : workers) w.join();
     rparser.stop();
+    try {
+        gunzip.finish();
+    } catch (std::exception const& e) {
+        std::cerr << "error in reading the file '" + query_filename + "': " << e.what()
+                  << std::endl;
+        if (!out_file.discard()) std::cerr << "the output is incomplete" << std::endl;
+        return 1;
+    }
+    try {
+        out_file.close();
+    } catch (std::exception const& e) {
+        std::cerr << "error in writing the file '" + output_filename + "': " << e.what()
+                  << std::endl;
+        out_file.discard();
+        return 1;
+    }
 
     t.stop();
     if (verbose) essentials::logger("DONE");
 
+    if (verbose) scheduler.print(std::cerr);
+
+    if (topology) {
+        if (!pinned) std::cerr << "warning: could not pin the workers to cores" << std::endl;
+        for (uint64_t i = 0; i != num_nodes; ++i) {
+            std::cerr << "node " << topology->node_id(i) << ": " << num_node_workers[i]
+                      << " workers, " << num_node_reads[i] << " reads, "
+                      << uint64_t(num_node_reads[i] * 1000.0 / std::max(t.elapsed(), 1.0))
+                      << " reads/s"
+                      << std::endl;
+        }
+    }
+
+    if (profiler::perf_counters_enabled()) profiler::print_perf_counters(std::cerr, num_reads);
+
+    if (profiler::enabled) {
+        profiler::write(output_filename);
+        if (verbose) essentials::logger("per-stage profile written next to the output");
+    }
+
     if (verbose) {
         std::cout << "mapped " << num_reads << " reads" << std::endl;
         std::cout << "elapsed = " << t.elapsed() << " millisec / ";
@@ -155,25 +240,161 @@ int pseudoalign(std::string const& index_filename, std::string const& query_file
     return 0;
 }
 
+template <typename FulgorIndex>
+int pseudoalign(std::string const& index_filename, std::string const& query_filename,
+                std::string const& output_filename, uint64_t num_threads,
+                uint64_t num_inflate_threads, double threshold, pseudoalignment_algorithm ps_alg,
+                std::string const& profile_filename,
+                std::string const& hot_sets_filename, const uint64_t hot_sets_budget_in_MiB,
+                const bool huge_pages, const numa::mode numa_mode, const bool verbose) {
+    numa::topology topology;
+    if (numa_mode != numa::mode::none) {
+        topology = numa::topology::detect();
+        if (verbose) topology.print(std::cout);
+    }
+
+    /* one replica per node with --numa replicate, a single index otherwise */
+    const uint64_t num_replicas =
+        numa_mode == numa::mode::replicate ? topology.num_nodes() : 1;
+    std::vector<FulgorIndex> replicas(num_replicas);
+    std::vector<hot_color_sets> hot_sets(num_replicas);
+    std::vector<huge_pages_report> huge_pages_reports(num_replicas);
+    std::vector<uint32_t> hot_sets_counts;
+    if (!hot_sets_filename.empty()) hot_sets_counts = color_set_profile::load(hot_sets_filename);
+
+    /* all allocations happen here, so that they follow the memory policy of the caller */
+    auto load = [&](uint64_t i) {
+        essentials::load(replicas[i], index_filename.c_str());
+        if (huge_pages) huge_pages_reports[i] = advise_huge_pages(replicas[i]);
+        if (!hot_sets_filename.empty()) {
+            hot_sets[i].build(replicas[i].get_color_sets(), hot_sets_counts,
+                              hot_sets_budget_in_MiB << 20);
+            replicas[i].set_hot_color_sets(&hot_sets[i]);
+        }
+    };
+
+    if (verbose) {
+        essentials::logger(num_replicas > 1 ? "loading one index replica per NUMA node..."
+                                            : "loading index from disk...");
+    }
+    if (numa_mode == numa::mode::replicate) {
+        numa::run_on_nodes(topology, load);
+    } else {
+        if (numa_mode == numa::mode::interleave and !numa::interleave(topology)) {
+            std::cerr << "warning: could not interleave the index over the NUMA nodes"
+                      << std::endl;
+        }
+        load(0);
+        if (numa_mode == numa::mode::interleave) numa::reset();
+    }
+    if (verbose) essentials::logger("DONE");
+    if (huge_pages) {
+        for (auto const& report : huge_pages_reports) report.print(std::cerr);
+    }
+    if (verbose and !hot_sets_filename.empty()) {
+        std::cout << "decoded " << hot_sets[0].num_hot_color_sets() << " hot color sets ("
+                  << hot_sets[0].num_bytes() / (1024.0 * 1024.0) << " [MiB]) per replica"
+                  << std::endl;
+    }
+
+    color_set_profile profile;
+    if (!profile_filename.empty()) {
+        profile.init(replicas[0].num_color_sets());
+        for (auto& index : replicas) index.set_color_set_profile(&profile);
+    }
+
+    std::vector<FulgorIndex const*> pointers;
+    for (auto const& index : replicas) pointers.push_back(&index);
+    int ret = pseudoalign(pointers, query_filename, output_filename, num_threads,
+                          num_inflate_threads, threshold, ps_alg,
+                          numa_mode != numa::mode::none ? &topology : nullptr, verbose);
+
+    if (ret == 0 and !profile_filename.empty()) {
+        profile.save(profile_filename);
+        if (verbose) essentials::logger("color set profile written to '" + profile_filename + "'");
+    }
+
+    return ret;
+}
+
+template <typename FulgorIndex>
+int pseudoalign(std::vector<std::string> const& index_filenames,
+                std::string const& query_filename, std::string const& output_filename,
+                uint64_t num_threads, uint64_t num_inflate_threads, double threshold,
+                pseudoalignment_algorithm ps_alg, const bool huge_pages, const bool verbose)  //
+{
+    federated_index<FulgorIndex> index;
+    index.load(index_filenames, verbose);
+    if (huge_pages) advise_huge_pages(index).print(std::cerr);
+    if (verbose) {
+        std::cout << "querying " << index.num_shards() << " shards with " << index.num_colors()
+                  << " colors in total" << std::endl;
+    }
+    std::vector<federated_index<FulgorIndex> const*> replicas = {&index};
+    return pseudoalign(replicas, query_filename, output_filename, num_threads,
+                       num_inflate_threads, threshold, ps_alg, nullptr, verbose);
+}
+
 int pseudoalign(int argc, char** argv) {
     cmd_line_parser::parser parser(argc, argv);
 
-    parser.add("index_filename", "The Fulgor index filename.", "-i", true);
+    parser.add("index_filename",
+               "The Fulgor index filename. A comma-separated list of indexes of the same type, "
+               "built on disjoint sets of references, is queried as a single index.",
+               "-i", true);
     parser.add("query_filename", "Query filename in FASTA/FASTQ format (optionally gzipped).", "-q",
                true);
     parser.add("output_filename",
                "File where output will be written. You can specify \"/dev/stdout\" to write "
                "output to stdout. In this case, it is also recommended to use the --verbose flag "
-               "to avoid printing status messages to stdout.",
+               "to avoid printing status messages to stdout. The output is compressed if the "
+               "filename ends with \".gz\" (or \".zst\", if compiled with zstd).",
                "-o", true);
-    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("num_threads",
+               "Number of threads (default is 1). They include the threads inflating a gzipped "
+               "query file and the num_threads / 4 (at least 1) threads compressing a "
+               "compressed output: the others parse the query and run the queries.",
+               "-t", false);
+    parser.add("inflate_threads",
+               "Number of threads, out of num_threads, inflating a gzipped query file ahead of "
+               "the parser: BGZF files are inflated block-parallel, plain gzip files by a single "
+               "thread. Use 0 to let the parser inflate the file. Default is num_threads / 4 "
+               "(at least 1).",
+               "--inflate-threads", false);
     parser.add("verbose", "Verbose output during query (default is false).", "--verbose", false,
                true);
+    parser.add("perf_counters",
+               "Count cycles, instructions, LLC misses, dTLB misses and branch mispredictions "
+               "of each worker thread with perf_event_open (Linux only) and print them to stderr "
+               "at the end. Compile with -D FULGOR_PROFILE=On to attribute them to query phases.",
+               "--perf-counters", false, true);
+    parser.add("huge_pages",
+               "Back the large arrays of the index with transparent huge pages (Linux only) "
+               "after loading it, and print the coverage to stderr.",
+               "--huge-pages", false, true);
     parser.add("threshold",
                "Threshold for threshold_union algorithm. It must be a float in (0.0,1.0].", "-r",
                false);
+    parser.add("profile",
+               "Record the access frequencies of the color sets and write them to this file.",
+               "--profile", false);
+    parser.add("hot_sets",
+               "Keep the most accessed color sets, according to the profile written with "
+               "--profile, in decoded form (full-intersection only).",
+               "--hot-sets", false);
+    parser.add("hot_sets_budget",
+               "Memory budget in MiB for the decoded hot color sets. Default value is " +
+                   std::to_string(constants::default_hot_sets_budget_in_MiB) + ".",
+               "--hot-sets-budget", false);
+    parser.add("numa",
+               "NUMA placement: 'interleave' spreads the index over all nodes, 'replicate' "
+               "loads one copy of the index per node. In both cases the workers are pinned to "
+               "cores, round-robin over the nodes (Linux only).",
+               "--numa", false);
     if (!parser.parse()) return 1;
 
+    if (parser.get<bool>("perf_counters")) profiler::enable_perf_counters();
+
     auto index_filename = parser.get<std::string>("index_filename");
     auto query_filename = parser.get<std::string>("query_filename");
     auto output_filename = parser.get<std::string>("output_filename");
@@ -186,6 +407,10 @@ int pseudoalign(int argc, char** argv) {
             << "1 thread was specified, but an additional thread will be allocated for parsing"
             << std::endl;
     }
+    uint64_t num_inflate_threads = std::max<uint64_t>(num_threads / 4, 1);
+    if (parser.parsed("inflate_threads")) {
+        num_inflate_threads = parser.get<uint64_t>("inflate_threads");
+    }
 
     double threshold = constants::invalid_threshold;
     if (parser.parsed("threshold")) threshold = parser.get<double>("threshold");
@@ -199,25 +424,90 @@ int pseudoalign(int argc, char** argv) {
         ps_alg = pseudoalignment_algorithm::THRESHOLD_UNION;
     }
 
+    std::string profile_filename;
+    if (parser.parsed("profile")) profile_filename = parser.get<std::string>("profile");
+    std::string hot_sets_filename;
+    if (parser.parsed("hot_sets")) hot_sets_filename = parser.get<std::string>("hot_sets");
+    uint64_t hot_sets_budget_in_MiB = constants::default_hot_sets_budget_in_MiB;
+    if (parser.parsed("hot_sets_budget")) {
+        hot_sets_budget_in_MiB = parser.get<uint64_t>("hot_sets_budget");
+    }
+
+    bool huge_pages = parser.get<bool>("huge_pages");
+    auto numa_mode = numa::mode::none;
+    if (parser.parsed("numa")) {
+        try {
+            numa_mode = numa::parse_mode(parser.get<std::string>("numa"));
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
     bool verbose = parser.get<bool>("verbose");
     if (verbose) util::print_cmd(argc, argv);
 
+    auto index_filenames = util::split(index_filename, ',');
+    if (index_filenames.size() > 1) {
+        if (!profile_filename.empty() or !hot_sets_filename.empty() or
+            numa_mode != numa::mode::none) {
+            std::cerr << "--profile, --hot-sets and --numa are not supported with multiple "
+                         "indexes"
+                      << std::endl;
+            return 1;
+        }
+        for (auto const& fn : index_filenames) {
+            if (util::extension(fn) != util::extension(index_filenames.front())) {
+                std::cerr << "all indexes must be of the same type" << std::endl;
+                return 1;
+            }
+        }
+        auto const& fn = index_filenames.front();
+        if (sshash::util::ends_with(fn, constants::meta_diff_colored_fulgor_filename_extension)) {
+            return pseudoalign<meta_differential_index_type>(
+                index_filenames, query_filename, output_filename, num_threads,
+                num_inflate_threads, threshold, ps_alg, huge_pages, verbose);
+        } else if (sshash::util::ends_with(fn,
+                                           constants::meta_colored_fulgor_filename_extension)) {
+            return pseudoalign<meta_index_type>(index_filenames, query_filename, output_filename,
+                                                num_threads, num_inflate_threads, threshold,
+                                                ps_alg, huge_pages, verbose);
+        } else if (sshash::util::ends_with(fn,
+                                           constants::diff_colored_fulgor_filename_extension)) {
+            return pseudoalign<differential_index_type>(
+                index_filenames, query_filename, output_filename, num_threads,
+                num_inflate_threads, threshold, ps_alg, huge_pages, verbose);
+        } else if (sshash::util::ends_with(fn, constants::fulgor_filename_extension)) {
+            return pseudoalign<index_type>(index_filenames, query_filename, output_filename,
+                                           num_threads, num_inflate_threads, threshold, ps_alg,
+                                           huge_pages, verbose);
+        }
+        std::cerr << "Wrong index filename supplied." << std::endl;
+        return 1;
+    }
+
     if (sshash::util::ends_with(index_filename,
                                 constants::meta_diff_colored_fulgor_filename_extension)) {
-        return pseudoalign<meta_differential_index_type>(index_filename, query_filename,
-                                                         output_filename, num_threads, threshold,
-                                                         ps_alg, verbose);
+        return pseudoalign<meta_differential_index_type>(
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            threshold, ps_alg, profile_filename, hot_sets_filename, hot_sets_budget_in_MiB,
+            huge_pages, numa_mode, verbose);
     } else if (sshash::util::ends_with(index_filename,
                                        constants::meta_colored_fulgor_filename_extension)) {
-        return pseudoalign<meta_index_type>(index_filename, query_filename, output_filename,
-                                            num_threads, threshold, ps_alg, verbose);
+        return pseudoalign<meta_index_type>(
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            threshold, ps_alg, profile_filename, hot_sets_filename, hot_sets_budget_in_MiB,
+            huge_pages, numa_mode, verbose);
     } else if (sshash::util::ends_with(index_filename,
                                        constants::diff_colored_fulgor_filename_extension)) {
-        return pseudoalign<differential_index_type>(index_filename, query_filename, output_filename,
-                                                    num_threads, threshold, ps_alg, verbose);
+        return pseudoalign<differential_index_type>(
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            threshold, ps_alg, profile_filename, hot_sets_filename, hot_sets_budget_in_MiB,
+            huge_pages, numa_mode, verbose);
     } else if (sshash::util::ends_with(index_filename, constants::fulgor_filename_extension)) {
-        return pseudoalign<index_type>(index_filename, query_filename, output_filename, num_threads,
-                                       threshold, ps_alg, verbose);
+        return pseudoalign<index_type>(
+            index_filename, query_filename, output_filename, num_threads, num_inflate_threads,
+            threshold, ps_alg, profile_filename, hot_sets_filename, hot_sets_budget_in_MiB,
+            huge_pages, numa_mode, verbose);
     }
 
     std::cerr << "Wrong index filename supplied." << std::endl;
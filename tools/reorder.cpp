@@ -0,0 +1,69 @@
+using namespace fulgor;
+
+int reorder(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename", "The Fulgor index filename to reorder.", "-i", true);
+    parser.add("output_filename", "Output file where to save the reordered index.", "-o", true);
+    parser.add(
+        "tmp_dirname",
+        "Temporary directory used for construction in external memory. Default is directory '" +
+            constants::default_tmp_dirname + "'.",
+        "-d", false);
+    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("profile_filename",
+               "A color-set access profile, as written by 'pseudoalign --profile', used to "
+               "pack the most accessed color sets together.",
+               "--profile", false);
+    parser.add("verbose", "Verbose output during construction.", "--verbose", false, true);
+    parser.add("check", "Check correctness after reordering (it might take some time).",
+               "--check", false, true);
+    if (!parser.parse()) return 1;
+    util::print_cmd(argc, argv);
+
+    build_configuration build_config;
+    build_config.index_filename_to_partition = parser.get<std::string>("index_filename");
+    if (!sshash::util::ends_with(build_config.index_filename_to_partition,
+                                 "." + constants::fulgor_filename_extension)) {
+        std::cerr << "Error: the file to reorder must have extension \"."
+                  << constants::fulgor_filename_extension
+                  << "\". Have you first built a Fulgor index with the tool \"build\"?"
+                  << std::endl;
+        return 1;
+    }
+    auto output_filename = parser.get<std::string>("output_filename");
+    if (!sshash::util::ends_with(output_filename, "." + constants::fulgor_filename_extension)) {
+        std::cerr << "Error: the output file must have extension \"."
+                  << constants::fulgor_filename_extension << "\"." << std::endl;
+        return 1;
+    }
+
+    if (parser.parsed("tmp_dirname")) {
+        build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
+        essentials::create_directory(build_config.tmp_dirname);
+    }
+    if (parser.parsed("num_threads")) {
+        build_config.num_threads = parser.get<uint64_t>("num_threads");
+    }
+    if (parser.parsed("profile_filename")) {
+        build_config.color_set_profile_filename = parser.get<std::string>("profile_filename");
+    }
+    build_config.check = parser.get<bool>("check");
+    build_config.verbose = parser.get<bool>("verbose");
+
+    essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+    timer.start();
+    index_type index;
+    typename index_type::reorder_builder builder(build_config);
+    builder.build(index);
+    index.print_stats();
+    timer.stop();
+    essentials::logger("DONE");
+    std::cout << "** reordering the index took " << timer.elapsed() << " seconds / "
+              << timer.elapsed() / 60 << " minutes" << std::endl;
+
+    essentials::logger("saving index to disk...");
+    essentials::save(index, output_filename.c_str());
+    essentials::logger("DONE");
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+using namespace fulgor;
+
+int update(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename", "The Fulgor index filename to update.", "-i", true);
+    parser.add("filenames_list", "Filenames list of the references to add.", "-l", true);
+    parser.add("file_base_name", "File basename of the updated index.", "-o", true);
+    parser.add(
+        "tmp_dirname",
+        "Temporary directory used for construction in external memory. Default is directory '" +
+            constants::default_tmp_dirname + "'.",
+        "-d", false);
+    parser.add("RAM",
+               "RAM limit in GiB. Default value is " +
+                   std::to_string(constants::default_ram_limit_in_GiB) + ".",
+               "-g", false);
+    parser.add("num_threads", "Number of threads (default is 1).", "-t", false);
+    parser.add("verbose", "Verbose output during construction.", "--verbose", false, true);
+    parser.add("check", "Check correctness after index construction (it might take some time).",
+               "--check", false, true);
+    parser.add("force", "Re-build the index even when an index with the same name is found.",
+               "--force", false, true);
+    if (!parser.parse()) return 1;
+    util::print_cmd(argc, argv);
+
+    build_configuration build_config;
+    build_config.index_filename_to_partition = parser.get<std::string>("index_filename");
+    if (!sshash::util::ends_with(build_config.index_filename_to_partition,
+                                 "." + constants::fulgor_filename_extension)) {
+        std::cerr << "Error: the file to update must have extension \"."
+                  << constants::fulgor_filename_extension
+                  << "\". Have you first built a Fulgor index with the tool \"build\"?"
+                  << std::endl;
+        return 1;
+    }
+    build_config.filenames_list = parser.get<std::string>("filenames_list");
+    build_config.file_base_name = parser.get<std::string>("file_base_name");
+    std::string output_filename =
+        build_config.file_base_name + "." + constants::fulgor_filename_extension;
+    if (output_filename == build_config.index_filename_to_partition) {
+        std::cerr << "Error: the updated index must have a different name." << std::endl;
+        return 1;
+    }
+
+    if (std::filesystem::exists(output_filename)) {
+        std::cerr << "An index with the name '" << output_filename << "' alreay exists."
+                  << std::endl;
+        if (parser.get<bool>("force")) {
+            std::cerr << "Option '--force' specified: re-building the index." << std::endl;
+        } else {
+            std::cerr << "Use option '--force' to re-build the index." << std::endl;
+            return 1;
+        }
+    }
+
+    if (parser.parsed("tmp_dirname")) {
+        build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
+        essentials::create_directory(build_config.tmp_dirname);
+    }
+    if (parser.parsed("num_threads")) {
+        build_config.num_threads = parser.get<uint64_t>("num_threads");
+    }
+    if (parser.parsed("RAM")) build_config.ram_limit_in_GiB = parser.get<uint64_t>("RAM");
+    build_config.verbose = parser.get<bool>("verbose");
+    build_config.check = parser.get<bool>("check");
+
+    essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> timer;
+    timer.start();
+    index_type index;
+    typename index_type::update_builder builder(build_config);
+    builder.build(index);
+    index.print_stats();
+    timer.stop();
+    essentials::logger("DONE");
+    std::cout << "** updating the index took " << timer.elapsed() << " seconds / "
+              << timer.elapsed() / 60 << " minutes" << std::endl;
+
+    essentials::logger("saving index to disk...");
+    essentials::save(index, output_filename.c_str());
+    essentials::logger("DONE");
+
+    return 0;
+}